@@ -0,0 +1,107 @@
+#ifndef ARG_GLOB_H_INCLUDED
+#define ARG_GLOB_H_INCLUDED
+
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* arg_glob.h */
+
+/* Wildcard expansion of command-line arguments, used by arg_parser.c.
+   Directories are enumerated through a backend, so the expansion does not depend
+  on the Win32 API and may be built and tested on any platform.
+
+   Pattern syntax:
+   *        - matches any (possibly empty) sequence of characters,
+   ?        - matches any single character,
+   [...]    - matches one character from the set, e.g. [abc] or [a-z],
+   [!...]   - (or [^...]) matches one character not in the set,
+   {a,b,..} - matches any of the comma-separated alternatives, may be nested,
+   **       - as a whole path component, matches any number of nested directories,
+              including none, symbolic links and junctions are not followed.
+   Both '\' and '/' separate path components, there is no escape character:
+  to match '*', '?', '[' or '{' literally, enclose it in brackets, e.g. [*].
+   Characters are compared case-insensitively, by the Unicode case mapping of
+  unicode_ctype, not depending on the current locale.  The "*.*" component matches any
+  name, as it does in cmd.exe.
+   Prefixes "\\?\", "\\.\" and the drive "X:" are never matched as wildcards, e.g.
+  "C:*.txt" lists the current directory of the drive C:.
+   Found names are returned with the directory prefix, as it was typed in the pattern.
+   This matcher works on UTF-16 names and is separate from localerpl_fnmatch() (see
+  localerpl.h), which matches strings in the locale encoding by POSIX rules.  It differs
+  from localerpl_fnmatch() in that:
+  - braces {a,b} and the "**" component are supported only here;
+  - "*.*" matches any name here, even one without a dot;
+  - there is no escape character here, and '\' separates path components;
+  - character classes are not supported here: [[:alpha:]] is the set of the characters
+    '[', ':', 'a', 'l', 'p', 'h' followed by ']';
+  - a leading '.' is matched by wildcards here, as without LOCALERPL_FNM_PERIOD;
+  - case is always ignored here, by comparing unicode_toupper() of the characters,
+    localerpl_fnmatch() ignores case only with LOCALERPL_FNM_CASEFOLD and compares
+    localerpl_c32tolower() of the characters, which uses the CRT in non-UTF-8 locales.
+    The results differ for a few characters, e.g. U+017F LATIN SMALL LETTER LONG S
+    matches 's' here but not in localerpl_fnmatch().  */
+
+#include "mscrtx/arg_tokenizer.h"
+
+/* Maximum size of a file name returned by the directory enumeration backend,
+  in wide-characters, including the terminating L'\0' (the same as MAX_PATH).  */
+#define ARG_FIND_NAME_MAX 260
+
+/* Attributes of a found file.  */
+#define ARG_FIND_DIR  1u /* a directory */
+#define ARG_FIND_LINK 2u /* a symbolic link or a junction */
+
+/* Directory enumeration backend.
+   On Windows, the default one is based on FindFirstFileExW(), see arg_set_find_backend().  */
+struct arg_find_backend {
+	/* Start search of the files matching the pattern, store the name of the first one
+	  and its ARG_FIND_... attributes.
+	   Only the last component of the pattern may contain wildcards, and it is either
+	  "*" or a literal name.
+	   Returns the search handle, or NULL if no files match.  */
+	void *(*find_first)(const wchar_t pattern[], wchar_t name[ARG_FIND_NAME_MAX], unsigned *attrs);
+	/* Store the name of the next found file, returns 0 if there are no more files.  */
+	int (*find_next)(void *handle, wchar_t name[ARG_FIND_NAME_MAX], unsigned *attrs);
+	/* Finish the search.  */
+	void (*find_close)(void *handle);
+};
+
+#ifndef _WIN32
+/* Directory enumeration backend based on opendir()/readdir(), to test or benchmark
+  the expansion on POSIX systems, where wchar_t is 2 bytes (e.g. gcc -fshort-wchar).
+   File names are converted between utf16 and utf8, names that are not valid utf8
+  are skipped.  */
+extern const struct arg_find_backend arg_readdir_find_backend;
+#endif
+
+/* Check if the argument contains wildcards: '*', '?', a bracket expression or
+  a brace expression with alternatives.
+   Returns non-zero if the argument should be expanded.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_At(arg, A_In_z)
+#endif
+int arg_glob_has_magic(const wchar_t arg[]);
+
+/* Append names of the files matching the pattern to the out buffer, one after another,
+  each terminated by L'\0'.  Names "." and ".." are skipped.
+   Pattern may point into the out buffer, before out->filled.
+   Sets *matched to non-zero if any file, including "." or "..", matches the pattern.
+   Returns the number of appended names, or (size_t)-1 on failure, out->filled is not
+  changed then. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(backend, A_In)
+A_At(pattern, A_In_z)
+A_At(out, A_Inout)
+A_At(matched, A_Out)
+A_Success(return != A_Size_t(-1))
+#endif
+size_t arg_expand_wildcard(const struct arg_find_backend *const backend,
+	const wchar_t pattern[], struct arg_tok_buf *const out/*in,out*/, int *const matched/*out*/);
+
+#endif /* ARG_GLOB_H_INCLUDED */
@@ -9,6 +9,8 @@
 
 /* arg_parser.h */
 
+#include "mscrtx/arg_glob.h"
+
 struct wide_arg {
 	struct wide_arg *next;
 	wchar_t value[1];
@@ -26,12 +28,153 @@ A_Success(return)
 #endif
 struct wide_arg *arg_parse_command_line(int *const argc/*out*/);
 
-/* Free arguments list created by arg_parse_command_line() */
+/* Flags for arg_parse_command_line_ex(), arg_parse_command_line_argv_ex() and
+  arg_parse_command_line_utf8_ex() */
+#define ARG_PARSE_WILDCARDS      1u /* expand wildcards in arguments, see arg_glob.h */
+#define ARG_PARSE_RESPONSE_FILES 2u /* replace "@path" arguments by the contents of response files */
+
+/* Same as arg_parse_command_line(), but wildcards are expanded only if ARG_PARSE_WILDCARDS
+  is specified.
+   If ARG_PARSE_RESPONSE_FILES is specified, an argument of the form "@path" is replaced by
+  the arguments read from the response file path, see arg_rsp_decode() about the encoding.
+  Arguments in the response file may be separated by newlines, wildcards in them are
+  expanded if ARG_PARSE_WILDCARDS is specified, "@path" arguments are not expanded.
+   Returns NULL on failure, e.g. if a response file cannot be read (errno is set to ENOENT). */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(argc, A_Out)
+A_Success(return)
+#endif
+struct wide_arg *arg_parse_command_line_ex(int *const argc/*out*/, const unsigned flags);
+
+/* Free arguments list created by arg_parse_command_line() or arg_parse_command_line_ex() */
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_At(list, A_In_opt A_Post_ptr_invalid)
 #endif
 void arg_free_wide_args(struct wide_arg *list);
 
+/* Same as arg_parse_command_line(), but returns arguments in one block:
+  NULL-terminated array of pointers followed by L'\0'-terminated strings.
+   The block is grown geometrically while parsing, free it with arg_free_wargv().
+   Returns NULL on failure. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(argc, A_Out)
+A_Success(return)
+#endif
+wchar_t **arg_parse_command_line_argv(int *const argc/*out*/);
+
+/* Same as arg_parse_command_line_argv(), but flags are the same as for
+  arg_parse_command_line_ex(). */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(argc, A_Out)
+A_Success(return)
+#endif
+wchar_t **arg_parse_command_line_argv_ex(int *const argc/*out*/, const unsigned flags);
+
+/* Same as arg_parse_command_line(), but returns arguments converted to utf8, in one block:
+  NULL-terminated array of pointers followed by '\0'-terminated strings.
+   Each argument is converted right after it is parsed, without the size-computing pass.
+   Useful in utf8 locale (see localerpl_is_utf8()), free result with arg_free_argv().
+   Returns NULL on failure, errno is set to EILSEQ if an argument has an unpaired surrogate. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(argc, A_Out)
+A_Success(return)
+#endif
+char **arg_parse_command_line_utf8(int *const argc/*out*/);
+
+/* Same as arg_parse_command_line_utf8(), but flags are the same as for
+  arg_parse_command_line_ex(). */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(argc, A_Out)
+A_Success(return)
+#endif
+char **arg_parse_command_line_utf8_ex(int *const argc/*out*/, const unsigned flags);
+
+/* Flags for arg_iter_init() */
+#define ARG_ITER_WILDCARDS      ARG_PARSE_WILDCARDS      /* expand wildcards in arguments */
+#define ARG_ITER_RESPONSE_FILES ARG_PARSE_RESPONSE_FILES /* expand "@path" arguments */
+
+/* Reader of the command-line tokens, expanding "@path" arguments, private.  */
+struct arg_reader {
+	const wchar_t *line;    /* current position in the command line */
+	wchar_t *rsp;           /* malloc'ated text of the response file being read, or NULL */
+	const wchar_t *rsp_pos; /* current position in rsp */
+	unsigned n;             /* number of parsed command-line tokens */
+	unsigned flags;         /* ARG_PARSE_RESPONSE_FILES? */
+};
+
+/* Iterator over the command-line arguments.
+   Fields are private, use arg_iter_init(), arg_iter_next() and arg_iter_destroy().  */
+struct arg_iter {
+	struct arg_reader rd;  /* reader of the command line and response files */
+	wchar_t *modname;      /* malloc'ated program name if the command line is empty, or NULL */
+	size_t found;          /* number of found files not returned yet */
+	size_t next;           /* offset of the next found file name in tb */
+	struct arg_tok_buf tb; /* buffer of the current argument */
+	unsigned flags;        /* ARG_ITER_WILDCARDS? */
+};
+
+/* Initialize iterator over the command-line arguments.
+   buf - caller-provided buffer for the arguments, of sz wide-characters: the heap
+  is not used while the arguments (and the files found by one pattern) fit in the buffer.
+   flags - 0 or combination of ARG_ITER_WILDCARDS and ARG_ITER_RESPONSE_FILES, the latter -
+  to return the arguments of the response file in place of the "@path" argument,
+  as arg_parse_command_line_ex() does.
+   Returns 0 on failure, else arg_iter_destroy() must be called when done. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(it, A_Out)
+A_At(buf, A_Out_writes_opt(sz))
+A_Success(return)
+#endif
+int arg_iter_init(struct arg_iter *const it/*out*/,
+	wchar_t buf[/*sz*/]/*NULL?*/, const size_t sz/*0?*/, const unsigned flags);
+
+/* Get next argument: first argument is the program name.
+   Unescaped double-quotes are removed, wildcards are expanded if ARG_ITER_WILDCARDS was
+  specified (found files are returned one by one, in place of the pattern), response
+  files are read if ARG_ITER_RESPONSE_FILES was specified.
+   On success, sets *arg to the L'\0'-terminated argument, valid until the next call,
+  and, if len != NULL, *len to its length, returns 1.
+   Returns 0 if there are no more arguments, -1 on failure. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(2)
+A_At(it, A_Inout)
+A_At(arg, A_Out)
+A_At(len, A_Out_opt)
+A_Success(return > 0)
+#endif
+int arg_iter_next(struct arg_iter *const it/*in,out*/,
+	const wchar_t **const arg/*out*/, size_t *const len/*NULL?,out*/);
+
+/* Destroy iterator initialized by arg_iter_init(), free allocated memory. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Nonnull_all_args
+A_At(it, A_Inout)
+#endif
+void arg_iter_destroy(struct arg_iter *const it);
+
+/* Set the directory enumeration backend used to expand wildcards, e.g. to test
+  or benchmark the expansion.  If backend is NULL, restore the default one, based on
+  FindFirstFileExW().
+   Must not be called while arguments are being parsed. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_At(backend, A_In_opt)
+#endif
+void arg_set_find_backend(const struct arg_find_backend *const backend/*NULL?*/);
+
 /* Get program module name.
    sz - is the buf size, in wide-chars, if 0 - the buf is not used.
    Returns buf or new malloc'ated buffer if buf is too small.
@@ -50,6 +193,7 @@ struct arg_convert_err {
 };
 
 /* Convert program arguments from wide-char to multibyte according to current locale.
+   Only first argc arguments of the list are converted.
    Returns NULL-terminated array of pointers to '\0'-terminated strings.
    Returns NULL on error and, if err != NULL, fills err:
   err->number and err->arg are will be set only if failed to convert an argument
@@ -64,7 +208,7 @@ A_Success(return)
 char **arg_convert_wide_args(const unsigned argc, const struct wide_arg *list,
 	struct arg_convert_err *const err/*NULL?,out*/);
 
-/* Free arguments array allocated by arg_convert_wide_args() */
+/* Free arguments array allocated by arg_convert_wide_args() or arg_parse_command_line_utf8() */
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Nonnull_all_args
 A_At(argv, A_In A_Post_ptr_invalid)
@@ -91,7 +235,7 @@ A_Success(return)
 wchar_t **arg_convert_mb_args(char *const argv[]/*!=NULL*/,
 	struct arg_convert_mb_err *const err/*NULL?,out*/);
 
-/* Free arguments array allocated by arg_convert_mb_args() */
+/* Free arguments array allocated by arg_convert_mb_args() or arg_parse_command_line_argv() */
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Nonnull_all_args
 A_At(wargv, A_In A_Post_ptr_invalid)
@@ -0,0 +1,160 @@
+#ifndef ARG_TOKENIZER_H_INCLUDED
+#define ARG_TOKENIZER_H_INCLUDED
+
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* arg_tokenizer.h */
+
+/* Command line tokenizer used by arg_parser.c.
+   Works over a caller-supplied L'\0'-terminated buffer and does not depend on
+  the Win32 API, so it may be built and tested on any platform.  */
+
+#include <stddef.h> /* for size_t, wchar_t */
+
+/* Growable output buffer of the tokenizer.
+   Initially, buf may point to a caller-supplied (e.g. stack) buffer of size
+  wide-characters, with own == 0, or be NULL with size == 0.
+   When the buffer is too small, it is replaced by a malloc'ated one, which is
+  then grown geometrically by realloc(), own is set to non-zero.
+   If own != 0, the caller must free(buf) when done.  */
+struct arg_tok_buf {
+	wchar_t *buf;  /* NULL? */
+	size_t filled; /* number of used wide-characters */
+	size_t size;   /* number of allocated wide-characters */
+	int own;       /* non-zero if buf was allocated by malloc() */
+};
+
+/* Make sure there is a space for at least need wide-characters after
+  out->filled ones.
+   Returns 0 on failure (errno is set to ENOMEM or E2BIG).  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(out, A_Inout)
+A_Success(return)
+#endif
+int arg_tok_buf_reserve(struct arg_tok_buf *const out/*in,out*/, const size_t need);
+
+/* Parse program name at the beginning of the command line.
+   Double-quotes are removed, there are no escape sequences.
+   Appends the L'\0'-terminated name to the out buffer, growing it as needed, so
+  the name is scanned only once, however long it is.
+   On success, updates *line to point after the parsed name, advances
+  out->filled past the L'\0' and returns the length of the name.
+   Returns (size_t)-1 on failure, out->filled is not changed.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(line, A_Inout)
+A_At(*line, A_In_z)
+A_At(out, A_Inout)
+A_Success(return != A_Size_t(-1))
+#endif
+size_t arg_tokenize_module_name(const wchar_t **const line/*in,out*/,
+	struct arg_tok_buf *const out/*in,out*/);
+
+/* Parse one argument at the beginning of the command line.
+   Unescaped double-quotes are removed, backslashes before double-quotes are halved.
+   Appends the L'\0'-terminated argument to the out buffer, growing it as needed.
+   On success, updates *line to point after the parsed argument, advances
+  out->filled past the L'\0' and returns the length of the argument.
+   Returns (size_t)-1 on failure, out->filled is not changed.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(line, A_Inout)
+A_At(*line, A_In_z)
+A_At(out, A_Inout)
+A_Success(return != A_Size_t(-1))
+#endif
+size_t arg_tokenize_arg(const wchar_t **const line/*in,out*/,
+	struct arg_tok_buf *const out/*in,out*/);
+
+/* Skip spaces and tabs between arguments.
+   Returns pointer to the first non-space character, may be the terminating L'\0'. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Ret_never_null
+A_At(line, A_In_z)
+#endif
+const wchar_t *arg_skip_spaces(const wchar_t *line);
+
+/* Response files.
+   Arguments in a response file are parsed with the same rules as by arg_tokenize_arg(),
+  but newlines also separate arguments.  */
+
+/* Decode the contents of a response file of size bytes.
+   The encoding is detected by the BOM: UTF-16LE, UTF-16BE or UTF-8; without a BOM,
+  the contents are assumed to be UTF-8.  The BOM is skipped.
+   Returns malloc'ated L'\0'-terminated text, or NULL on failure (errno is set to
+  ENOMEM, E2BIG, or EILSEQ - if the contents are not valid UTF-8 or UTF-16: have
+  unpaired surrogates, an odd number of bytes of UTF-16, or a null character). */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_At(data, A_In_reads_bytes_opt(size))
+A_Ret_z
+A_Success(return)
+#endif
+wchar_t *arg_rsp_decode(const void *const data/*NULL?*/, size_t size/*0?*/);
+
+/* Parse one argument at the beginning of the decoded response file text.
+   Same as arg_tokenize_arg(), but L'\n' and L'\r' also end an argument. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(line, A_Inout)
+A_At(*line, A_In_z)
+A_At(out, A_Inout)
+A_Success(return != A_Size_t(-1))
+#endif
+size_t arg_tokenize_rsp_arg(const wchar_t **const line/*in,out*/,
+	struct arg_tok_buf *const out/*in,out*/);
+
+/* Skip spaces, tabs and newlines between arguments in the response file text.
+   Returns pointer to the first non-space character, may be the terminating L'\0'. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Ret_never_null
+A_At(text, A_In_z)
+#endif
+const wchar_t *arg_skip_rsp_spaces(const wchar_t *text);
+
+/* Command line encoder - the inverse of the tokenizer.  */
+
+/* Build a command line from the NULL-terminated vector of arguments, so that it is
+  parsed back to the same arguments by the tokenizer (and by the CRT of a started program).
+   argv[0] - the program name - is parsed by arg_tokenize_module_name(), so it must not
+  contain double-quotes; it is enclosed in double-quotes if it is empty or contains
+  spaces or tabs.
+   Other arguments are escaped minimally: an argument without spaces, tabs and
+  double-quotes is copied as is, double-quotes are escaped by backslashes (doubling the
+  backslashes before them), and only empty arguments or arguments with spaces or tabs
+  are enclosed in double-quotes (doubling the backslashes at the end).
+   Arguments are separated by one space.
+   The exact size of the command line is computed first, then it is written to
+  the allocated buffer.
+   Returns malloc'ated L'\0'-terminated command line, or NULL on failure (errno is set
+  to EINVAL - if the program name contains a double-quote, ENOMEM or E2BIG). */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(argv, A_In)
+A_Ret_z
+A_Success(return)
+#endif
+wchar_t *arg_encode_command_line(const wchar_t *const argv[]);
+
+/* Same as arg_encode_command_line(), but the arguments are in UTF-8.
+   Returns NULL on failure, errno is also set to EILSEQ if an argument is not valid UTF-8. */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(argv, A_In)
+A_Ret_z
+A_Success(return)
+#endif
+wchar_t *arg_encode_command_line_utf8(const char *const argv[]);
+
+#endif /* ARG_TOKENIZER_H_INCLUDED */
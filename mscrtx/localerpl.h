@@ -52,6 +52,20 @@ A_Check_return
 #endif
 int localerpl_is_utf8(void);
 
+/* In UTF-8 mode, path wrappers (localerpl_open(), localerpl_stat(), ...) convert
+  paths to utf16 in stack buffers, and paths longer than MAX_PATH - in per-thread
+  scratch buffers, which grow on demand, are reused and are freed at the exit of the thread.
+  Free scratch buffers of the calling thread that are larger than keep wide characters,
+  pass 0 to free all of them (e.g. after a burst of long paths).  */
+void localerpl_scratch_trim(size_t keep);
+
+/* Returns the high-water mark of the scratch buffers of the calling thread:
+  maximum size in wide characters (including terminating L'\0') of converted path.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+#endif
+size_t localerpl_scratch_hwm(void);
+
 /* Returns locale code page number (based on the value of LC_CTYPE).
   For example, for UTF-8 locale, code page number is 65001.  */
 /* Returns 0 if using "C" locale.  */
@@ -627,6 +641,92 @@ int localerpl_chmod(const char *path, int mode);
 # endif
 #endif
 
+/* Same as above, but paths are passed as pointer+length slices (without terminating '\0'),
+  paths must not contain '\0'.  */
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(name, A_In_reads(name_len))
+A_Success(return >= 0)
+#endif
+int localerpl_open_n(const char *name, size_t name_len, int flags, ...);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(path, A_In_reads(path_len))
+A_At(mode, A_In_z)
+A_Success(return)
+#endif
+FILE *localerpl_fopen_n(const char *path, size_t path_len, const char *mode);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(dirname, A_In_reads(dirname_len))
+A_Success(!return)
+#endif
+int localerpl_mkdir_n(const char *dirname, size_t dirname_len);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(dirname, A_In_reads(dirname_len))
+A_Success(!return)
+#endif
+int localerpl_rmdir_n(const char *dirname, size_t dirname_len);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(pathname, A_In_reads(pathname_len))
+A_Success(!return)
+#endif
+int localerpl_remove_n(const char *pathname, size_t pathname_len);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(pathname, A_In_reads(pathname_len))
+A_Success(!return)
+#endif
+int localerpl_unlink_n(const char *pathname, size_t pathname_len);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(old_name, A_In_reads(old_name_len))
+A_At(new_name, A_In_reads(new_name_len))
+A_Success(!return)
+#endif
+int localerpl_rename_n(const char *old_name, size_t old_name_len,
+	const char *new_name, size_t new_name_len);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(path, A_In_reads(path_len))
+A_Success(!return)
+#endif
+int localerpl_chdir_n(const char *path, size_t path_len);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(path, A_In_reads(path_len))
+A_At(buf, A_Out)
+A_Success(!return)
+#endif
+int localerpl_stat_n(const char *path, size_t path_len, struct __stat64 *buf);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Nonnull_all_args
+A_At(path, A_In_reads(path_len))
+A_Success(!return)
+#endif
+int localerpl_chmod_n(const char *path, size_t path_len, int mode);
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Ret_z
@@ -977,6 +1077,78 @@ int localerpl_stricmp(const char *s1, const char *s2);
 # endif
 #endif
 
+/* Flags for localerpl_fnmatch() */
+#define LOCALERPL_FNM_NOESCAPE 0x01 /* backslash is an ordinary character */
+#define LOCALERPL_FNM_PATHNAME 0x02 /* wildcards do not match '/' */
+#define LOCALERPL_FNM_PERIOD   0x04 /* leading '.' (after '/' - if LOCALERPL_FNM_PATHNAME)
+                                       must be matched by '.' in the pattern */
+#define LOCALERPL_FNM_CASEFOLD 0x10 /* ignore case, as localerpl_stricmp() does */
+
+/* Returned by localerpl_fnmatch() if the string does not match the pattern */
+#define LOCALERPL_FNM_NOMATCH 1
+
+/* Match the string against the shell wildcard pattern in the current locale encoding.
+   The pattern may contain '*', '?', bracket expressions: [a-z], [!a-z] (or [^a-z]),
+  with character classes like [:alpha:], and '\' to escape the next character
+  (unless LOCALERPL_FNM_NOESCAPE is specified).
+   With LOCALERPL_FNM_PATHNAME, a bracket expression containing '/' is not special.
+   With LOCALERPL_FNM_CASEFOLD, ranges and character classes also match the characters
+  whose lower or upper case is in them: [[:upper:]] matches 'a'.
+   Collating symbols [. .] and equivalence classes [= =] are not supported.
+   Bytes that do not form a valid character match only themselves.
+   Returns 0 if the string matches, else LOCALERPL_FNM_NOMATCH.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(pattern, A_In_z)
+A_At(string, A_In_z)
+#endif
+int localerpl_fnmatch(const char *pattern, const char *string, int flags);
+
+#ifndef localerpl_do_not_redefine_fnmatch
+# ifndef LOCALE_RPL_IMPL
+#  ifdef fnmatch
+#   undef fnmatch
+#  endif
+#  define fnmatch localerpl_fnmatch
+#  ifndef FNM_NOMATCH
+#   define FNM_NOMATCH  LOCALERPL_FNM_NOMATCH
+#   define FNM_NOESCAPE LOCALERPL_FNM_NOESCAPE
+#   define FNM_PATHNAME LOCALERPL_FNM_PATHNAME
+#   define FNM_PERIOD   LOCALERPL_FNM_PERIOD
+#   define FNM_CASEFOLD LOCALERPL_FNM_CASEFOLD
+#  endif
+# endif
+#endif
+
+/* Pattern compiled by localerpl_fnmatch_compile(), to match many strings against it.
+   Strings that cannot match - because they lack the literal prefix of the pattern or
+  the longest literal part of it - are rejected before running the full matcher.  */
+struct localerpl_fnpat;
+
+/* Compile the pattern for localerpl_fnmatch_exec(), flags - as for localerpl_fnmatch().
+   The compiled pattern must not be used after the locale encoding is changed.
+   Returns NULL on failure (errno is set to ENOMEM).  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(pattern, A_In_z)
+A_Success(return)
+#endif
+struct localerpl_fnpat *localerpl_fnmatch_compile(const char *pattern, int flags);
+
+/* Same as localerpl_fnmatch(), but for the compiled pattern.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(pat, A_In)
+A_At(string, A_In_z)
+#endif
+int localerpl_fnmatch_exec(const struct localerpl_fnpat *pat, const char *string);
+
+/* Free the pattern compiled by localerpl_fnmatch_compile().  */
+void localerpl_fnmatch_free(struct localerpl_fnpat *pat/*NULL?*/);
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_At(c, A_In_range(0,255))
@@ -1495,6 +1667,17 @@ size_t localerpl_mbstoc32s(unsigned *dst, const char *src, size_t n);
 # endif
 #endif
 
+/* Count characters of the multibyte string, not counting the terminating '\0'.
+   In UTF-8 mode the string is only validated and counted, by SIMD code if available.
+   Returns (size_t)-1 and sets errno to EILSEQ if the string is invalid.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(s, A_In_z)
+A_Success(return != A_Size_t(-1))
+#endif
+size_t localerpl_mbslen(const char *s);
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Nonnull_arg(2)
@@ -1549,6 +1732,10 @@ size_t localerpl_c32stowcs(wchar_t *dst, const unsigned *src, size_t n);
 # endif
 #endif
 
+/* Same as _spawnvp(), in UTF-8 mode - paths and arguments are in UTF-8.
+   As _spawnvp(), arguments are joined by spaces without quoting, so the caller must
+  quote arguments containing spaces, tabs or double-quotes - in both modes.
+   To pass arguments as is, use localerpl_spawnvp_quoted().  */
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Nonnull_all_args
@@ -1566,6 +1753,8 @@ intptr_t localerpl_spawnvp(int mode, const char *cmdname, const char *const *arg
 # endif
 #endif
 
+/* Same as _spawnl(), in UTF-8 mode - paths and arguments are in UTF-8.
+   Arguments are not quoted, as by localerpl_spawnvp().  */
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_At(cmdname, A_In_z)
@@ -1583,6 +1772,18 @@ intptr_t localerpl_spawnl_utf8(int mode, const char *cmdname, ...);
 # endif
 #endif
 
+/* Same as localerpl_spawnvp(), but arguments are quoted by arg_encode_command_line(), in
+  both modes, so that the started program gets them unchanged - they must not be quoted
+  by the caller.
+   argv[0] must not contain double-quotes, else -1 is returned and errno is set to EINVAL.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(cmdname, A_In_z)
+A_At(argv, A_Notnull)
+#endif
+intptr_t localerpl_spawnvp_quoted(int mode, const char *cmdname, const char *const *argv);
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Nonnull_all_args
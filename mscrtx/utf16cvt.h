@@ -11,6 +11,16 @@
 
 /* Convert utf8->utf16, malloc'ate and return new buffer if necessary */
 
+/* Conversion flags for the *_f() functions.  */
+
+/* If the utf8 string is not shorter than the buffer, do not try to convert it into the
+  buffer: allocate new buffer for the worst case - one utf16 character per utf8 byte,
+  then convert in one pass (by default, size of utf16 string is computed first).  */
+#define CVT_ONE_PASS 1
+
+/* With CVT_ONE_PASS: realloc() over-allocated buffer to the size of utf16 string.  */
+#define CVT_SHRINK   2
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Nonnull_arg(1)
@@ -27,6 +37,23 @@ A_Ret_writes(*sz)
 wchar_t *cvt_utf8_to_16_z_reserve(const char str[], wchar_t buf[]/*NULL?*/,
 	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/);
 
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_Nonnull_arg(5)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Inout A_Out_range(>,0))
+A_At(u8sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+wchar_t *cvt_utf8_to_16_z_reserve_f(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/,
+	const unsigned flags/*CVT_ONE_PASS,CVT_SHRINK*/);
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Nonnull_arg(1)
@@ -51,6 +78,43 @@ A_Ret_z
 #endif
 wchar_t *cvt_utf8_to_16_z(const char str[], wchar_t buf[]/*NULL?*/, const size_t buf_sz);
 
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_z
+#endif
+wchar_t *cvt_utf8_to_16_z_f(const char str[], wchar_t buf[]/*NULL?*/, const size_t buf_sz,
+	const unsigned flags/*CVT_ONE_PASS,CVT_SHRINK*/);
+
+/* Convert utf8 string of len bytes (not containing '\0') to '\0'-terminated utf16 string.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_When(len, A_At(str, A_Notnull))
+A_Nonnull_arg(5)
+A_At(str, A_In_reads(len))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+wchar_t *cvt_utf8_to_16_z_n_sz(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_When(len, A_At(str, A_Notnull))
+A_At(str, A_In_reads(len))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_z
+#endif
+wchar_t *cvt_utf8_to_16_z_n(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz);
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Nonnull_arg(1)
@@ -63,18 +127,45 @@ A_Ret_writes(*len)
 wchar_t *cvt_utf8_to_16(const char str[], size_t *const len/*>0,in,out*/,
 	wchar_t buf[]/*NULL?*/, const size_t buf_sz);
 
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(str, A_Pre_readable_size(*len))
+A_At(len, A_Inout A_In_range(>,0))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_writes(*len)
+#endif
+wchar_t *cvt_utf8_to_16_f(const char str[], size_t *const len/*>0,in,out*/,
+	wchar_t buf[]/*NULL?*/, const size_t buf_sz, const unsigned flags/*CVT_ONE_PASS,CVT_SHRINK*/);
+
 #define CVT_UTF8_TO_16_Z_RESERVE(str, buf, sz/*in,out*/, u8sz/*out*/) \
 	cvt_utf8_to_16_z_reserve(str, buf, sizeof(buf)/sizeof(buf[0]), sz, u8sz)
 
+#define CVT_UTF8_TO_16_Z_RESERVE_F(str, buf, sz/*in,out*/, u8sz/*out*/, flags) \
+	cvt_utf8_to_16_z_reserve_f(str, buf, sizeof(buf)/sizeof(buf[0]), sz, u8sz, flags)
+
 #define CVT_UTF8_TO_16_Z_SZ(str, buf, sz/*out*/) \
 	cvt_utf8_to_16_z_sz(str, buf, sizeof(buf)/sizeof(buf[0]), sz)
 
 #define CVT_UTF8_TO_16_Z(str, buf) \
 	cvt_utf8_to_16_z(str, buf, sizeof(buf)/sizeof(buf[0]))
 
+#define CVT_UTF8_TO_16_Z_F(str, buf, flags) \
+	cvt_utf8_to_16_z_f(str, buf, sizeof(buf)/sizeof(buf[0]), flags)
+
+#define CVT_UTF8_TO_16_Z_N_SZ(str, len, buf, sz/*out*/) \
+	cvt_utf8_to_16_z_n_sz(str, len, buf, sizeof(buf)/sizeof(buf[0]), sz)
+
+#define CVT_UTF8_TO_16_Z_N(str, len, buf) \
+	cvt_utf8_to_16_z_n(str, len, buf, sizeof(buf)/sizeof(buf[0]))
+
 #define CVT_UTF8_TO_16(str, len/*>0,in,out*/, buf) \
 	cvt_utf8_to_16(str, len, buf, sizeof(buf)/sizeof(buf[0]))
 
+#define CVT_UTF8_TO_16_F(str, len/*>0,in,out*/, buf, flags) \
+	cvt_utf8_to_16_f(str, len, buf, sizeof(buf)/sizeof(buf[0]), flags)
+
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Check_return
 A_Nonnull_arg(1)
@@ -105,4 +196,355 @@ wchar_t *cvt_utf32_to_16_z(const unsigned str[], wchar_t buf[]/*NULL?*/, const s
 #define CVT_UTF32_TO_16_Z(str, buf) \
 	cvt_utf32_to_16_z(str, buf, sizeof(buf)/sizeof(buf[0]))
 
+/* Convert utf16->utf8, malloc'ate and return new buffer if necessary */
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_Nonnull_arg(5)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Inout A_Out_range(>,0))
+A_At(u16sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+char *cvt_utf16_to_8_z_reserve(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u16sz/*out*/);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+char *cvt_utf16_to_8_z_sz(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_z
+#endif
+char *cvt_utf16_to_8_z(const wchar_t str[], char buf[]/*NULL?*/, const size_t buf_sz);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(str, A_Pre_readable_size(*len))
+A_At(len, A_Inout A_In_range(>,0))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_writes(*len)
+#endif
+char *cvt_utf16_to_8(const wchar_t str[], size_t *const len/*>0,in,out*/,
+	char buf[]/*NULL?*/, const size_t buf_sz);
+
+/* Convert utf16->utf8 by parts, never allocating memory: convert '\0'-terminated utf16 string
+  while there is a space in the buffer, the terminating '\0' is not stored.
+   Only whole utf8 characters are stored, a surrogate pair is never split.
+   Updates *str to point after the last converted utf16 character - to the terminating
+  L'\0', if the whole string was converted.
+   Returns the number of stored bytes, or (size_t)-1 if the string has an unpaired
+  surrogate (errno is set to EILSEQ, *str points to it).  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_all_args
+A_At(str, A_Inout)
+A_At(*str, A_In_z)
+A_At(buf, A_Pre_writable_size(buf_sz) A_Post_readable_size(return))
+A_Success(return != A_Size_t(-1))
+#endif
+size_t cvt_utf16_to_8_part_z(const wchar_t **const str/*in,out*/, char buf[], const size_t buf_sz);
+
+#define CVT_UTF16_TO_8_Z_RESERVE(str, buf, sz/*in,out*/, u16sz/*out*/) \
+	cvt_utf16_to_8_z_reserve(str, buf, sizeof(buf)/sizeof(buf[0]), sz, u16sz)
+
+#define CVT_UTF16_TO_8_Z_SZ(str, buf, sz/*out*/) \
+	cvt_utf16_to_8_z_sz(str, buf, sizeof(buf)/sizeof(buf[0]), sz)
+
+#define CVT_UTF16_TO_8_Z(str, buf) \
+	cvt_utf16_to_8_z(str, buf, sizeof(buf)/sizeof(buf[0]))
+
+#define CVT_UTF16_TO_8(str, len/*>0,in,out*/, buf) \
+	cvt_utf16_to_8(str, len, buf, sizeof(buf)/sizeof(buf[0]))
+
+/* Validate '\0'-terminated utf8 string and count its characters.
+   Returns number of unicode code points, not counting terminating '\0', and,
+  if u16len != NULL, sets *u16len to the number of utf16 characters needed to store them.
+   Returns (size_t)-1 and sets errno to EILSEQ if the string is not a valid utf8.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(str, A_In_z)
+A_At(u16len, A_Out_opt)
+#endif
+size_t cvt_utf8_count_z(const char str[], size_t *const u16len/*NULL?,out*/);
+
+/* Convert NULL-terminated vector of strings utf8->utf16 or utf16->utf8.
+   Returns NULL-terminated array of pointers to converted strings, allocated
+  in one block together with the strings - free it with a single free().
+   Returns NULL on error and, if bad != NULL, sets *bad to the index of the
+  string that cannot be converted, or to (size_t)-1 if failed for other reason.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(vec, A_In)
+A_At(bad, A_On_failure(A_Out_opt))
+A_Success(return)
+#endif
+wchar_t **cvt_utf8_to_16_vec(const char *const vec[], size_t *const bad/*NULL?,out*/);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_At(vec, A_In)
+A_At(bad, A_On_failure(A_Out_opt))
+A_Success(return)
+#endif
+char **cvt_utf16_to_8_vec(const wchar_t *const vec[], size_t *const bad/*NULL?,out*/);
+
+/* Same as above, but allocate new buffer via the alloc callback instead of malloc(),
+  e.g. in a per-request arena, which is then freed in one shot.
+   alloc(ctx, sz) must return memory of sz bytes suitably aligned for any type, or NULL.
+   Returned buffer is never freed by these functions.  */
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_Nonnull_arg(5)
+A_Nonnull_arg(6)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Inout A_Out_range(>,0))
+A_At(u8sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+wchar_t *cvt_utf8_to_16_z_reserve_a(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_Nonnull_arg(5)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+wchar_t *cvt_utf8_to_16_z_sz_a(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_z
+#endif
+wchar_t *cvt_utf8_to_16_z_a(const char str[], wchar_t buf[]/*NULL?*/, const size_t buf_sz,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_When(len, A_At(str, A_Notnull))
+A_Nonnull_arg(5)
+A_Nonnull_arg(6)
+A_At(str, A_In_reads(len))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+wchar_t *cvt_utf8_to_16_z_n_sz_a(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_When(len, A_At(str, A_Notnull))
+A_Nonnull_arg(5)
+A_At(str, A_In_reads(len))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_z
+#endif
+wchar_t *cvt_utf8_to_16_z_n_a(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(5)
+A_At(str, A_Pre_readable_size(*len))
+A_At(len, A_Inout A_In_range(>,0))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_writes(*len)
+#endif
+wchar_t *cvt_utf8_to_16_a(const char str[], size_t *const len/*>0,in,out*/,
+	wchar_t buf[]/*NULL?*/, const size_t buf_sz, void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_Nonnull_arg(5)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+wchar_t *cvt_utf32_to_16_z_sz_a(const unsigned str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_z
+#endif
+wchar_t *cvt_utf32_to_16_z_a(const unsigned str[], wchar_t buf[]/*NULL?*/, const size_t buf_sz,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_Nonnull_arg(5)
+A_Nonnull_arg(6)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Inout A_Out_range(>,0))
+A_At(u16sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+char *cvt_utf16_to_8_z_reserve_a(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u16sz/*out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_Nonnull_arg(5)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_At(sz, A_Out A_Out_range(>,0))
+A_Success(return)
+A_Ret_z
+A_Ret_writes(*sz)
+#endif
+char *cvt_utf16_to_8_z_sz_a(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(4)
+A_At(str, A_In_z)
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_z
+#endif
+char *cvt_utf16_to_8_z_a(const wchar_t str[], char buf[]/*NULL?*/, const size_t buf_sz,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(5)
+A_At(str, A_Pre_readable_size(*len))
+A_At(len, A_Inout A_In_range(>,0))
+A_When(buf, A_At(buf, A_Pre_writable_size(buf_sz)))
+A_Success(return)
+A_Ret_writes(*len)
+#endif
+char *cvt_utf16_to_8_a(const wchar_t str[], size_t *const len/*>0,in,out*/,
+	char buf[]/*NULL?*/, const size_t buf_sz, void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(3)
+A_At(vec, A_In)
+A_At(bad, A_On_failure(A_Out_opt))
+A_Success(return)
+#endif
+wchar_t **cvt_utf8_to_16_vec_a(const char *const vec[], size_t *const bad/*NULL?,out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Check_return
+A_Nonnull_arg(1)
+A_Nonnull_arg(3)
+A_At(vec, A_In)
+A_At(bad, A_On_failure(A_Out_opt))
+A_Success(return)
+#endif
+char **cvt_utf16_to_8_vec_a(const wchar_t *const vec[], size_t *const bad/*NULL?,out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx);
+
+#define CVT_UTF8_TO_16_Z_RESERVE_A(str, buf, sz/*in,out*/, u8sz/*out*/, alloc, ctx) \
+	cvt_utf8_to_16_z_reserve_a(str, buf, sizeof(buf)/sizeof(buf[0]), sz, u8sz, alloc, ctx)
+
+#define CVT_UTF8_TO_16_Z_SZ_A(str, buf, sz/*out*/, alloc, ctx) \
+	cvt_utf8_to_16_z_sz_a(str, buf, sizeof(buf)/sizeof(buf[0]), sz, alloc, ctx)
+
+#define CVT_UTF8_TO_16_Z_A(str, buf, alloc, ctx) \
+	cvt_utf8_to_16_z_a(str, buf, sizeof(buf)/sizeof(buf[0]), alloc, ctx)
+
+#define CVT_UTF8_TO_16_Z_N_SZ_A(str, len, buf, sz/*out*/, alloc, ctx) \
+	cvt_utf8_to_16_z_n_sz_a(str, len, buf, sizeof(buf)/sizeof(buf[0]), sz, alloc, ctx)
+
+#define CVT_UTF8_TO_16_Z_N_A(str, len, buf, alloc, ctx) \
+	cvt_utf8_to_16_z_n_a(str, len, buf, sizeof(buf)/sizeof(buf[0]), alloc, ctx)
+
+#define CVT_UTF8_TO_16_A(str, len/*>0,in,out*/, buf, alloc, ctx) \
+	cvt_utf8_to_16_a(str, len, buf, sizeof(buf)/sizeof(buf[0]), alloc, ctx)
+
+#define CVT_UTF32_TO_16_Z_SZ_A(str, buf, sz/*out*/, alloc, ctx) \
+	cvt_utf32_to_16_z_sz_a(str, buf, sizeof(buf)/sizeof(buf[0]), sz, alloc, ctx)
+
+#define CVT_UTF32_TO_16_Z_A(str, buf, alloc, ctx) \
+	cvt_utf32_to_16_z_a(str, buf, sizeof(buf)/sizeof(buf[0]), alloc, ctx)
+
+#define CVT_UTF16_TO_8_Z_RESERVE_A(str, buf, sz/*in,out*/, u16sz/*out*/, alloc, ctx) \
+	cvt_utf16_to_8_z_reserve_a(str, buf, sizeof(buf)/sizeof(buf[0]), sz, u16sz, alloc, ctx)
+
+#define CVT_UTF16_TO_8_Z_SZ_A(str, buf, sz/*out*/, alloc, ctx) \
+	cvt_utf16_to_8_z_sz_a(str, buf, sizeof(buf)/sizeof(buf[0]), sz, alloc, ctx)
+
+#define CVT_UTF16_TO_8_Z_A(str, buf, alloc, ctx) \
+	cvt_utf16_to_8_z_a(str, buf, sizeof(buf)/sizeof(buf[0]), alloc, ctx)
+
+#define CVT_UTF16_TO_8_A(str, len/*>0,in,out*/, buf, alloc, ctx) \
+	cvt_utf16_to_8_a(str, len, buf, sizeof(buf)/sizeof(buf[0]), alloc, ctx)
+
 #endif /* UTF16CVT_H_INCLUDED */
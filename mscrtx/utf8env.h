@@ -20,6 +20,13 @@ int utf8_clearenv(void);
 /* these functions will create shadow utf8 environment variables table
    by the first call - if failed, utf8_env_fatal() callback is called */
 
+/* Enable (non-zero) or disable (0, the default) lazy conversion of the environment.
+   In lazy mode, utf8_getenv() converts only the requested variable, so it sees changes
+  of the real environment made after the first call, and the whole environment is
+  converted by the first call of utf8_environ(); until then, utf8_unsetenv() also
+  deletes the variable from the real environment.  */
+void utf8_env_set_lazy(int lazy);
+
 /* environ (5) */
 #ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
 A_Ret_never_null
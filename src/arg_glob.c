@@ -0,0 +1,687 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* arg_glob.c */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h> /* for wcslen() */
+
+#include "mscrtx/arg_glob.h"
+#include "unicode_ctype/unicode_toupper.h"
+
+#ifndef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+#define A_Use_decl_annotations
+#endif
+
+static int is_sep(const wchar_t c)
+{
+	return L'\\' == c || L'/' == c;
+}
+
+/* Check if the name is "." or "..".  */
+static int is_dot_dir(const wchar_t name[])
+{
+	return L'.' == name[0] && (L'\0' == name[1] || (L'.' == name[1] && L'\0' == name[2]));
+}
+
+/* Get next character of the string, combining a surrogate pair into one code point.  */
+static unsigned next_char(const wchar_t **const s/*in,out*/)
+{
+	const wchar_t *p = *s;
+	unsigned c = (unsigned)*p++;
+	if (0xD800 <= c && c <= 0xDBFF && 0xDC00 <= (unsigned)*p && (unsigned)*p <= 0xDFFF)
+		c = 0x10000 + ((c - 0xD800) << 10) + ((unsigned)*p++ - 0xDC00);
+	*s = p;
+	return c;
+}
+
+/* Case is folded as by the file system, not by the current locale of the CRT.  */
+static wchar_t fold_case(const wchar_t c)
+{
+	if ((unsigned)c < 0x80)
+		return (L'a' <= c && c <= L'z') ? (wchar_t)(c - (L'a' - L'A')) : c;
+	return (wchar_t)unicode_toupper((unsigned)c);
+}
+
+/* Check if the character c is in the range [lo, hi], ignoring case.  */
+static int in_range(const unsigned c, const unsigned lo, const unsigned hi)
+{
+	unsigned u, l;
+	if (lo <= c && c <= hi)
+		return 1;
+	if (c > 0xFFFF)
+		return 0;
+	u = unicode_toupper(c);
+	l = unicode_tolower(c);
+	return (lo <= u && u <= hi) || (lo <= l && l <= hi);
+}
+
+/* Find the end of the bracket expression starting at p, which points to '['.
+   Returns pointer to the closing ']', or NULL if the bracket expression is not
+  terminated in the same path component - then '[' is an ordinary character.  */
+static const wchar_t *bracket_end(const wchar_t *p)
+{
+	p++;
+	if (L'!' == *p || L'^' == *p)
+		p++;
+	if (L']' == *p)
+		p++; /* ']' at the start of the set is an ordinary character */
+	for (; *p && !is_sep(*p); p++) {
+		if (L']' == *p)
+			return p;
+	}
+	return NULL;
+}
+
+/* Find the end of the brace expression starting at p, which points to '{'.
+   Returns pointer to the closing '}', or NULL if the brace expression is not
+  terminated or has no comma-separated alternatives - then '{' is an ordinary character.  */
+static const wchar_t *brace_end(const wchar_t *p)
+{
+	unsigned depth = 0;
+	int alts = 0;
+	for (p++; *p; p++) {
+		if (L'[' == *p) {
+			const wchar_t *const b = bracket_end(p);
+			if (b)
+				p = b;
+		}
+		else if (L'{' == *p)
+			depth++;
+		else if (L'}' == *p) {
+			if (!depth)
+				return alts ? p : NULL;
+			depth--;
+		}
+		else if (L',' == *p && !depth)
+			alts = 1;
+	}
+	return NULL;
+}
+
+A_Use_decl_annotations
+int arg_glob_has_magic(const wchar_t arg[])
+{
+	for (; *arg; arg++) {
+		if (L'*' == *arg || L'?' == *arg)
+			return 1;
+		if (L'[' == *arg && bracket_end(arg))
+			return 1;
+		if (L'{' == *arg && brace_end(arg))
+			return 1;
+	}
+	return 0;
+}
+
+/* Check if the character c is in the set of the bracket expression: s points after
+  the opening '[', end - to the closing ']'.  */
+static int match_bracket(const wchar_t *s, const wchar_t *const end, const unsigned c)
+{
+	int negate = 0;
+	int found = 0;
+	if (L'!' == *s || L'^' == *s) {
+		negate = 1;
+		s++;
+	}
+	do {
+		const unsigned lo = next_char(&s);
+		unsigned hi = lo;
+		if (L'-' == *s && s + 1 != end) {
+			s++;
+			hi = next_char(&s);
+		}
+		if (!found)
+			found = in_range(c, lo, hi);
+	} while (s < end);
+	return found != negate;
+}
+
+/* Match the name against the pattern of one path component [p, end).
+   Only the last '*' needs to be backtracked, so the time is O(pattern*name) at worst.  */
+static int match_component(const wchar_t *p, const wchar_t *const end, const wchar_t *n)
+{
+	const wchar_t *star_p = NULL; /* pattern after the last '*' */
+	const wchar_t *star_n = NULL; /* where that '*' ends in the name */
+
+	for (;;) {
+		if (p != end) {
+			if (L'*' == *p) {
+				star_p = ++p;
+				star_n = n;
+				continue;
+			}
+			if (*n) {
+				if (L'?' == *p) {
+					(void)next_char(&n);
+					p++;
+					continue;
+				}
+				if (L'[' == *p) {
+					const wchar_t *const b = bracket_end(p);
+					if (b) {
+						if (match_bracket(p + 1, b, next_char(&n))) {
+							p = b + 1;
+							continue;
+						}
+						goto backtrack;
+					}
+				}
+				if (fold_case(*p) == fold_case(*n)) {
+					p++;
+					n++;
+					continue;
+				}
+			}
+		}
+		else if (!*n)
+			return 1;
+backtrack:
+		if (!star_p || !*star_n)
+			return 0;
+		(void)next_char(&star_n);
+		n = star_n;
+		p = star_p;
+	}
+}
+
+/* Check if the path component [p, end) has wildcards.  */
+static int component_has_magic(const wchar_t *p, const wchar_t *const end)
+{
+	for (; p != end; p++) {
+		if (L'*' == *p || L'?' == *p || (L'[' == *p && bracket_end(p)))
+			return 1;
+	}
+	return 0;
+}
+
+static int is_globstar(const wchar_t *const p, const wchar_t *const end)
+{
+	return 2 == end - p && L'*' == p[0] && L'*' == p[1];
+}
+
+/* "*.*" matches any name, like in cmd.exe.  */
+static int match_name(const wchar_t *const p, const wchar_t *const end, const wchar_t name[])
+{
+	return (3 == end - p && L'*' == p[0] && L'.' == p[1] && L'*' == p[2]) ||
+		match_component(p, end, name);
+}
+
+static const wchar_t *component_end(const wchar_t *p)
+{
+	while (*p && !is_sep(*p))
+		p++;
+	return p;
+}
+
+static const wchar_t *skip_seps(const wchar_t *p)
+{
+	while (is_sep(*p))
+		p++;
+	return p;
+}
+
+/* Expansion state.  */
+struct glob {
+	const struct arg_find_backend *backend;
+	struct arg_tok_buf *out;  /* found names */
+	struct arg_tok_buf path;  /* directory prefix of the current path component */
+	struct arg_tok_buf pat;   /* patterns produced by the brace expansion */
+	size_t count;             /* number of found names */
+	int matched;              /* non-zero if any file, including "." or "..", matched */
+};
+
+static int path_append(struct glob *const g, const wchar_t s[], const size_t len)
+{
+	if (!arg_tok_buf_reserve(&g->path, len))
+		return 0;
+	memcpy(g->path.buf + g->path.filled, s, len*sizeof(*s));
+	g->path.filled += len;
+	return 1;
+}
+
+/* Append the found name: directory prefix, name, trailing separators (sep_len
+  characters of sep) and L'\0'.  */
+static int glob_emit(struct glob *const g, const wchar_t name[], const size_t len,
+	const wchar_t sep[], const size_t sep_len)
+{
+	struct arg_tok_buf *const out = g->out;
+	const size_t dir_len = g->path.filled;
+	wchar_t *o;
+	if (!arg_tok_buf_reserve(out, dir_len + len + sep_len + 1))
+		return 0;
+	o = out->buf + out->filled;
+	memcpy(o, g->path.buf, dir_len*sizeof(*o));
+	memcpy(o + dir_len, name, len*sizeof(*o));
+	memcpy(o + dir_len + len, sep, sep_len*sizeof(*o));
+	o[dir_len + len + sep_len] = L'\0';
+	out->filled += dir_len + len + sep_len + 1;
+	g->count++;
+	g->matched = 1;
+	return 1;
+}
+
+/* Start search in the current directory for the name of len characters,
+  which is either "*" or a literal name.
+   Returns 0 on failure, else *handle is NULL if nothing is found.  */
+static int glob_find_first(struct glob *const g, const wchar_t name[], const size_t len,
+	void **const handle/*out*/, wchar_t found[ARG_FIND_NAME_MAX], unsigned *const attrs/*out*/)
+{
+	const size_t filled = g->path.filled;
+	if (!path_append(g, name, len) || !arg_tok_buf_reserve(&g->path, 1))
+		return 0;
+	g->path.buf[g->path.filled] = L'\0';
+	g->path.filled = filled;
+	*handle = g->backend->find_first(g->path.buf, found, attrs);
+	return 1;
+}
+
+static int glob_walk(struct glob *const g, const wchar_t *const comp);
+
+/* Descend to the directory with the given name, using sep_len separators of sep,
+  then match the rest of the pattern.  */
+static int glob_descend(struct glob *const g, const wchar_t name[], const size_t len,
+	const wchar_t sep[], const size_t sep_len, const wchar_t *const rest)
+{
+	const size_t filled = g->path.filled;
+	const int ok = path_append(g, name, len) && path_append(g, sep, sep_len) && glob_walk(g, rest);
+	g->path.filled = filled;
+	return ok;
+}
+
+/* Process the found file against the path component [comp, end), followed by
+  separators up to next.  */
+static int glob_entry(struct glob *const g, const wchar_t *const comp, const wchar_t *const end,
+	const wchar_t *const next, const wchar_t name[], const unsigned attrs)
+{
+	if (!match_name(comp, end, name))
+		return 1;
+	if (is_dot_dir(name)) {
+		if (!*next)
+			g->matched = 1;
+		return 1; /* skip "." and "..", also as intermediate directories */
+	}
+	if (!*next) {
+		/* Trailing separator matches only directories.  */
+		if (end != next && !(attrs & ARG_FIND_DIR))
+			return 1;
+		return glob_emit(g, name, wcslen(name), end, (size_t)(next - end));
+	}
+	if (!(attrs & ARG_FIND_DIR))
+		return 1;
+	return glob_descend(g, name, wcslen(name), end, (size_t)(next - end), next);
+}
+
+/* Match "**" - the path component [comp, end), followed by separators up to next,
+  against the current directory and all its subdirectories.
+   The directory is enumerated only once: its entries are matched against the next
+  path component and searched for subdirectories at the same time.  */
+static int glob_walk_globstar(struct glob *const g, const wchar_t *const comp,
+	const wchar_t *const end, const wchar_t *const next)
+{
+	const wchar_t *const sub_end = component_end(next);
+	const wchar_t *const sub_next = skip_seps(sub_end);
+	/* Separator to use after found subdirectories.  */
+	const wchar_t *const sep = end != next ? end : (comp != g->pat.buf && is_sep(comp[-1])) ? comp - 1 : L"\\";
+	wchar_t name[ARG_FIND_NAME_MAX];
+	unsigned attrs;
+	void *handle;
+
+	if (!glob_find_first(g, L"*", 1, &handle, name, &attrs))
+		return 0;
+	if (!handle)
+		return 1;
+
+	do {
+		if (*next) {
+			if (!glob_entry(g, next, sub_end, sub_next, name, attrs))
+				goto fail;
+		}
+		else if (!is_dot_dir(name) && (end == next || (attrs & ARG_FIND_DIR))) {
+			/* Trailing "**" matches all files, "**\" - all directories.  */
+			if (!glob_emit(g, name, wcslen(name), end, (size_t)(next - end)))
+				goto fail;
+		}
+		if ((attrs & (ARG_FIND_DIR | ARG_FIND_LINK)) == ARG_FIND_DIR && !is_dot_dir(name)) {
+			const size_t filled = g->path.filled;
+			const int ok = path_append(g, name, wcslen(name)) && path_append(g, sep, 1) &&
+				glob_walk_globstar(g, comp, end, next);
+			g->path.filled = filled;
+			if (!ok)
+				goto fail;
+		}
+	} while (g->backend->find_next(handle, name, &attrs));
+
+	g->backend->find_close(handle);
+	return 1;
+
+fail:
+	g->backend->find_close(handle);
+	return 0;
+}
+
+/* Match the pattern, starting from the path component comp, against the current directory.  */
+static int glob_walk(struct glob *const g, const wchar_t *const comp)
+{
+	const wchar_t *const end = component_end(comp);
+	const wchar_t *next = skip_seps(end);
+	wchar_t name[ARG_FIND_NAME_MAX];
+	unsigned attrs;
+	void *handle;
+
+	if (is_globstar(comp, end)) {
+		/* "**\**" is the same as "**".  */
+		for (;;) {
+			const wchar_t *const e = component_end(next);
+			if (!is_globstar(next, e))
+				break;
+			next = skip_seps(e);
+		}
+		return glob_walk_globstar(g, comp, end, next);
+	}
+
+	if (!component_has_magic(comp, end)) {
+		/* No need to check that an intermediate directory exists.  */
+		if (*next)
+			return glob_descend(g, comp, (size_t)(end - comp), end, (size_t)(next - end), next);
+		if (!glob_find_first(g, comp, (size_t)(end - comp), &handle, name, &attrs))
+			return 0;
+		if (!handle)
+			return 1;
+		g->backend->find_close(handle);
+		if (end != next && !(attrs & ARG_FIND_DIR))
+			return 1;
+		/* Keep the name as it was typed.  */
+		return glob_emit(g, comp, (size_t)(next - comp), L"", 0);
+	}
+
+	if (!glob_find_first(g, L"*", 1, &handle, name, &attrs))
+		return 0;
+	if (!handle)
+		return 1;
+
+	do {
+		if (!glob_entry(g, comp, end, next, name, attrs)) {
+			g->backend->find_close(handle);
+			return 0;
+		}
+	} while (g->backend->find_next(handle, name, &attrs));
+
+	g->backend->find_close(handle);
+	return 1;
+}
+
+/* Expand the first brace expression in the pattern stored at offset off in the g->pat
+  buffer, starting the search at offset from, then expand the resulting patterns.  */
+static int glob_braces(struct glob *const g, const size_t off, const size_t from)
+{
+	const wchar_t *const pat = g->pat.buf + off;
+	const wchar_t *b = pat + from;
+	const wchar_t *e = NULL;
+
+	for (; *b; b++) {
+		if (L'[' == *b) {
+			const wchar_t *const c = bracket_end(b);
+			if (c)
+				b = c;
+		}
+		else if (L'{' == *b) {
+			e = brace_end(b);
+			if (e)
+				break;
+		}
+	}
+
+	if (!e) {
+		/* No more braces, match the pattern.
+		   Prefixes "\\?\" and "\\.\" are not wildcards, the drive "X:" is not a part
+		  of the first path component, e.g. "C:*.txt" - files in the current directory
+		  of the drive C:.  */
+		size_t prefix = 0;
+		if (is_sep(pat[0]) && is_sep(pat[1]) && (L'?' == pat[2] || L'.' == pat[2]) && is_sep(pat[3]))
+			prefix = 4;
+		if (((L'a' <= pat[prefix] && pat[prefix] <= L'z') || (L'A' <= pat[prefix] && pat[prefix] <= L'Z')) &&
+			L':' == pat[prefix + 1])
+		{
+			prefix += 2;
+		}
+		if (prefix) {
+			const size_t filled = g->path.filled;
+			const int ok = path_append(g, pat, prefix) && glob_walk(g, pat + prefix);
+			g->path.filled = filled;
+			return ok;
+		}
+		return glob_walk(g, pat);
+	}
+
+	{
+		/* Pattern is: prefix{alt1,alt2,...}suffix, the buffer may be reallocated, so use offsets.  */
+		const size_t prefix = (size_t)(b - pat);
+		const size_t suffix = (size_t)(e + 1 - pat);
+		const size_t pat_len = g->pat.filled - off; /* including L'\0' */
+		size_t alt = prefix + 1;
+
+		for (;;) {
+			const wchar_t *a = g->pat.buf + off + alt;
+			const size_t new_off = g->pat.filled;
+			unsigned depth = 0;
+			size_t alt_len;
+			int ok;
+
+			/* Find the end of the alternative.  */
+			for (;; a++) {
+				if (L'[' == *a) {
+					const wchar_t *const c = bracket_end(a);
+					if (c)
+						a = c;
+				}
+				else if (L'{' == *a)
+					depth++;
+				else if (L'}' == *a && depth)
+					depth--;
+				else if ((L',' == *a || L'}' == *a) && !depth)
+					break;
+			}
+			alt_len = (size_t)(a - (g->pat.buf + off + alt));
+
+			/* Make the pattern prefix + alternative + suffix.  */
+			if (!arg_tok_buf_reserve(&g->pat, prefix + alt_len + pat_len - suffix))
+				return 0;
+			{
+				wchar_t *const p = g->pat.buf + off;
+				wchar_t *const n = g->pat.buf + new_off;
+				memcpy(n, p, prefix*sizeof(*p));
+				memcpy(n + prefix, p + alt, alt_len*sizeof(*p));
+				memcpy(n + prefix + alt_len, p + suffix, (pat_len - suffix)*sizeof(*p));
+			}
+			g->pat.filled += prefix + alt_len + pat_len - suffix;
+
+			ok = glob_braces(g, new_off, prefix);
+			g->pat.filled = new_off;
+			if (!ok)
+				return 0;
+
+			alt += alt_len;
+			if (alt == suffix - 1)
+				return 1; /* at '}' */
+			alt++; /* skip ',' */
+		}
+	}
+}
+
+A_Use_decl_annotations
+size_t arg_expand_wildcard(const struct arg_find_backend *const backend,
+	const wchar_t pattern[], struct arg_tok_buf *const out/*in,out*/, int *const matched/*out*/)
+{
+	const size_t start = out->filled;
+	const size_t len = wcslen(pattern) + 1;
+	wchar_t path_buf[ARG_FIND_NAME_MAX];
+	wchar_t pat_buf[ARG_FIND_NAME_MAX];
+	struct glob g;
+	int ok;
+
+	g.backend = backend;
+	g.out = out;
+	g.path.buf = path_buf;
+	g.path.filled = 0;
+	g.path.size = sizeof(path_buf)/sizeof(path_buf[0]);
+	g.path.own = 0;
+	g.pat.buf = pat_buf;
+	g.pat.filled = 0;
+	g.pat.size = sizeof(pat_buf)/sizeof(pat_buf[0]);
+	g.pat.own = 0;
+	g.count = 0;
+	g.matched = 0;
+
+	/* Pattern may point into the out buffer, copy it before the buffer grows.  */
+	ok = arg_tok_buf_reserve(&g.pat, len);
+	if (ok) {
+		memcpy(g.pat.buf, pattern, len*sizeof(*pattern));
+		g.pat.filled = len;
+		ok = glob_braces(&g, 0, 0);
+	}
+
+	if (g.path.own)
+		free(g.path.buf);
+	if (g.pat.own)
+		free(g.pat.buf);
+
+	*matched = g.matched;
+	if (!ok) {
+		out->filled = start;
+		return (size_t)-1;
+	}
+	return g.count;
+}
+
+#ifndef _WIN32
+
+/* Directory enumeration backend for POSIX systems.  */
+
+#include <dirent.h>
+#include <fcntl.h> /* for AT_FDCWD, AT_SYMLINK_NOFOLLOW */
+#include <sys/stat.h>
+
+#include "mscrtx/utf16cvt.h"
+
+/* Get ARG_FIND_... attributes of the file name in the directory dirfd.
+   Returns 0 if the file does not exist.  */
+static int readdir_stat(const int dirfd, const char name[], unsigned *const attrs/*out*/)
+{
+	struct stat st;
+	if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW))
+		return 0;
+	if (S_ISLNK(st.st_mode)) {
+		/* may be a link to a directory */
+		*attrs = ARG_FIND_LINK |
+			((!fstatat(dirfd, name, &st, 0) && S_ISDIR(st.st_mode)) ? ARG_FIND_DIR : 0u);
+	}
+	else
+		*attrs = S_ISDIR(st.st_mode) ? ARG_FIND_DIR : 0u;
+	return 1;
+}
+
+/* Read the next entry of the directory.
+   Names that are not valid utf8 or too long are skipped.
+   Returns 0 if there are no more entries.  */
+static int readdir_next(DIR *const dir, wchar_t name[ARG_FIND_NAME_MAX], unsigned *const attrs)
+{
+	const struct dirent *e;
+	while (NULL != (e = readdir(dir))) {
+		wchar_t *const n = cvt_utf8_to_16_z(e->d_name, name, ARG_FIND_NAME_MAX);
+		if (n != name) {
+			if (n)
+				free(n);
+			continue;
+		}
+#ifdef DT_DIR
+		/* do not stat each file if the type is known */
+		if (DT_UNKNOWN != e->d_type && DT_LNK != e->d_type) {
+			*attrs = DT_DIR == e->d_type ? ARG_FIND_DIR : 0u;
+			return 1;
+		}
+#endif
+		if (!readdir_stat(dirfd(dir), e->d_name, attrs))
+			*attrs = 0u; /* just removed */
+		return 1;
+	}
+	return 0;
+}
+
+/* Handle of the search of a literal name, which is found only once.  */
+static char readdir_literal;
+
+static void *readdir_find_first(const wchar_t pattern[], wchar_t name[ARG_FIND_NAME_MAX],
+	unsigned *const attrs/*out*/)
+{
+	void *handle = NULL;
+	char *const path = cvt_utf16_to_8_z(pattern, NULL, 0);
+	char *comp, *s;
+
+	if (!path)
+		return NULL;
+
+	/* both '\' and '/' separate path components */
+	for (comp = s = path; *s; s++) {
+		if ('\\' == *s)
+			*s = '/';
+		if ('/' == *s)
+			comp = s + 1;
+	}
+
+	if ('*' == comp[0] && !comp[1]) {
+		DIR *dir;
+		if (comp == path)
+			dir = opendir(".");
+		else {
+			*comp = '\0';
+			dir = opendir(path);
+		}
+		if (dir) {
+			if (readdir_next(dir, name, attrs))
+				handle = dir;
+			else
+				closedir(dir);
+		}
+	}
+	else if (readdir_stat(AT_FDCWD, path, attrs)) {
+		const wchar_t *n = pattern;
+		const wchar_t *c = pattern;
+		for (; *n; n++) {
+			if (L'\\' == *n || L'/' == *n)
+				c = n + 1;
+		}
+		if ((size_t)(n - c) < ARG_FIND_NAME_MAX) {
+			memcpy(name, c, (size_t)(n - c + 1)*sizeof(*c));
+			handle = &readdir_literal;
+		}
+	}
+
+	free(path);
+	return handle;
+}
+
+static int readdir_find_next(void *const handle, wchar_t name[ARG_FIND_NAME_MAX],
+	unsigned *const attrs/*out*/)
+{
+	if (&readdir_literal == handle)
+		return 0;
+	return readdir_next((DIR*)handle, name, attrs);
+}
+
+static void readdir_find_close(void *const handle)
+{
+	if (&readdir_literal != handle)
+		closedir((DIR*)handle);
+}
+
+const struct arg_find_backend arg_readdir_find_backend = {
+	readdir_find_first,
+	readdir_find_next,
+	readdir_find_close
+};
+
+#endif /* !_WIN32 */
@@ -13,7 +13,10 @@
 #include <errno.h>
 
 #include "mscrtx/arg_parser.h"
+#include "mscrtx/arg_tokenizer.h"
+#include "mscrtx/arg_glob.h"
 #include "mscrtx/localerpl.h"
+#include "mscrtx/utf16cvt.h"
 
 /* not defined under MinGW.org */
 #ifndef INT_MAX
@@ -69,308 +72,719 @@ wchar_t *arg_get_module_name(wchar_t buf[], unsigned sz)
 	}
 }
 
-static wchar_t *copy_to(wchar_t d[], wchar_t *const e,
-	const wchar_t *const b, const wchar_t *const t)
+/* Each node of the wide_arg list is preceded by the pointer to the memory block to free:
+  nodes of the files found by a wildcard share one block, the pointer is NULL for all
+  of them but the first one.  */
+#define WIDE_ARG_HDR sizeof(void*)
+
+/* Size of the node with the value of value_len wide-chars, including the header,
+  aligned so that the nodes may follow each other in one block.  */
+static size_t wide_arg_node_size(const size_t value_len)
 {
-	const size_t copy = (size_t)(t - b);
-	if (!copy)
-		return d;
-	if (copy > (size_t)(e - d))
-		return e;
-	return (wchar_t*)memcpy(d, b, copy*sizeof(*b)) + copy;
+	const size_t sz = WIDE_ARG_HDR + OFFSETOF(struct wide_arg, value) + (value_len + 1)*sizeof(wchar_t);
+	return (sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
 }
 
-static size_t parse_module_name(const wchar_t **const line, wchar_t dst[], const size_t sz)
+static struct wide_arg *create_wide_arg(const size_t value_len)
 {
-	/* assume there are no escaped double-quotes */
-	const wchar_t *w = *line;
-	const wchar_t *b = w;
-	wchar_t *d = dst;
-	wchar_t *const e = d + sz;
-	size_t skipped = 0;
-	for (;;) {
-		switch (*w) {
-			default:
-				w++;
-				continue;
-			case L'\0':case L' ':case L'\t':case L'"':
-				d = copy_to(d, e, b, w);
-				if (L'"' != *w)
-					break;
-				skipped++; /* skip double-quote */
-				/* don't stop on spaces and tabs */
-				for (b = ++w;;) {
-					switch (*w) {
-						default:
-							w++;
-							continue;
-						case L'\0':case L'"':
-							break;
-					}
-					break;
-				}
-				d = copy_to(d, e, b, w);
-				if (L'\0' == *w)
-					break;
-				skipped++; /* skip double-quote */
-				b = ++w;
-				continue;
-		}
-		break;
-	}
-	{
-		const size_t name_sz = (size_t)(w - *line) - skipped;
-		*line = w;
-		return name_sz;
+	const size_t offs = OFFSETOF(struct wide_arg, value);
+	if (value_len < ((size_t)-1 - offs - 2*WIDE_ARG_HDR)/sizeof(wchar_t)) {
+		void **const block = (void**)malloc(wide_arg_node_size(value_len));
+		if (!block)
+			return NULL;
+		*block = block;
+		return (struct wide_arg*)(block + 1);
 	}
+	errno = E2BIG;
+	return NULL;
 }
 
-static size_t parse_one_arg(const wchar_t **const line, wchar_t dst[], const size_t sz)
-{
-	/* double-quotes can be escaped - backslashes before double-quotes are halved:
-	  "     ->     (quote-mode)
-	  \"    ->  "
-	  \\"   ->  \  (quote-mode)
-	  \\\"  ->  \"
-	  \\\\" ->  \\ (quote-mode) */
-	/* note: handle a special case of escaping double-quote inside double-quotes:
-	  "abc""def"  ->  abc"def   */
-	const wchar_t *w = *line;
-	const wchar_t *b = w, *t;
-	wchar_t *d = dst;
-	wchar_t *const e = d + sz;
-	size_t skipped = 0;
-	for (;;) {
-		switch (*w) {
-			default:
-				w++;
-				continue;
-			case L'\\': {
-				const wchar_t *const bs = w;
-				while (L'\\' == *++w);
-				if (L'"' != *w)
-					continue; /* backslashes are special only before a double-quote */
-				t = w - ((size_t)(w - bs) + 1)/2;
-				skipped += (size_t)(w - t);
-				if (1u & (size_t)(w - bs)) {
-					d = copy_to(d, e, b, t);
-					b = w++;
-					continue; /* double-quote is escaped */
-				}
-				goto dquote;
-			}
-			case L'\0':case L' ':case L'\t':case L'"':
-				t = w;
-dquote:
-				d = copy_to(d, e, b, t);
-				if (L'"' != *w)
-					break;
-				skipped++; /* skip double-quote */
-				/* don't stop on spaces and tabs */
-				for (b = ++w;; w++) {
-					for (;;) {
-						switch (*w) {
-							default:
-								w++;
-								continue;
-							case L'\\': {
-								const wchar_t *const bs = w;
-								while (L'\\' == *++w);
-								if (L'"' != *w)
-									continue; /* backslashes are special only before a double-quote */
-								t = w - ((size_t)(w - bs) + 1)/2;
-								skipped += (size_t)(w - t);
-								if (1u & (size_t)(w - bs)) {
-									d = copy_to(d, e, b, t);
-									b = w++;
-									continue; /* double-quote is escaped */
-								}
-								break;
-							}
-							case L'\0':case L'"':
-								t = w;
-								break;
-						}
-						break;
-					}
-					d = copy_to(d, e, b, t);
-					if (L'\0' == *w)
-						goto ret;
-					skipped++; /* skip double-quote */
-					b = ++w;
-					if (L'"' != *w)
-						break;
-					/* special case: escaped double-quote inside double quotes:
-					  "abc""def"  ->  abc"def   */
-				}
-				continue;
-		}
-		break;
+/* Append count L'\0'-terminated names, packed one after another in the names
+  buffer of names_len wide-chars, to the list, allocating the nodes in one block.
+   Returns count, or (size_t)-1 on failure.  */
+static size_t append_found(struct wide_arg ***const tail/*in,out*/,
+	const wchar_t names[], const size_t names_len, const size_t count)
+{
+	/* A node takes at most: header, next pointer, value, alignment padding.  */
+	const size_t per_node = WIDE_ARG_HDR + OFFSETOF(struct wide_arg, value) + sizeof(void*) - 1;
+	char *block;
+	if (names_len >= ((size_t)-1)/sizeof(wchar_t) ||
+		count > ((size_t)-1 - names_len*sizeof(wchar_t))/per_node)
+	{
+		errno = E2BIG;
+		return (size_t)-1;
 	}
-ret:
+	block = (char*)malloc(names_len*sizeof(wchar_t) + count*per_node);
+	if (!block)
+		return (size_t)-1;
 	{
-		const size_t arg_sz = (size_t)(w - *line) - skipped;
-		*line = w;
-		return arg_sz;
+		char *p = block;
+		size_t i = 0;
+		for (; i < count; i++) {
+			const size_t len = wcslen(names);
+			void **const hdr = (void**)p;
+			struct wide_arg *const wa = (struct wide_arg*)(hdr + 1);
+			*hdr = i ? NULL : block;
+			memcpy(wa->value, names, (len + 1)*sizeof(wchar_t));
+			**tail = wa;
+			*tail = &wa->next;
+			names += len + 1;
+			p += wide_arg_node_size(len);
+		}
 	}
-}
-
-static struct wide_arg *create_wide_arg(const size_t value_len)
-{
-	const size_t offs = OFFSETOF(struct wide_arg, value);
-	if (value_len < ((size_t)-1 - offs)/sizeof(wchar_t))
-		return (struct wide_arg*)malloc(offs + (value_len + 1)*sizeof(wchar_t));
-	errno = E2BIG;
-	return NULL;
+	return count;
 }
 
 A_Use_decl_annotations
 void arg_free_wide_args(struct wide_arg *list)
 {
+	/* Free the block after all its nodes are walked.  */
+	void *block = NULL;
 	while (list) {
-		struct wide_arg *const next = list->next;
-		free(list);
-		list = next;
+		void *const b = ((void**)list)[-1];
+		list = list->next;
+		if (b) {
+			free(block);
+			block = b;
+		}
 	}
+	free(block);
 }
 
+/* FindFirstFileExW() parameters, not defined under MinGW.org.  */
+#ifndef FIND_FIRST_EX_LARGE_FETCH
+#define FIND_FIRST_EX_LARGE_FETCH 2
+#endif
+#define FIND_EX_INFO_BASIC ((FINDEX_INFO_LEVELS)1) /* FindExInfoBasic */
+
+static void copy_found_name(wchar_t name[ARG_FIND_NAME_MAX], unsigned *const attrs/*out*/,
+	const WIN32_FIND_DATAW *const ffd)
+{
+	(void)sizeof(int[1-2*(sizeof(ffd->cFileName) != ARG_FIND_NAME_MAX*sizeof(wchar_t))]);
+	memcpy(name, ffd->cFileName, (wcslen(ffd->cFileName) + 1)*sizeof(wchar_t));
+	*attrs = ((ffd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? ARG_FIND_DIR : 0u) |
+		((ffd->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? ARG_FIND_LINK : 0u);
+}
+
+static void *win32_find_first(const wchar_t pattern[], wchar_t name[ARG_FIND_NAME_MAX],
+	unsigned *const attrs/*out*/)
+{
+	WIN32_FIND_DATAW ffd;
+	/* Do not query short (8.3) names, fetch directory entries in large batches.  */
+	HANDLE h = FindFirstFileExW(pattern, FIND_EX_INFO_BASIC, &ffd,
+		FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (INVALID_HANDLE_VALUE == h && ERROR_INVALID_PARAMETER == GetLastError())
+		h = FindFirstFileW(pattern, &ffd); /* before Windows 7 */
+	if (INVALID_HANDLE_VALUE == h)
+		return NULL;
+	copy_found_name(name, attrs, &ffd);
+	return h;
+}
+
+static int win32_find_next(void *const handle, wchar_t name[ARG_FIND_NAME_MAX],
+	unsigned *const attrs/*out*/)
+{
+	WIN32_FIND_DATAW ffd;
+	if (!FindNextFileW((HANDLE)handle, &ffd))
+		return 0;
+	copy_found_name(name, attrs, &ffd);
+	return 1;
+}
+
+static void win32_find_close(void *const handle)
+{
+	FindClose((HANDLE)handle);
+}
+
+static const struct arg_find_backend win32_find_backend = {
+	win32_find_first,
+	win32_find_next,
+	win32_find_close
+};
+
+static const struct arg_find_backend *find_backend = &win32_find_backend;
+
 A_Use_decl_annotations
-struct wide_arg *arg_parse_command_line(int *const argc/*out*/)
+void arg_set_find_backend(const struct arg_find_backend *const backend/*NULL?*/)
+{
+	find_backend = backend ? backend : &win32_find_backend;
+}
+
+/* Get the command line to parse.
+   If it is empty, get the program name to pathbuf of sz wide-chars or, if it is
+  too small, to newly allocated *modname.
+   Returns NULL on failure.  */
+static const wchar_t *get_command_line(wchar_t pathbuf[/*sz*/]/*NULL?*/, const unsigned sz/*0?*/,
+	wchar_t **const modname/*out*/)
 {
-	unsigned n = 0;
-	wchar_t pathbuf[MAX_PATH];
 	const wchar_t *cmdline = GetCommandLineW();
-	wchar_t *modname = NULL;
-	const wchar_t *line;
-	struct wide_arg *head;
-	struct wide_arg **tail = &head;
+	*modname = NULL;
 
 	/* Should not happen, but at least we will have a program name as the first arg.  */
 	if (!cmdline || !*cmdline) {
-		modname = arg_get_module_name(pathbuf, sizeof(pathbuf)/sizeof(pathbuf[0]));
-		if (!modname || !*modname) {
-			if (modname && modname != pathbuf)
-				free(modname);
+		wchar_t *const m = arg_get_module_name(pathbuf, sz);
+		if (!m || !*m) {
+			if (m && m != pathbuf)
+				free(m);
 			errno = EINVAL;
 			return NULL;
 		}
-		cmdline = modname;
+		if (m != pathbuf)
+			*modname = m;
+		cmdline = m;
+	}
+
+	return cmdline;
+}
+
+/* Append the arg of sz wide-chars, parsed to the tb buffer, to the list,
+  expanding wildcards in it if ARG_PARSE_WILDCARDS is set in flags.
+   Returns the number of appended args, or (size_t)-1 on failure.  */
+static size_t append_wide_arg(struct wide_arg ***const tail/*in,out*/,
+	struct arg_tok_buf *const tb/*in,out*/, const size_t sz, const unsigned flags)
+{
+	struct wide_arg *wa;
+
+	if ((flags & ARG_PARSE_WILDCARDS) && arg_glob_has_magic(tb->buf)) {
+		/* Append found names after the pattern.  */
+		int matched;
+		const size_t count = arg_expand_wildcard(find_backend, tb->buf, tb, &matched);
+		if ((size_t)-1 == count)
+			return (size_t)-1;
+		if (matched) {
+			return count
+				? append_found(tail, tb->buf + sz + 1, tb->filled - sz - 1, count)
+				: 0;
+		}
+	}
+
+	wa = create_wide_arg(sz);
+	if (!wa)
+		return (size_t)-1;
+	memcpy(wa->value, tb->buf, (sz + 1)*sizeof(wchar_t));
+	**tail = wa;
+	*tail = &wa->next;
+	return 1;
+}
+
+/* Read and decode the response file.
+   The file is mapped to memory or, if that fails, read to a temporary buffer.
+   Returns malloc'ated L'\0'-terminated text, or NULL on failure.  */
+static wchar_t *read_response_file(const wchar_t path[])
+{
+	wchar_t *text = NULL;
+	LARGE_INTEGER fsize;
+	const HANDLE h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+	if (INVALID_HANDLE_VALUE == h) {
+		const DWORD err = GetLastError();
+		errno = (ERROR_FILE_NOT_FOUND == err || ERROR_PATH_NOT_FOUND == err) ? ENOENT : EACCES;
+		return NULL;
 	}
 
-	for (line = cmdline; n < INT_MAX; n++) {
-		wchar_t argbuf[ARG_BUF_SIZE];
-		size_t sz = sizeof(argbuf)/sizeof(argbuf[0]) - 1;
-		const wchar_t *const tmp = line;
-		struct wide_arg *wa = NULL;
-		wchar_t *a;
-
-		if (n) {
-			/* Skip spaces between args.  */
-			for (;; line++) {
-				switch (*line) {
-					case L' ':case L'\t':
-						continue;
-					default:
+	if (!GetFileSizeEx(h, &fsize))
+		errno = EACCES;
+	else if ((ULONGLONG)fsize.QuadPart > (size_t)-1/2)
+		errno = E2BIG;
+	else if (!fsize.QuadPart)
+		text = arg_rsp_decode(NULL, 0); /* CreateFileMappingW() fails for empty files */
+	else {
+		const size_t size = (size_t)fsize.QuadPart;
+		const HANDLE m = CreateFileMappingW(h, NULL, PAGE_READONLY, 0, 0, NULL);
+		const void *const view = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (view) {
+			text = arg_rsp_decode(view, size);
+			UnmapViewOfFile(view);
+		}
+		else {
+			/* E.g. there is no room in the address space, read the file.  */
+			char *const buf = (char*)malloc(size);
+			if (buf) {
+				size_t filled = 0;
+				while (filled < size) {
+					const DWORD chunk = size - filled < 0x40000000 ? (DWORD)(size - filled) : 0x40000000;
+					DWORD got;
+					if (!ReadFile(h, buf + filled, chunk, &got, NULL) || !got)
 						break;
+					filled += got;
 				}
-				break;
+				if (filled == size)
+					text = arg_rsp_decode(buf, size);
+				else
+					errno = EIO;
+				free(buf);
 			}
-			if (!*line)
-				break;
 		}
+		if (m)
+			CloseHandle(m);
+	}
 
-		sz = !n
-			? parse_module_name(&line, argbuf, sz)
-			: parse_one_arg(&line, argbuf, sz);
+	CloseHandle(h);
+	return text;
+}
 
-		if (sz < sizeof(argbuf)/sizeof(argbuf[0]))
-			a = argbuf;
-		else {
-			wa = create_wide_arg(sz);
-			if (!wa)
-				goto err;
-			a = wa->value;
-			line = tmp;
-			sz = !n
-				? parse_module_name(&line, a, sz)
-				: parse_one_arg(&line, a, sz);
+/* Returned by arg_read_next() if there are no more arguments.  */
+#define ARG_READ_END ((size_t)-2)
+
+static void arg_reader_init(struct arg_reader *const rd/*out*/,
+	const wchar_t cmdline[], const unsigned flags)
+{
+	rd->line = cmdline;
+	rd->rsp = NULL;
+	rd->rsp_pos = NULL;
+	rd->n = 0;
+	rd->flags = flags;
+}
+
+static void arg_reader_destroy(struct arg_reader *const rd)
+{
+	if (rd->rsp)
+		free(rd->rsp);
+}
+
+/* Parse the next argument, appending it to the tb buffer: the first one is the program name.
+   If ARG_PARSE_RESPONSE_FILES is set in rd->flags, an argument of the form "@path" is
+  replaced by the arguments of the response file, then the command line is parsed further.
+   Returns the length of the argument, ARG_READ_END if there are no more arguments, or
+  (size_t)-1 on failure, e.g. if a response file cannot be read.  */
+static size_t arg_read_next(struct arg_reader *const rd/*in,out*/,
+	struct arg_tok_buf *const tb/*in,out*/)
+{
+	for (;;) {
+		size_t start, sz;
+
+		if (rd->rsp) {
+			rd->rsp_pos = arg_skip_rsp_spaces(rd->rsp_pos);
+			if (*rd->rsp_pos)
+				return arg_tokenize_rsp_arg(&rd->rsp_pos, tb);
+			free(rd->rsp);
+			rd->rsp = NULL;
 		}
 
-		a[sz] = L'\0';
-
-		/* Expand wildcards '*' or '?' in the arg.  */
-		if (n && (wcschr(a, L'*') || wcschr(a, L'?'))) {
-			WIN32_FIND_DATAW ffd;
-			const HANDLE h = FindFirstFileW(a, &ffd);
-			if (INVALID_HANDLE_VALUE != h) {
-				do {
-					/* Skip . and .. directory entries */
-					if (L'.' != ffd.cFileName[0] ||
-						(L'\0' != ffd.cFileName[1] && (
-							L'.' != ffd.cFileName[1] || L'\0' != ffd.cFileName[2])))
-					{
-						const size_t len = wcslen(ffd.cFileName);
-						struct wide_arg *const file = create_wide_arg(len);
-						if (!file) {
-							FindClose(h);
-							if (wa) {
-								*tail = wa;
-								tail = &wa->next;
-							}
-							goto err;
-						}
-						memcpy(file->value, ffd.cFileName, (len + 1)*sizeof(wchar_t));
-						*tail = file;
-						tail = &file->next;
-					}
-				} while (FindNextFileW(h, &ffd));
-				FindClose(h);
-				if (wa)
-					free(wa);
-				continue;
-			}
+		if (!rd->n) {
+			rd->n++;
+			return arg_tokenize_module_name(&rd->line, tb);
 		}
 
-		if (!wa) {
-			wa = create_wide_arg(sz);
-			if (!wa)
-				goto err;
-			memcpy(wa->value, a, (sz + 1)*sizeof(wchar_t));
+		rd->line = arg_skip_spaces(rd->line);
+		if (!*rd->line || rd->n >= INT_MAX)
+			return ARG_READ_END;
+
+		rd->n++;
+		start = tb->filled;
+		sz = arg_tokenize_arg(&rd->line, tb);
+		if ((size_t)-1 == sz || !(rd->flags & ARG_PARSE_RESPONSE_FILES) ||
+			L'@' != tb->buf[start] || sz < 2)
+		{
+			return sz;
 		}
-		*tail = wa;
-		tail = &wa->next;
+
+		/* "@path" is replaced by the contents of the response file.  */
+		rd->rsp = read_response_file(tb->buf + start + 1);
+		if (!rd->rsp)
+			return (size_t)-1;
+		rd->rsp_pos = rd->rsp;
+		tb->filled = start;
+	}
+}
+
+A_Use_decl_annotations
+struct wide_arg *arg_parse_command_line_ex(int *const argc/*out*/, const unsigned flags)
+{
+	size_t count = 0; /* number of args, after expanding wildcards and response files */
+	wchar_t pathbuf[MAX_PATH];
+	wchar_t *modname;
+	const wchar_t *const cmdline = get_command_line(pathbuf, MAX_PATH, &modname);
+	struct arg_reader rd;
+	struct wide_arg *head;
+	struct wide_arg **tail = &head;
+	wchar_t argbuf[ARG_BUF_SIZE];
+	struct arg_tok_buf tb = {argbuf, 0, sizeof(argbuf)/sizeof(argbuf[0]), 0};
+
+	if (!cmdline)
+		return NULL;
+
+	for (arg_reader_init(&rd, cmdline, flags);;) {
+		/* Parse the arg to the buffer, which is grown if the arg is too long.  */
+		size_t sz;
+		tb.filled = 0;
+		sz = arg_read_next(&rd, &tb);
+
+		if (ARG_READ_END == sz)
+			break;
+
+		/* Do not expand wildcards in the program name.  */
+		if ((size_t)-1 != sz)
+			sz = append_wide_arg(&tail, &tb, sz, count ? flags : 0u);
+
+		if ((size_t)-1 == sz)
+			goto err;
+
+		count += sz;
 	} /* for */
 
-	if (modname && modname != pathbuf)
+	if (modname)
 		free(modname);
+	if (tb.own)
+		free(tb.buf);
 	*tail = NULL;
-	*argc = (int)n; /* >0 */
+	if (count > INT_MAX) {
+		arg_free_wide_args(head);
+		errno = E2BIG;
+		return NULL;
+	}
+	*argc = (int)count; /* >0 */
 	return head;
 
 err:
-	if (modname && modname != pathbuf)
+	arg_reader_destroy(&rd);
+	if (modname)
 		free(modname);
+	if (tb.own)
+		free(tb.buf);
 	*tail = NULL;
 	arg_free_wide_args(head);
 	return NULL;
 }
 
-/* Free arguments array allocated by arg_convert_wide_args().  */
+A_Use_decl_annotations
+struct wide_arg *arg_parse_command_line(int *const argc/*out*/)
+{
+	return arg_parse_command_line_ex(argc, ARG_PARSE_WILDCARDS);
+}
+
+/* Growable block of packed '\0'-terminated strings.  */
+struct arg_block {
+	char *buf;
+	size_t filled; /* number of used bytes */
+	size_t size;   /* number of allocated bytes */
+};
+
+/* Make sure there is a space for at least need bytes in the block.
+   Returns 0 on failure.  */
+static int arg_block_reserve(struct arg_block *const blk, const size_t need)
+{
+	if (need > blk->size - blk->filled) {
+		const size_t max_size = (size_t)-1 - sizeof(void*);
+		size_t new_size = blk->size ? blk->size : ARG_BUF_SIZE*sizeof(wchar_t);
+		char *b;
+		if (need > max_size - blk->filled) {
+			errno = E2BIG;
+			return 0;
+		}
+		/* grow geometrically */
+		while (need > new_size - blk->filled)
+			new_size = new_size <= max_size/2 ? new_size*2 : max_size;
+		b = (char*)realloc(blk->buf, new_size);
+		if (!b)
+			return 0;
+		blk->buf = b;
+		blk->size = new_size;
+	}
+	return 1;
+}
+
+/* Append utf16 string of len characters to the block, converting it to utf8.
+   Returns 0 on failure.  */
+static int arg_block_append_utf8(struct arg_block *const blk, const wchar_t s[], const size_t len)
+{
+	/* one utf16 character is converted to at most 3 utf8 bytes */
+	size_t n = len + 1/*L'\0'*/;
+	if (len >= ((size_t)-1)/3) {
+		errno = E2BIG;
+		return 0;
+	}
+	if (!arg_block_reserve(blk, len*3 + 1/*'\0'*/))
+		return 0;
+	if (!cvt_utf16_to_8(s, &n, blk->buf + blk->filled, blk->size - blk->filled))
+		return 0;
+	blk->filled += n;
+	return 1;
+}
+
+/* Convert the block of count packed strings to NULL-terminated array of pointers
+  followed by the strings.
+   Frees the block on failure.  */
+static void **arg_block_to_argv(struct arg_block *const blk, size_t count, const int wide)
+{
+	if (count <= INT_MAX) {
+		const size_t ptrs_sz = sizeof(void*)*(count + 1);
+		if (blk->filled <= (size_t)-1 - ptrs_sz) {
+			/* Move the strings to make a room for the array of pointers before them.  */
+			void **const argv = (void**)realloc(blk->buf, ptrs_sz + blk->filled);
+			if (argv) {
+				void **p = argv;
+				char *a = (char*)memmove(argv + count + 1, argv, blk->filled);
+				for (; count; count--, p++) {
+					*p = a;
+					a += wide
+						? sizeof(wchar_t)*(wcslen((const wchar_t*)a) + 1)
+						: strlen(a) + 1;
+				}
+				*p = NULL;
+				return argv;
+			}
+			free(blk->buf);
+			return NULL;
+		}
+	}
+	free(blk->buf);
+	errno = E2BIG;
+	return NULL;
+}
+
+A_Use_decl_annotations
+wchar_t **arg_parse_command_line_argv_ex(int *const argc/*out*/, const unsigned flags)
+{
+	size_t count = 0; /* number of args, after expanding wildcards and response files */
+	wchar_t pathbuf[MAX_PATH];
+	wchar_t *modname;
+	const wchar_t *const cmdline = get_command_line(pathbuf, MAX_PATH, &modname);
+	struct arg_reader rd;
+	struct arg_tok_buf tb = {NULL, 0, 0, 0};
+
+	if (!cmdline)
+		return NULL;
+
+	for (arg_reader_init(&rd, cmdline, flags);;) {
+		/* Parse the arg directly to the block, growing it as needed.  */
+		const size_t start = tb.filled;
+		const size_t sz = arg_read_next(&rd, &tb);
+
+		if (ARG_READ_END == sz)
+			break;
+
+		if ((size_t)-1 == sz)
+			goto err;
+
+		/* Expand wildcards in the arg, append found names after the pattern.  */
+		if (count && (flags & ARG_PARSE_WILDCARDS) && arg_glob_has_magic(tb.buf + start)) {
+			int matched;
+			const size_t found = arg_expand_wildcard(find_backend, tb.buf + start, &tb, &matched);
+			if ((size_t)-1 == found)
+				goto err;
+			if (matched) {
+				/* The pattern is not needed anymore, overwrite it by the found names.  */
+				memmove(tb.buf + start, tb.buf + start + sz + 1,
+					sizeof(wchar_t)*(tb.filled - start - sz - 1));
+				tb.filled -= sz + 1;
+				count += found;
+				continue;
+			}
+		}
+
+		count++;
+	} /* for */
+
+	if (modname)
+		free(modname);
+
+	{
+		/* Note: tb.buf is always allocated - there is at least the program name.  */
+		struct arg_block blk;
+		wchar_t **wargv;
+		blk.buf = (char*)tb.buf;
+		blk.filled = sizeof(wchar_t)*tb.filled;
+		blk.size = sizeof(wchar_t)*tb.size;
+		wargv = (wchar_t**)arg_block_to_argv(&blk, count, /*wide:*/1);
+		if (wargv)
+			*argc = (int)count; /* >0 */
+		return wargv;
+	}
+
+err:
+	arg_reader_destroy(&rd);
+	if (modname)
+		free(modname);
+	free(tb.buf);
+	return NULL;
+}
+
+A_Use_decl_annotations
+wchar_t **arg_parse_command_line_argv(int *const argc/*out*/)
+{
+	return arg_parse_command_line_argv_ex(argc, ARG_PARSE_WILDCARDS);
+}
+
+A_Use_decl_annotations
+char **arg_parse_command_line_utf8_ex(int *const argc/*out*/, const unsigned flags)
+{
+	size_t count = 0; /* number of args, after expanding wildcards and response files */
+	wchar_t pathbuf[MAX_PATH];
+	wchar_t *modname;
+	const wchar_t *const cmdline = get_command_line(pathbuf, MAX_PATH, &modname);
+	struct arg_reader rd;
+	struct arg_block blk = {NULL, 0, 0};
+	wchar_t argbuf[ARG_BUF_SIZE];
+	struct arg_tok_buf tb = {argbuf, 0, sizeof(argbuf)/sizeof(argbuf[0]), 0};
+
+	if (!cmdline)
+		return NULL;
+
+	for (arg_reader_init(&rd, cmdline, flags);;) {
+		/* Parse the arg to the buffer, which is grown if the arg is too long.  */
+		size_t sz;
+		tb.filled = 0;
+		sz = arg_read_next(&rd, &tb);
+
+		if (ARG_READ_END == sz)
+			break;
+
+		if ((size_t)-1 == sz)
+			goto err;
+
+		/* Expand wildcards in the arg, append found names after the pattern.  */
+		if (count && (flags & ARG_PARSE_WILDCARDS) && arg_glob_has_magic(tb.buf)) {
+			int matched;
+			size_t found = arg_expand_wildcard(find_backend, tb.buf, &tb, &matched);
+			if ((size_t)-1 == found)
+				goto err;
+			if (matched) {
+				const wchar_t *name = tb.buf + sz + 1;
+				for (; found; found--) {
+					const size_t len = wcslen(name);
+					if (!arg_block_append_utf8(&blk, name, len))
+						goto err;
+					name += len + 1;
+					count++;
+				}
+				continue;
+			}
+		}
+
+		if (!arg_block_append_utf8(&blk, tb.buf, sz))
+			goto err;
+		count++;
+	} /* for */
+
+	if (modname)
+		free(modname);
+	if (tb.own)
+		free(tb.buf);
+
+	{
+		char **const argv = (char**)arg_block_to_argv(&blk, count, /*wide:*/0);
+		if (argv)
+			*argc = (int)count; /* >0 */
+		return argv;
+	}
+
+err:
+	arg_reader_destroy(&rd);
+	if (modname)
+		free(modname);
+	if (tb.own)
+		free(tb.buf);
+	free(blk.buf);
+	return NULL;
+}
+
+A_Use_decl_annotations
+char **arg_parse_command_line_utf8(int *const argc/*out*/)
+{
+	return arg_parse_command_line_utf8_ex(argc, ARG_PARSE_WILDCARDS);
+}
+
+A_Use_decl_annotations
+int arg_iter_init(struct arg_iter *const it/*out*/,
+	wchar_t buf[]/*NULL?*/, const size_t sz/*0?*/, const unsigned flags)
+{
+	/* The program name must live until arg_iter_destroy(), so it is allocated on heap.  */
+	const wchar_t *const cmdline = get_command_line(NULL, 0, &it->modname);
+	if (!cmdline)
+		return 0;
+	arg_reader_init(&it->rd, cmdline, flags);
+	it->found = 0;
+	it->tb.buf = buf;
+	it->tb.filled = 0;
+	it->tb.size = buf ? sz : 0;
+	it->tb.own = 0;
+	it->flags = flags;
+	return 1;
+}
+
+/* Return the name of the next found file as the next argument.  */
+static int arg_iter_found(struct arg_iter *const it,
+	const wchar_t **const arg/*out*/, size_t *const len/*NULL?,out*/)
+{
+	const wchar_t *const name = it->tb.buf + it->next;
+	const size_t sz = wcslen(name);
+	it->next += sz + 1;
+	it->found--;
+	*arg = name;
+	if (len)
+		*len = sz;
+	return 1;
+}
+
+A_Use_decl_annotations
+int arg_iter_next(struct arg_iter *const it/*in,out*/,
+	const wchar_t **const arg/*out*/, size_t *const len/*NULL?,out*/)
+{
+	/* Return the rest of files found by a wildcard.  */
+	if (it->found)
+		return arg_iter_found(it, arg, len);
+
+	for (;;) {
+		/* The program name is the first command-line token.  */
+		const int is_name = !it->rd.n;
+		size_t sz;
+
+		it->tb.filled = 0;
+		sz = arg_read_next(&it->rd, &it->tb);
+
+		if (ARG_READ_END == sz)
+			return 0;
+
+		if ((size_t)-1 == sz)
+			return -1;
+
+		/* Expand wildcards in the arg, append found names after the pattern.  */
+		if (!is_name && (it->flags & ARG_ITER_WILDCARDS) && arg_glob_has_magic(it->tb.buf)) {
+			int matched;
+			const size_t found = arg_expand_wildcard(find_backend, it->tb.buf, &it->tb, &matched);
+			if ((size_t)-1 == found)
+				return -1;
+			if (matched) {
+				if (!found)
+					continue;
+				it->found = found;
+				it->next = sz + 1;
+				return arg_iter_found(it, arg, len);
+			}
+		}
+
+		*arg = it->tb.buf;
+		if (len)
+			*len = sz;
+		return 1;
+	}
+}
+
+A_Use_decl_annotations
+void arg_iter_destroy(struct arg_iter *const it)
+{
+	arg_reader_destroy(&it->rd);
+	if (it->tb.own)
+		free(it->tb.buf);
+	if (it->modname)
+		free(it->modname);
+}
+
+/* Free arguments array allocated by arg_convert_wide_args() or arg_parse_command_line_utf8().  */
 A_Use_decl_annotations
 void arg_free_argv(char **const argv)
 {
-	char **a = argv;
-	for (; *a; a++)
-		free(*a);
+	/* Pointers and strings are allocated in one block.  */
 	free(argv);
 }
 
-/* Free arguments array allocated by arg_convert_mb_args().  */
+/* Free arguments array allocated by arg_convert_mb_args() or arg_parse_command_line_argv().  */
 A_Use_decl_annotations
 void arg_free_wargv(wchar_t **const wargv)
 {
-	void *const arr = wargv;
-	arg_free_argv((char**)arr);
+	free(wargv);
 }
 
 #ifndef PRAGMA_WARNING_PUSH
@@ -421,37 +835,47 @@ PRAGMA_WARNING_PUSH
 PRAGMA_WARNING_DISABLE_COND_IS_CONST
 	if (argc < (size_t)-1/sizeof(char*)) {
 PRAGMA_WARNING_POP
-		char **const argv = (char**)malloc(sizeof(*argv)*(argc + 1));
-		if (argv) {
-			char **p = argv;
-			for (; list; list = list->next, p++) {
-				const size_t need = wcstombs(NULL, list->value, 0);
-				if ((size_t)-1 != need) {
-					char *const a = (char*)malloc(need + 1);
-					if (a) {
-						*p = a;
-						(void)!wcstombs(a, list->value, need + 1);
-						continue;
-					}
-					if (err) {
-						err->number = (unsigned)-1;
-						err->arg = NULL;
-					}
+		/* Compute the size of the block: array of pointers followed by all the strings.
+		   Only first argc arguments of the list are converted.  */
+		const size_t ptrs = sizeof(char*)*(argc + 1);
+		size_t total = ptrs;
+		const struct wide_arg *l = list;
+		unsigned i = 0;
+		for (; l && i < argc; l = l->next, i++) {
+			const size_t need = wcstombs(NULL, l->value, 0);
+			if ((size_t)-1 == need) {
+				if (err) {
+					err->number = i;
+					err->arg = l->value;
 				}
-				else if (err) {
-					err->number = (unsigned)(p - argv);
-					err->arg = list->value;
+				return NULL;
+			}
+			if (need >= (size_t)-1 - total) {
+				errno = E2BIG;
+				goto fail;
+			}
+			total += need + 1;
+		}
+		{
+			char **const argv = (char**)malloc(total);
+			if (argv) {
+				char **p = argv;
+				char *a = (char*)(argv + argc + 1);
+				size_t left = total - ptrs; /* size of the area for the strings */
+				for (; list && p != argv + argc; list = list->next, p++) {
+					const size_t n = wcstombs(a, list->value, left) + 1;
+					*p = a;
+					a += n;
+					left -= n;
 				}
 				*p = NULL;
-				arg_free_argv(argv);
-				return NULL;
+				return argv;
 			}
-			*p = NULL;
-			return argv;
 		}
 	}
 	else
 		errno = E2BIG;
+fail:
 	if (err) {
 		err->number = (unsigned)-1;
 		err->arg = NULL;
@@ -476,38 +900,44 @@ PRAGMA_WARNING_PUSH
 PRAGMA_WARNING_DISABLE_COND_IS_CONST
 	if (argc <= (unsigned)-1 && (unsigned)argc < (size_t)-1/sizeof(wchar_t*)) {
 PRAGMA_WARNING_POP
-		wchar_t **const wargv = (wchar_t**)malloc(sizeof(*wargv)*(argc + 1));
-		if (wargv) {
-			wchar_t **p = wargv;
-			char *const *a = argv;
-			for (; *a; a++, p++) {
-				const size_t need = mbstowcs(NULL, *a, 0);
-				if ((size_t)-1 != need) {
-					wchar_t *const w = (wchar_t*)malloc(sizeof(wchar_t)*(need + 1));
-					if (w) {
-						*p = w;
-						(void)!mbstowcs(w, *a, need + 1);
-						continue;
-					}
-					if (err) {
-						err->number = (unsigned)-1;
-						err->arg = NULL;
-					}
-				}
-				else if (err) {
+		/* Compute the size of the block: array of pointers followed by all the strings.  */
+		size_t total = 0;
+		char *const *a = argv;
+		for (; *a; a++) {
+			const size_t need = mbstowcs(NULL, *a, 0);
+			if ((size_t)-1 == need) {
+				if (err) {
 					err->number = (unsigned)(a - argv);
 					err->arg = *a;
 				}
-				*p = NULL;
-				arg_free_wargv(wargv);
 				return NULL;
 			}
-			*p = NULL;
-			return wargv;
+			if (need >= ((size_t)-1 - sizeof(wchar_t*)*(argc + 1))/sizeof(wchar_t) - total) {
+				errno = E2BIG;
+				goto fail;
+			}
+			total += need + 1;
+		}
+		{
+			wchar_t **const wargv = (wchar_t**)malloc(
+				sizeof(wchar_t*)*(argc + 1) + sizeof(wchar_t)*total);
+			if (wargv) {
+				wchar_t **p = wargv;
+				wchar_t *w = (wchar_t*)(wargv + argc + 1);
+				for (a = argv; *a; a++, p++) {
+					const size_t n = mbstowcs(w, *a, total) + 1;
+					*p = w;
+					w += n;
+					total -= n;
+				}
+				*p = NULL;
+				return wargv;
+			}
 		}
 	}
 	else
 		errno = E2BIG;
+fail:
 	if (err) {
 		err->number = (unsigned)-1;
 		err->arg = NULL;
@@ -0,0 +1,670 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* arg_tokenizer.c */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h> /* for WCHAR_MAX */
+
+#include "mscrtx/arg_tokenizer.h"
+#include "mscrtx/utf16cvt.h"
+
+#ifndef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+#define A_Use_decl_annotations
+#endif
+
+/* Runs of ordinary characters are skipped by 8/16 wide-characters at once,
+  define ARG_TOKENIZER_NO_SIMD to use only the scalar code.  */
+#if !defined ARG_TOKENIZER_NO_SIMD && defined WCHAR_MAX && WCHAR_MAX <= 0xFFFF
+# if defined __AVX2__
+#  include <immintrin.h>
+#  define ARG_TOKENIZER_AVX2
+#  define ARG_TOKENIZER_SSE2
+# elif defined __SSE2__ || defined _M_X64 || defined _M_AMD64 || \
+	(defined _M_IX86_FP && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define ARG_TOKENIZER_SSE2
+# endif
+#endif
+
+#ifdef ARG_TOKENIZER_AVX2
+# define SIMD_ALIGN 32u
+#else
+# define SIMD_ALIGN 16u
+#endif
+
+/* Aligned loads may read past the terminating L'\0' (never crossing the page boundary),
+  do not let the address sanitizer report that.  */
+#ifndef ARG_TOKENIZER_NO_SANITIZE
+# if defined ARG_TOKENIZER_SSE2 && defined __SANITIZE_ADDRESS__
+#  ifdef _MSC_VER
+#   define ARG_TOKENIZER_NO_SANITIZE __declspec(no_sanitize_address)
+#  else
+#   define ARG_TOKENIZER_NO_SANITIZE __attribute__((no_sanitize_address))
+#  endif
+# elif defined ARG_TOKENIZER_SSE2 && defined __clang__ && defined __has_feature
+#  if __has_feature(address_sanitizer)
+#   define ARG_TOKENIZER_NO_SANITIZE __attribute__((no_sanitize_address))
+#  endif
+# endif
+# ifndef ARG_TOKENIZER_NO_SANITIZE
+#  define ARG_TOKENIZER_NO_SANITIZE
+# endif
+#endif
+
+/* tokenize_arg() is instantiated for each scanning mode, so the checks of the mode
+  are resolved at compile time.  */
+#ifdef _MSC_VER
+# define ARG_TOKENIZER_INLINE __forceinline
+#elif defined __GNUC__
+# define ARG_TOKENIZER_INLINE inline __attribute__((always_inline))
+#else
+# define ARG_TOKENIZER_INLINE inline
+#endif
+
+/* Scanning modes.  */
+#define SCAN_ARG    0 /* not in quote-mode */
+#define SCAN_QUOTED 1 /* in quote-mode */
+#define SCAN_RSP    2 /* not in quote-mode, in a response file: newlines are delimiters too */
+
+/* Check if the character ends a run of ordinary characters:
+  L'\0' or L'"', and also L' ' or L'\t' - if not in quote-mode,
+  and also L'\n' or L'\r' - in a response file.
+   Note: backslashes are special only before a double-quote, they are
+  counted backwards from the double-quote, see count_backslashes().  */
+static inline int is_special(const wchar_t c, const int mode)
+{
+	return L'\0' == c || L'"' == c || (SCAN_QUOTED != mode &&
+		(L' ' == c || L'\t' == c || (SCAN_RSP == mode && (L'\n' == c || L'\r' == c))));
+}
+
+#ifdef ARG_TOKENIZER_SSE2
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+/* Index of the lowest set bit of the non-zero mask.  */
+static inline unsigned first_bit(const unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return (unsigned)i;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+/* Find special characters among SIMD_ALIGN/sizeof(wchar_t) characters at w.
+   Returns the mask of two bits per special character, 0 if there are none.
+   Not in quote-mode, first look for characters <= L'"': this catches L'\0', L'\t',
+  L'\n', L'\r', L' ' and L'"' with one comparison, the exact comparisons that filter
+  out rare false positives are done only if there is a match.  */
+ARG_TOKENIZER_NO_SANITIZE
+static inline unsigned special_mask(const wchar_t w[], const int mode)
+{
+#ifdef ARG_TOKENIZER_AVX2
+	const __m256i v = _mm256_loadu_si256((const __m256i*)w);
+	const __m256i dq = _mm256_set1_epi16(L'"');
+	__m256i m = _mm256_or_si256(
+		_mm256_cmpeq_epi16(v, _mm256_setzero_si256()), _mm256_cmpeq_epi16(v, dq));
+	if (SCAN_QUOTED != mode) {
+		if (!_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+			_mm256_subs_epu16(v, dq), _mm256_setzero_si256())))
+		{
+			return 0;
+		}
+		m = _mm256_or_si256(m, _mm256_or_si256(
+			_mm256_cmpeq_epi16(v, _mm256_set1_epi16(L' ')),
+			_mm256_cmpeq_epi16(v, _mm256_set1_epi16(L'\t'))));
+		if (SCAN_RSP == mode)
+			m = _mm256_or_si256(m, _mm256_or_si256(
+				_mm256_cmpeq_epi16(v, _mm256_set1_epi16(L'\n')),
+				_mm256_cmpeq_epi16(v, _mm256_set1_epi16(L'\r'))));
+	}
+	return (unsigned)_mm256_movemask_epi8(m);
+#else
+	const __m128i v = _mm_loadu_si128((const __m128i*)w);
+	const __m128i dq = _mm_set1_epi16(L'"');
+	__m128i m = _mm_or_si128(
+		_mm_cmpeq_epi16(v, _mm_setzero_si128()), _mm_cmpeq_epi16(v, dq));
+	if (SCAN_QUOTED != mode) {
+		if (!_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(v, dq), _mm_setzero_si128())))
+			return 0;
+		m = _mm_or_si128(m, _mm_or_si128(
+			_mm_cmpeq_epi16(v, _mm_set1_epi16(L' ')),
+			_mm_cmpeq_epi16(v, _mm_set1_epi16(L'\t'))));
+		if (SCAN_RSP == mode)
+			m = _mm_or_si128(m, _mm_or_si128(
+				_mm_cmpeq_epi16(v, _mm_set1_epi16(L'\n')),
+				_mm_cmpeq_epi16(v, _mm_set1_epi16(L'\r'))));
+	}
+	return (unsigned)_mm_movemask_epi8(m);
+#endif
+}
+
+#endif /* ARG_TOKENIZER_SSE2 */
+
+/* Skip ordinary characters of the L'\0'-terminated string.
+   Returns pointer to the first special character (see is_special()).  */
+ARG_TOKENIZER_NO_SANITIZE
+static inline const wchar_t *skip_plain(const wchar_t *w, const int mode)
+{
+#ifdef ARG_TOKENIZER_SSE2
+	unsigned m;
+	/* the run is often empty, e.g. after an escaped double-quote */
+	if (is_special(*w, mode))
+		return w;
+	/* Loads that do not cross the page boundary never fault,
+	  so it is safe to read past the terminating L'\0'.  */
+	if (((size_t)w & 4095) > 4096 - SIMD_ALIGN) {
+		for (; (size_t)w & (SIMD_ALIGN - 1); w++) {
+			if (is_special(*w, mode))
+				return w;
+		}
+	}
+	else if (0 != (m = special_mask(w, mode))) {
+		/* the mask gives the exact position: short arguments end here */
+		return w + first_bit(m)/sizeof(*w);
+	}
+	else {
+		/* continue from the next aligned block */
+		w = (const wchar_t*)(((size_t)w + SIMD_ALIGN) & ~(size_t)(SIMD_ALIGN - 1));
+	}
+	for (;; w += SIMD_ALIGN/sizeof(*w)) {
+		m = special_mask(w, mode);
+		if (m)
+			return w + first_bit(m)/sizeof(*w);
+	}
+#else
+	while (!is_special(*w, mode))
+		w++;
+	return w;
+#endif
+}
+
+/* Count backslashes before the double-quote at w, not looking before b.  */
+static size_t count_backslashes(const wchar_t *const b, const wchar_t *const w)
+{
+	const wchar_t *bs = w;
+	while (bs != b && L'\\' == bs[-1])
+		bs--;
+	return (size_t)(w - bs);
+}
+
+/* Initial size of the buffer allocated on heap, in wide-characters.  */
+#define ARG_TOK_BUF_SIZE 1024
+
+A_Use_decl_annotations
+int arg_tok_buf_reserve(struct arg_tok_buf *const out/*in,out*/, const size_t need)
+{
+	if (need > out->size - out->filled) {
+		const size_t max_size = ((size_t)-1)/sizeof(wchar_t);
+		size_t new_size = out->size > ARG_TOK_BUF_SIZE/2 ? out->size : ARG_TOK_BUF_SIZE/2;
+		wchar_t *b;
+		if (need > max_size - out->filled) {
+			errno = E2BIG;
+			return 0;
+		}
+		/* grow geometrically */
+		do {
+			new_size = new_size <= max_size/2 ? new_size*2 : max_size;
+		} while (need > new_size - out->filled);
+		if (out->own)
+			b = (wchar_t*)realloc(out->buf, new_size*sizeof(*b));
+		else {
+			/* the caller-supplied buffer cannot be reallocated */
+			b = (wchar_t*)malloc(new_size*sizeof(*b));
+			if (b && out->filled)
+				memcpy(b, out->buf, out->filled*sizeof(*b));
+		}
+		if (!b)
+			return 0;
+		out->buf = b;
+		out->size = new_size;
+		out->own = 1;
+	}
+	return 1;
+}
+
+/* Append characters [b, t) to the buffer.
+   Returns 0 on failure.  */
+static int copy_to(struct arg_tok_buf *const out,
+	const wchar_t *const b, const wchar_t *const t)
+{
+	const size_t copy = (size_t)(t - b);
+	if (!copy)
+		return 1;
+	if (copy > out->size - out->filled && !arg_tok_buf_reserve(out, copy))
+		return 0;
+	if (copy <= 8) {
+		/* most copies are short, don't call memcpy() for them */
+		wchar_t *const d = out->buf + out->filled;
+		size_t i = 0;
+		do {
+			d[i] = b[i];
+		} while (++i != copy);
+	}
+	else
+		memcpy(out->buf + out->filled, b, copy*sizeof(*b));
+	out->filled += copy;
+	return 1;
+}
+
+/* Terminate the token started at out->buf[start] by L'\0'.
+   Returns the length of the token or (size_t)-1 on failure.  */
+static size_t finish_token(struct arg_tok_buf *const out, const size_t start)
+{
+	if (out->size == out->filled && !arg_tok_buf_reserve(out, 1)) {
+		out->filled = start;
+		return (size_t)-1;
+	}
+	out->buf[out->filled++] = L'\0';
+	return out->filled - 1 - start;
+}
+
+A_Use_decl_annotations
+size_t arg_tokenize_module_name(const wchar_t **const line/*in,out*/,
+	struct arg_tok_buf *const out/*in,out*/)
+{
+	/* assume there are no escaped double-quotes */
+	const size_t start = out->filled;
+	const wchar_t *w = *line;
+	const wchar_t *b = w;
+	for (;;) {
+		switch (*w) {
+			default:
+				w = skip_plain(w + 1, SCAN_ARG);
+				continue;
+			case L'\0':case L' ':case L'\t':case L'"':
+				if (!copy_to(out, b, w))
+					goto fail;
+				if (L'"' != *w)
+					break;
+				/* skip double-quote, don't stop on spaces and tabs */
+				for (b = ++w;;) {
+					switch (*w) {
+						default:
+							w = skip_plain(w + 1, SCAN_QUOTED);
+							continue;
+						case L'\0':case L'"':
+							break;
+					}
+					break;
+				}
+				if (!copy_to(out, b, w))
+					goto fail;
+				if (L'\0' == *w)
+					break;
+				b = ++w; /* skip double-quote */
+				continue;
+		}
+		break;
+	}
+	{
+		const size_t name_sz = finish_token(out, start);
+		if ((size_t)-1 != name_sz)
+			*line = w;
+		return name_sz;
+	}
+fail:
+	out->filled = start;
+	return (size_t)-1;
+}
+
+/* Parse one argument, mode - SCAN_ARG or SCAN_RSP.  */
+static ARG_TOKENIZER_INLINE size_t tokenize_arg(const wchar_t **const line/*in,out*/,
+	struct arg_tok_buf *const out/*in,out*/, const int mode)
+{
+	/* double-quotes can be escaped - backslashes before double-quotes are halved:
+	  "     ->     (quote-mode)
+	  \"    ->  "
+	  \\"   ->  \  (quote-mode)
+	  \\\"  ->  \"
+	  \\\\" ->  \\ (quote-mode) */
+	/* note: handle a special case of escaping double-quote inside double-quotes:
+	  "abc""def"  ->  abc"def   */
+	const size_t start = out->filled;
+	const wchar_t *w = *line;
+	const wchar_t *b = w, *t;
+	for (;;) {
+		w = skip_plain(w, mode);
+		t = w;
+		if (L'"' == *w) {
+			const size_t n = count_backslashes(b, w);
+			t = w - (n + 1)/2;
+			if (1u & n) {
+				if (!copy_to(out, b, t))
+					goto fail;
+				b = w++;
+				continue; /* double-quote is escaped */
+			}
+		}
+		if (!copy_to(out, b, t))
+			goto fail;
+		if (L'"' != *w)
+			break;
+		/* skip double-quote, don't stop on spaces and tabs */
+		for (b = ++w;; w++) {
+			for (;;) {
+				w = skip_plain(w, SCAN_QUOTED);
+				t = w;
+				if (L'"' == *w) {
+					const size_t n = count_backslashes(b, w);
+					t = w - (n + 1)/2;
+					if (1u & n) {
+						if (!copy_to(out, b, t))
+							goto fail;
+						b = w++;
+						continue; /* double-quote is escaped */
+					}
+				}
+				break;
+			}
+			if (!copy_to(out, b, t))
+				goto fail;
+			if (L'\0' == *w)
+				goto ret;
+			b = ++w; /* skip double-quote */
+			if (L'"' != *w)
+				break;
+			/* special case: escaped double-quote inside double quotes:
+			  "abc""def"  ->  abc"def   */
+		}
+	}
+ret:
+	{
+		const size_t arg_sz = finish_token(out, start);
+		if ((size_t)-1 != arg_sz)
+			*line = w;
+		return arg_sz;
+	}
+fail:
+	out->filled = start;
+	return (size_t)-1;
+}
+
+A_Use_decl_annotations
+size_t arg_tokenize_arg(const wchar_t **const line/*in,out*/,
+	struct arg_tok_buf *const out/*in,out*/)
+{
+	return tokenize_arg(line, out, SCAN_ARG);
+}
+
+A_Use_decl_annotations
+size_t arg_tokenize_rsp_arg(const wchar_t **const line/*in,out*/,
+	struct arg_tok_buf *const out/*in,out*/)
+{
+	return tokenize_arg(line, out, SCAN_RSP);
+}
+
+A_Use_decl_annotations
+const wchar_t *arg_skip_spaces(const wchar_t *line)
+{
+	for (;; line++) {
+		switch (*line) {
+			case L' ':case L'\t':
+				continue;
+			default:
+				return line;
+		}
+	}
+}
+
+A_Use_decl_annotations
+const wchar_t *arg_skip_rsp_spaces(const wchar_t *text)
+{
+	for (;; text++) {
+		switch (*text) {
+			case L' ':case L'\t':case L'\n':case L'\r':
+				continue;
+			default:
+				return text;
+		}
+	}
+}
+
+A_Use_decl_annotations
+wchar_t *arg_rsp_decode(const void *const data/*NULL?*/, size_t size/*0?*/)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	wchar_t *text;
+
+	if (size >= 2 && ((0xFF == p[0] && 0xFE == p[1]) || (0xFE == p[0] && 0xFF == p[1]))) {
+		/* UTF-16 */
+		const unsigned lo = 0xFF == p[0] ? 0u : 1u; /* offset of the low byte */
+		size_t i;
+		if (size & 1) {
+			errno = EILSEQ;
+			return NULL;
+		}
+		size = size/2 - 1;
+		p += 2;
+		text = (wchar_t*)malloc((size + 1)*sizeof(*text));
+		if (!text)
+			return NULL;
+		for (i = 0; i < size; i++) {
+			const unsigned c = p[2*i + lo] | (unsigned)p[2*i + (lo ^ 1u)] << 8;
+			if (c - 0xD800 < 0x400) {
+				/* high surrogate must be followed by a low one */
+				const unsigned d = i + 1 < size
+					? p[2*i + 2 + lo] | (unsigned)p[2*i + 2 + (lo ^ 1u)] << 8 : 0u;
+				if (d - 0xDC00 >= 0x400)
+					break;
+				text[i++] = (wchar_t)c;
+				text[i] = (wchar_t)d;
+			}
+			else if (!c || c - 0xDC00 < 0x400)
+				break; /* null character or unpaired low surrogate */
+			else
+				text[i] = (wchar_t)c;
+		}
+		if (i != size) {
+			free(text);
+			errno = EILSEQ;
+			return NULL;
+		}
+		text[size] = L'\0';
+		return text;
+	}
+
+	/* UTF-8, optionally with BOM */
+	if (size >= 3 && 0xEF == p[0] && 0xBB == p[1] && 0xBF == p[2]) {
+		size -= 3;
+		p += 3;
+	}
+	if (size && memchr(p, '\0', size)) {
+		/* the text cannot contain null characters */
+		errno = EILSEQ;
+		return NULL;
+	}
+	return cvt_utf8_to_16_z_n((const char*)p, size, NULL, 0);
+}
+
+/* How an argument is encoded in the command line, see quote_scan().  */
+struct quote_info {
+	size_t len;   /* length of the argument, in wide-characters */
+	size_t extra; /* number of added backslashes and double-quotes */
+	size_t bs;    /* number of backslashes at the end of the argument */
+	int dq;       /* non-zero if the argument contains double-quotes */
+	int wrap;     /* non-zero if the argument is enclosed in double-quotes */
+};
+
+/* Account the next character of the argument, the length is counted by the caller.  */
+static inline void quote_scan(struct quote_info *const q/*in,out*/, const unsigned c)
+{
+	if ('\\' == c) {
+		q->bs++;
+		return;
+	}
+	if ('"' == c) {
+		q->extra += q->bs + 1; /* \\"  ->  \\\\\" */
+		q->dq = 1;
+	}
+	else if (' ' == c || '\t' == c)
+		q->wrap = 1;
+	q->bs = 0;
+}
+
+/* Finish scanning of the argument, module - non-zero for the program name.
+   Returns 0 if the argument cannot be encoded.  */
+static int quote_finish(struct quote_info *const q/*in,out*/, const int module)
+{
+	if (!q->len)
+		q->wrap = 1;
+	if (module) {
+		/* there are no escape sequences in the program name */
+		if (q->dq) {
+			errno = EINVAL;
+			return 0;
+		}
+		q->bs = 0;
+	}
+	if (q->wrap)
+		q->extra += 2 + q->bs;
+	return 1;
+}
+
+/* Write the encoded argument to d, the q->len characters of the argument at a may
+  be placed in the same buffer, but not before d.
+   Returns pointer after the written characters.  */
+static wchar_t *quote_write(wchar_t *d, const wchar_t *a, const struct quote_info *const q)
+{
+	/* the number of written characters never gets ahead of the number of read ones plus
+	  q->extra, so if a == d + q->extra, characters of the argument are read before
+	  they are overwritten */
+	if (q->wrap)
+		*d++ = L'"';
+	if (!q->dq) {
+		memmove(d, a, q->len*sizeof(*d));
+		d += q->len;
+	}
+	else {
+		const wchar_t *const e = a + q->len;
+		size_t bs = 0;
+		while (a != e) {
+			const wchar_t c = *a++;
+			if (L'\\' == c)
+				bs++;
+			else {
+				if (L'"' == c) {
+					for (bs++; bs; bs--)
+						*d++ = L'\\';
+				}
+				bs = 0;
+			}
+			*d++ = c;
+		}
+	}
+	if (q->wrap) {
+		size_t bs = q->bs;
+		for (; bs; bs--)
+			*d++ = L'\\';
+		*d++ = L'"';
+	}
+	return d;
+}
+
+/* Scan the UTF-16 argument.  */
+static void quote_scan_w(const wchar_t a[], struct quote_info *const q/*out*/)
+{
+	const wchar_t *w = a;
+	memset(q, 0, sizeof(*q));
+	for (; *w; w++)
+		quote_scan(q, (unsigned)*w);
+	q->len = (size_t)(w - a);
+}
+
+/* Scan the UTF-8 argument, count its length in UTF-16 characters.
+   Malformed UTF-8 is not detected here, but by the conversion.  */
+static void quote_scan_utf8(const char a[], struct quote_info *const q/*out*/)
+{
+	const unsigned char *s = (const unsigned char*)a;
+	size_t len = 0;
+	memset(q, 0, sizeof(*q));
+	for (; *s; s++) {
+		const unsigned c = *s;
+		quote_scan(q, c); /* bytes of non-ASCII characters are never special */
+		len += (size_t)(0x80 != (c & 0xC0)) + (c >= 0xF0); /* not a continuation byte, surrogate pair */
+	}
+	q->len = len;
+}
+
+/* Encode the vector of arguments, utf8 - non-zero if argv points to UTF-8 strings.  */
+static wchar_t *encode_command_line(const void *const argv, const int utf8)
+{
+	const wchar_t *const *const wargv = (const wchar_t *const*)argv;
+	const char *const *const cargv = (const char *const*)argv;
+	const size_t max_size = ((size_t)-1)/sizeof(wchar_t);
+	size_t total = 1; /* terminating L'\0' */
+	size_t i;
+	wchar_t *line, *d;
+
+	/* compute the size of the command line */
+	for (i = 0; utf8 ? NULL != cargv[i] : NULL != wargv[i]; i++) {
+		struct quote_info q;
+		if (utf8)
+			quote_scan_utf8(cargv[i], &q);
+		else
+			quote_scan_w(wargv[i], &q);
+		if (!quote_finish(&q, !i))
+			return NULL;
+		if (q.len > max_size - total || q.extra + (i != 0) > max_size - total - q.len) {
+			errno = E2BIG;
+			return NULL;
+		}
+		total += q.len + q.extra + (i != 0); /* separating space */
+	}
+
+	line = (wchar_t*)malloc(total*sizeof(*line));
+	if (!line)
+		return NULL;
+
+	/* write the arguments */
+	for (d = line, i = 0; utf8 ? NULL != cargv[i] : NULL != wargv[i]; i++) {
+		struct quote_info q;
+		if (i)
+			*d++ = L' ';
+		if (utf8) {
+			/* convert the argument to the end of its place in the buffer,
+			  there is a space for the terminating L'\0' after it */
+			wchar_t *a;
+			quote_scan_utf8(cargv[i], &q);
+			(void)quote_finish(&q, !i);
+			a = cvt_utf8_to_16_z(cargv[i], d + q.extra, q.len + 1);
+			if (a != d + q.extra) {
+				if (a)
+					free(a); /* not valid UTF-8: the length was counted wrongly */
+				free(line);
+				errno = EILSEQ;
+				return NULL;
+			}
+			d = quote_write(d, a, &q);
+		}
+		else {
+			quote_scan_w(wargv[i], &q);
+			(void)quote_finish(&q, !i);
+			d = quote_write(d, wargv[i], &q);
+		}
+	}
+	*d = L'\0';
+	return line;
+}
+
+A_Use_decl_annotations
+wchar_t *arg_encode_command_line(const wchar_t *const argv[])
+{
+	return encode_command_line(argv, 0);
+}
+
+A_Use_decl_annotations
+wchar_t *arg_encode_command_line_utf8(const char *const argv[])
+{
+	return encode_command_line(argv, 1);
+}
@@ -21,6 +21,7 @@
 
 #include "mscrtx/consoleio.h"
 #include "mscrtx/console_setup.h"
+#include "mscrtx/utf16cvt.h"
 #include "libutf16/utf16_char.h"
 #include "libutf16/utf8_to_utf16.h"
 #include "libutf16/utf16_to_utf8.h"
@@ -720,9 +721,10 @@ static int flush_wbuf(const unsigned console_cp,
 	size_t count;
 	char mb_buf[CONSOLEIO_WRITE_BUF_SIZE*MB_LEN_MAX + 1/*'\n'*/];
 	if (console_cp == CP_UTF8) {
-		const utf16_char_t *w = wbuf;
-		utf8_char_t *b = (utf8_char_t*)mb_buf;
-		count = utf16_to_utf8(&w, &b, sizeof(mb_buf) - 1/*'\n'*/, wbuf_filled);
+		/* mb_buf is large enough, so cvt_utf16_to_8() will not allocate */
+		size_t len = wbuf_filled;
+		(void)sizeof(int[1-2*(sizeof(mb_buf) - 1/*'\n'*/ < CONSOLEIO_WRITE_BUF_SIZE*3)]);
+		count = cvt_utf16_to_8(wbuf, &len, mb_buf, sizeof(mb_buf) - 1/*'\n'*/) ? len : 0;
 	}
 	else {
 		const int len = WideCharToMultiByte(console_cp, 0, wbuf, (int)wbuf_filled,
@@ -9,17 +9,19 @@
 #include <errno.h>
 #include <wctype.h>
 #include <ctype.h>
+#include <windows.h> /* for FlsAlloc() */
 
 #define LOCALE_RPL_IMPL
 #include "mscrtx/localerpl.h"
 #include "mscrtx/locale_helpers.h"
 #include "libutf16/utf8_cstd.h"
-#include "libutf16/utf16_to_utf8.h"
 #include "libutf16/utf8_to_utf16_one.h"
 #include "unicode_ctype/unicode_ctype.h"
 #include "unicode_ctype/unicode_toupper.h"
 #include "mscrtx/utf8env.h"
 #include "mscrtx/utf16cvt.h"
+#include "mscrtx/arg_tokenizer.h"
+#include "mscrtx/arg_parser.h"
 #include "mscrtx/console_setup.h"
 #include "mscrtx/consoleio.h"
 
@@ -62,6 +64,17 @@
 /* static buffers */
 #define UTF8_STRERROR_BUF_SIZE 1024
 
+/* number of per-thread path scratch buffers (localerpl_rename() needs two) */
+#define PATH_SCRATCH_SLOTS 2
+
+#ifndef THREAD_LOCAL
+# ifdef _MSC_VER
+#  define THREAD_LOCAL __declspec(thread)
+# else
+#  define THREAD_LOCAL __thread
+# endif
+#endif
+
 /* stack-buffer to form 'name=value' string */
 #define SETENV_BUF_SIZE 1024
 
@@ -172,6 +185,171 @@ char *localerpl_setlocale(int category, const char *locale/*NULL?*/)
 	return current;
 }
 
+struct path_scratch {
+	wchar_t *buf;
+	size_t size; /* in wide characters */
+};
+
+static THREAD_LOCAL struct path_scratch path_scratch[PATH_SCRATCH_SLOTS];
+
+/* high-water mark: maximum size of converted path, in wide characters */
+static THREAD_LOCAL size_t path_scratch_hwm;
+
+/* index of the fiber-local storage slot, whose callback frees the scratch buffers
+  at the exit of a thread, FLS_OUT_OF_INDEXES if not allocated yet */
+static volatile LONG path_scratch_fls = (LONG)FLS_OUT_OF_INDEXES;
+
+/* Called at the exit of a thread that allocated a scratch buffer,
+  data - path_scratch array of that thread.  */
+static void WINAPI scratch_fls_callback(void *data)
+{
+	struct path_scratch *const ps = (struct path_scratch*)data;
+	unsigned i = 0;
+	for (; i < PATH_SCRATCH_SLOTS; i++) {
+		free(ps[i].buf);
+		ps[i].buf = NULL;
+		ps[i].size = 0;
+	}
+}
+
+/* Arrange for the scratch buffers of the calling thread to be freed at its exit.
+   If the fiber-local storage is exhausted, the buffers are freed only by
+  localerpl_scratch_trim().  */
+static void scratch_at_thread_exit(void)
+{
+	DWORD index = (DWORD)path_scratch_fls;
+	if (FLS_OUT_OF_INDEXES == index) {
+		LONG prev;
+		index = FlsAlloc(scratch_fls_callback);
+		if (FLS_OUT_OF_INDEXES == index)
+			return;
+		prev = InterlockedCompareExchange(&path_scratch_fls, (LONG)index, (LONG)FLS_OUT_OF_INDEXES);
+		if ((LONG)FLS_OUT_OF_INDEXES != prev) {
+			/* another thread was first, no values were set for this index yet */
+			(void)FlsFree(index);
+			index = (DWORD)prev;
+		}
+	}
+	if (!FlsGetValue(index))
+		(void)FlsSetValue(index, path_scratch);
+}
+
+/* Allocator for a path that does not fit the stack buffer:
+  reuse the scratch buffer if it is large enough.  */
+static void *scratch_alloc(void *ctx, size_t sz)
+{
+	struct path_scratch *const ps = (struct path_scratch*)ctx;
+	return sz <= ps->size*sizeof(*ps->buf) ? ps->buf : malloc(sz);
+}
+
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Nonnull_all_args
+A_Ret_z
+#endif
+static wchar_t *scratch_update(struct path_scratch *const ps, const wchar_t buf[],
+	wchar_t *const wpath, const size_t sz)
+{
+	if (wpath != buf && wpath != ps->buf) {
+		/* adopt newly allocated buffer */
+		if (!ps->buf)
+			scratch_at_thread_exit();
+		free(ps->buf);
+		ps->buf = wpath;
+		ps->size = sz;
+	}
+
+	if (path_scratch_hwm < sz)
+		path_scratch_hwm = sz;
+
+	return wpath;
+}
+
+/* Convert utf8 path to utf16 in the caller's stack buffer, or, if the path
+  does not fit there, in the per-thread scratch buffer of given slot.
+   If the scratch buffer is too small, it is replaced with the new (larger) one,
+  so only long paths ever allocate memory.
+   Returned pointer is valid until the next conversion in the same slot.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Nonnull_all_args
+A_Check_return
+A_At(path, A_In_z)
+A_At(buf, A_Pre_writable_size(PATH_BUF_SIZE))
+A_Success(return)
+A_Ret_z
+#endif
+static wchar_t *path_to_scratch(const char *path, wchar_t buf[PATH_BUF_SIZE], const unsigned slot)
+{
+	struct path_scratch *const ps = &path_scratch[slot];
+	size_t sz;
+	wchar_t *const wpath = cvt_utf8_to_16_z_sz_a(path, buf, PATH_BUF_SIZE, &sz, scratch_alloc, ps);
+	return wpath ? scratch_update(ps, buf, wpath, sz) : NULL;
+}
+
+/* Same as path_to_scratch(), but path is a slice of path_len bytes.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Nonnull_all_args
+A_Check_return
+A_At(path, A_In_reads(path_len))
+A_At(buf, A_Pre_writable_size(PATH_BUF_SIZE))
+A_Success(return)
+A_Ret_z
+#endif
+static wchar_t *path_n_to_scratch(const char *path, const size_t path_len,
+	wchar_t buf[PATH_BUF_SIZE], const unsigned slot)
+{
+	struct path_scratch *const ps = &path_scratch[slot];
+	size_t sz;
+	wchar_t *const wpath = cvt_utf8_to_16_z_n_sz_a(path, path_len, buf, PATH_BUF_SIZE, &sz,
+		scratch_alloc, ps);
+	return wpath ? scratch_update(ps, buf, wpath, sz) : NULL;
+}
+
+/* Copy a slice of path_len bytes to '\0'-terminated string,
+  malloc'ate and return new buffer if buf is too small.  */
+#ifdef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+A_Nonnull_all_args
+A_Check_return
+A_At(path, A_In_reads(path_len))
+A_At(buf, A_Pre_writable_size(buf_sz))
+A_Success(return)
+A_Ret_z
+#endif
+static char *path_n_copy(const char *path, const size_t path_len, char buf[], const size_t buf_sz)
+{
+	char *p = buf;
+	if (path_len >= buf_sz) {
+		if (path_len == (size_t)-1) {
+			errno = E2BIG;
+			return NULL;
+		}
+		p = (char*)malloc(path_len + 1);
+		if (!p)
+			return NULL;
+	}
+	memcpy(p, path, path_len);
+	p[path_len] = '\0';
+	return p;
+}
+
+void localerpl_scratch_trim(size_t keep)
+{
+	unsigned i = 0;
+	for (; i < PATH_SCRATCH_SLOTS; i++) {
+		struct path_scratch *const ps = &path_scratch[i];
+		if (ps->size > keep) {
+			free(ps->buf);
+			ps->buf = NULL;
+			ps->size = 0;
+		}
+	}
+}
+
+A_Use_decl_annotations
+size_t localerpl_scratch_hwm(void)
+{
+	return path_scratch_hwm;
+}
+
 A_Use_decl_annotations
 int localerpl_open(const char *name, int flags, ...)
 {
@@ -184,12 +362,10 @@ int localerpl_open(const char *name, int flags, ...)
 
 	if (localerpl_is_utf8()) {
 		wchar_t path_buf[PATH_BUF_SIZE];
-		wchar_t *const wpath = CVT_UTF8_TO_16_Z(name, path_buf);
+		const wchar_t *const wpath = path_to_scratch(name, path_buf, 0);
 		if (!wpath)
 			return -1;
 		fd = _wopen(wpath, flags, mode);
-		if (wpath != path_buf)
-			free(wpath);
 	}
 	else
 		fd = _open(name, flags, mode);
@@ -205,10 +381,8 @@ enum file_op {
 	OP_CHDIR
 };
 
-static int utf8_file_op(const char *path, const enum file_op op)
+static int wide_file_op(const wchar_t *wpath, const enum file_op op)
 {
-	wchar_t path_buf[PATH_BUF_SIZE];
-	wchar_t *const wpath = CVT_UTF8_TO_16_Z(path, path_buf);
 	int ret = -1;
 	if (wpath) {
 		switch (op) {
@@ -228,12 +402,51 @@ static int utf8_file_op(const char *path, const enum file_op op)
 				ret = _wchdir(wpath);
 				break;
 		}
-		if (wpath != path_buf)
-			free(wpath);
 	}
 	return ret;
 }
 
+static int utf8_file_op(const char *path, const enum file_op op)
+{
+	wchar_t path_buf[PATH_BUF_SIZE];
+	return wide_file_op(path_to_scratch(path, path_buf, 0), op);
+}
+
+static int file_op_n(const char *path, const size_t path_len, const enum file_op op)
+{
+	if (localerpl_is_utf8()) {
+		wchar_t path_buf[PATH_BUF_SIZE];
+		return wide_file_op(path_n_to_scratch(path, path_len, path_buf, 0), op);
+	}
+	{
+		char path_buf[PATH_BUF_SIZE];
+		char *const p = path_n_copy(path, path_len, path_buf, sizeof(path_buf));
+		int ret = -1;
+		if (p) {
+			switch (op) {
+				case OP_MKDIR:
+					ret = _mkdir(p);
+					break;
+				case OP_RMDIR:
+					ret = _rmdir(p);
+					break;
+				case OP_REMOVE:
+					ret = remove(p);
+					break;
+				case OP_UNLINK:
+					ret = _unlink(p);
+					break;
+				case OP_CHDIR:
+					ret = _chdir(p);
+					break;
+			}
+			if (p != path_buf)
+				free(p);
+		}
+		return ret;
+	}
+}
+
 A_Use_decl_annotations
 int localerpl_mkdir(const char *dirname)
 {
@@ -269,14 +482,10 @@ int localerpl_stat(const char *path, struct __stat64 *buf)
 {
 	if (localerpl_is_utf8()) {
 		wchar_t path_buf[PATH_BUF_SIZE];
-		wchar_t *const wpath = CVT_UTF8_TO_16_Z(path, path_buf);
-		int ret;
+		const wchar_t *const wpath = path_to_scratch(path, path_buf, 0);
 		if (!wpath)
 			return -1;
-		ret = _wstat64(wpath, buf);
-		if (wpath != path_buf)
-			free(wpath);
-		return ret;
+		return _wstat64(wpath, buf);
 	}
 	return _stat64(path, buf);
 }
@@ -286,14 +495,10 @@ int localerpl_chmod(const char *path, int mode)
 {
 	if (localerpl_is_utf8()) {
 		wchar_t path_buf[PATH_BUF_SIZE];
-		wchar_t *const wpath = CVT_UTF8_TO_16_Z(path, path_buf);
-		int ret;
+		const wchar_t *const wpath = path_to_scratch(path, path_buf, 0);
 		if (!wpath)
 			return -1;
-		ret = _wchmod(wpath, mode);
-		if (wpath != path_buf)
-			free(wpath);
-		return ret;
+		return _wchmod(wpath, mode);
 	}
 	return _chmod(path, mode);
 }
@@ -302,36 +507,13 @@ A_Use_decl_annotations
 int localerpl_rename(const char *old_name, const char *new_name)
 {
 	if (localerpl_is_utf8()) {
-		int ret;
-		wchar_t buf[PATH_BUF_SIZE*2], *wp_new = buf;
-		size_t wp_old_sz;
-		wchar_t *const wp_old = CVT_UTF8_TO_16_Z_SZ(old_name, buf, &wp_old_sz);
-
-		if (!wp_old)
-			return -1;
-
-		if (buf == wp_old)
-			wp_new = buf + wp_old_sz;
-		else
-			wp_old_sz = 0;
-
-		wp_new = cvt_utf8_to_16_z(new_name, wp_new, (size_t)(&buf[sizeof(buf)/sizeof(buf[0])] - wp_new));
-
-		if (!wp_new) {
-			if (!wp_old_sz)
-				free(wp_old);
+		wchar_t buf[PATH_BUF_SIZE*2];
+		const wchar_t *const wp_old = path_to_scratch(old_name, buf, 0);
+		const wchar_t *const wp_new = wp_old ?
+			path_to_scratch(new_name, buf + PATH_BUF_SIZE, 1) : NULL;
+		if (!wp_new)
 			return -1;
-		}
-
-		ret = _wrename(wp_old, wp_new);
-
-		if (!wp_old_sz)
-			free(wp_old);
-
-		if (wp_new != buf + wp_old_sz)
-			free(wp_new);
-
-		return ret;
+		return _wrename(wp_old, wp_new);
 	}
 	return rename(old_name, new_name);
 }
@@ -355,41 +537,210 @@ static wchar_t conv_fmode(char c)
 	}
 }
 
+/* Check open mode.  Recoding via ccs=... is not supported.  */
+static int conv_fopen_mode(wchar_t wmode[], const unsigned wmode_sz, const char *mode)
+{
+	unsigned i = 0;
+	for (;;) {
+		wmode[i] = conv_fmode(mode[i]);
+		if (wmode[i] == L'\0') {
+			if (mode[i] == '\0')
+				return 0;
+			errno = EINVAL;
+			return -1;
+		}
+		if (++i == wmode_sz) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+}
+
 A_Use_decl_annotations
 FILE *localerpl_fopen(const char *path, const char *mode)
 {
 	if (localerpl_is_utf8()) {
-		/* Check open mode.  Recoding via ccs=... is not supported.  */
 		wchar_t wmode[sizeof("+arwbtcnSRTD")];
-		unsigned i = 0;
+		wchar_t path_buf[PATH_BUF_SIZE];
+		const wchar_t *wpath;
 
-		for (;;) {
-			wmode[i] = conv_fmode(mode[i]);
-			if (wmode[i] == L'\0') {
-				if (mode[i] == '\0')
-					break;
-				errno = EINVAL;
-				return NULL;
-			}
-			if (++i == sizeof(wmode)/sizeof(wmode[0])) {
-				errno = EINVAL;
-				return NULL;
-			}
+		if (conv_fopen_mode(wmode, sizeof(wmode)/sizeof(wmode[0]), mode))
+			return NULL;
+
+		wpath = path_to_scratch(path, path_buf, 0);
+		if (!wpath)
+			return NULL;
+
+		return _wfopen(wpath, wmode);
+	}
+	return fopen(path, mode);
+}
+
+A_Use_decl_annotations
+int localerpl_open_n(const char *name, size_t name_len, int flags, ...)
+{
+	int mode, fd = -1;
+	va_list args;
+
+	va_start(args, flags);
+	mode = va_arg(args, int);
+	va_end(args);
+
+	if (localerpl_is_utf8()) {
+		wchar_t path_buf[PATH_BUF_SIZE];
+		const wchar_t *const wpath = path_n_to_scratch(name, name_len, path_buf, 0);
+		if (wpath)
+			fd = _wopen(wpath, flags, mode);
+	}
+	else {
+		char path_buf[PATH_BUF_SIZE];
+		char *const p = path_n_copy(name, name_len, path_buf, sizeof(path_buf));
+		if (p) {
+			fd = _open(p, flags, mode);
+			if (p != path_buf)
+				free(p);
 		}
+	}
 
-		{
-			FILE *f;
-			wchar_t path_buf[PATH_BUF_SIZE];
-			wchar_t *const wpath = CVT_UTF8_TO_16_Z(path, path_buf);
-			if (!wpath)
-				return NULL;
+	return fd;
+}
+
+A_Use_decl_annotations
+FILE *localerpl_fopen_n(const char *path, size_t path_len, const char *mode)
+{
+	FILE *f = NULL;
+
+	if (localerpl_is_utf8()) {
+		wchar_t wmode[sizeof("+arwbtcnSRTD")];
+		wchar_t path_buf[PATH_BUF_SIZE];
+		const wchar_t *wpath;
+
+		if (conv_fopen_mode(wmode, sizeof(wmode)/sizeof(wmode[0]), mode))
+			return NULL;
+
+		wpath = path_n_to_scratch(path, path_len, path_buf, 0);
+		if (wpath)
 			f = _wfopen(wpath, wmode);
-			if (wpath != path_buf)
-				free(wpath);
-			return f;
+	}
+	else {
+		char path_buf[PATH_BUF_SIZE];
+		char *const p = path_n_copy(path, path_len, path_buf, sizeof(path_buf));
+		if (p) {
+			f = fopen(p, mode);
+			if (p != path_buf)
+				free(p);
 		}
 	}
-	return fopen(path, mode);
+
+	return f;
+}
+
+A_Use_decl_annotations
+int localerpl_mkdir_n(const char *dirname, size_t dirname_len)
+{
+	return file_op_n(dirname, dirname_len, OP_MKDIR);
+}
+
+A_Use_decl_annotations
+int localerpl_rmdir_n(const char *dirname, size_t dirname_len)
+{
+	return file_op_n(dirname, dirname_len, OP_RMDIR);
+}
+
+A_Use_decl_annotations
+int localerpl_remove_n(const char *pathname, size_t pathname_len)
+{
+	return file_op_n(pathname, pathname_len, OP_REMOVE);
+}
+
+A_Use_decl_annotations
+int localerpl_unlink_n(const char *pathname, size_t pathname_len)
+{
+	return file_op_n(pathname, pathname_len, OP_UNLINK);
+}
+
+A_Use_decl_annotations
+int localerpl_chdir_n(const char *path, size_t path_len)
+{
+	return file_op_n(path, path_len, OP_CHDIR);
+}
+
+A_Use_decl_annotations
+int localerpl_stat_n(const char *path, size_t path_len, struct __stat64 *buf)
+{
+	int ret = -1;
+
+	if (localerpl_is_utf8()) {
+		wchar_t path_buf[PATH_BUF_SIZE];
+		const wchar_t *const wpath = path_n_to_scratch(path, path_len, path_buf, 0);
+		if (wpath)
+			ret = _wstat64(wpath, buf);
+	}
+	else {
+		char path_buf[PATH_BUF_SIZE];
+		char *const p = path_n_copy(path, path_len, path_buf, sizeof(path_buf));
+		if (p) {
+			ret = _stat64(p, buf);
+			if (p != path_buf)
+				free(p);
+		}
+	}
+
+	return ret;
+}
+
+A_Use_decl_annotations
+int localerpl_chmod_n(const char *path, size_t path_len, int mode)
+{
+	int ret = -1;
+
+	if (localerpl_is_utf8()) {
+		wchar_t path_buf[PATH_BUF_SIZE];
+		const wchar_t *const wpath = path_n_to_scratch(path, path_len, path_buf, 0);
+		if (wpath)
+			ret = _wchmod(wpath, mode);
+	}
+	else {
+		char path_buf[PATH_BUF_SIZE];
+		char *const p = path_n_copy(path, path_len, path_buf, sizeof(path_buf));
+		if (p) {
+			ret = _chmod(p, mode);
+			if (p != path_buf)
+				free(p);
+		}
+	}
+
+	return ret;
+}
+
+A_Use_decl_annotations
+int localerpl_rename_n(const char *old_name, size_t old_name_len,
+	const char *new_name, size_t new_name_len)
+{
+	int ret = -1;
+
+	if (localerpl_is_utf8()) {
+		wchar_t buf[PATH_BUF_SIZE*2];
+		const wchar_t *const wp_old = path_n_to_scratch(old_name, old_name_len, buf, 0);
+		const wchar_t *const wp_new = wp_old ?
+			path_n_to_scratch(new_name, new_name_len, buf + PATH_BUF_SIZE, 1) : NULL;
+		if (wp_new)
+			ret = _wrename(wp_old, wp_new);
+	}
+	else {
+		char buf[PATH_BUF_SIZE*2];
+		char *const p_old = path_n_copy(old_name, old_name_len, buf, sizeof(buf)/2);
+		char *const p_new = p_old ? path_n_copy(new_name, new_name_len, buf + sizeof(buf)/2, sizeof(buf)/2) : NULL;
+		if (p_new) {
+			ret = rename(p_old, p_new);
+			if (p_new != buf + sizeof(buf)/2)
+				free(p_new);
+		}
+		if (p_old && p_old != buf)
+			free(p_old);
+	}
+
+	return ret;
 }
 
 static int localerpl_read_con(int fd, void *buf, unsigned count/*>0*/)
@@ -783,9 +1134,14 @@ size_t localerpl_c32rtomb(char *s, unsigned wi, mbstate_t *ps)
 A_Use_decl_annotations
 size_t localerpl_mbstowcs(wchar_t *wcstr, const char *mbstr, size_t count)
 {
-	return localerpl_is_utf8()
-		? utf8_mbstoc16s(wcstr, (const utf8_char_t*)mbstr, count)
-		: mbstowcs(wcstr, mbstr, count);
+	if (!localerpl_is_utf8())
+		return mbstowcs(wcstr, mbstr, count);
+	if (!wcstr) {
+		/* size query: only validate and count utf16 code units */
+		size_t n;
+		return (size_t)-1 != cvt_utf8_count_z(mbstr, &n) ? n : (size_t)-1;
+	}
+	return utf8_mbstoc16s(wcstr, (const utf8_char_t*)mbstr, count);
 }
 
 A_Use_decl_annotations
@@ -1217,9 +1573,20 @@ size_t localerpl_mbstoc32s(unsigned *dst, const char *src, size_t n)
 		}
 		return ret;
 	}
+	if (!dst)
+		return cvt_utf8_count_z(src, NULL); /* size query */
 	return utf8_mbstoc32s(dst, (const utf8_char_t*)src, n);
 }
 
+A_Use_decl_annotations
+size_t localerpl_mbslen(const char *s)
+{
+	/* characters of ANSI code pages are never encoded by utf16-surrogates */
+	return localerpl_is_utf8()
+		? cvt_utf8_count_z(s, NULL)
+		: mbstowcs(NULL, s, 0);
+}
+
 static size_t rpl_c32stombs(char *dst, const unsigned *src, const size_t n)
 {
 	size_t sz;
@@ -1339,41 +1706,18 @@ A_Use_decl_annotations
 intptr_t localerpl_spawnvp(int mode, const char *cmdname, const char *const *argv)
 {
 	if (localerpl_is_utf8()) {
-		wchar_t cmd_buf[SPAWN_CMD_BUF_SIZE];
-		wchar_t *argptr_buf[SPAWN_ARGPTR_BUF_SIZE], **wargv = argptr_buf;
+		wchar_t cmd_buf[SPAWN_CMD_BUF_SIZE], **wargv;
 		wchar_t *const wcmd = CVT_UTF8_TO_16_Z(cmdname, cmd_buf);
-		const char *const *a;
 		intptr_t ret = -1;
-		size_t n;
 
 		if (!wcmd)
 			return -1;
 
-		/* Count arguments.  */
-		for (a = argv; *a; a++);
-		n = (size_t)(a - argv);
-
-		if (n >= sizeof(argptr_buf)/sizeof(argptr_buf[0]))
-			wargv = (wchar_t**)malloc((n + 1)*sizeof(*wargv));
-
+		/* Convert all arguments into one block.  */
+		wargv = cvt_utf8_to_16_vec(argv, NULL);
 		if (wargv) {
-			/* Convert each argument.  */
-			for (a = argv; *a; a++) {
-				wchar_t *const wa = cvt_utf8_to_16_z(*a, NULL, 0);
-				if (!wa)
-					break;
-				wargv[a - argv] = wa;
-			}
-			n = (size_t)(a - argv);
-			wargv[n] = NULL;
-
-			if (!*a)
-				ret = _wspawnvp(mode, wcmd, (const wchar_t *const *)wargv);
-
-			while (n)
-				free(wargv[--n]);
-			if (wargv != argptr_buf)
-				free(wargv);
+			ret = _wspawnvp(mode, wcmd, (const wchar_t *const *)wargv);
+			free(wargv);
 		}
 
 		if (wcmd != cmd_buf)
@@ -1386,54 +1730,92 @@ intptr_t localerpl_spawnvp(int mode, const char *cmdname, const char *const *arg
 A_Use_decl_annotations
 intptr_t localerpl_spawnl_utf8(int mode, const char *cmdname, ...)
 {
-	wchar_t cmd_buf[SPAWN_CMD_BUF_SIZE];
-	wchar_t *argptr_buf[SPAWN_ARGPTR_BUF_SIZE], **wargv = argptr_buf, **pwa;
-	wchar_t *const wcmd = CVT_UTF8_TO_16_Z(cmdname, cmd_buf);
+	const char *argptr_buf[SPAWN_ARGPTR_BUF_SIZE], **argv = argptr_buf;
 	size_t n = 0;
-	const char *a;
 	intptr_t ret = -1;
 	va_list args;
 
-	if (!wcmd)
-		return -1;
-
 	/* Count arguments.  */
 	va_start(args, cmdname);
-	for (;; n++) {
-		a = va_arg(args, const char *);
-		if (!a)
-			break;
-	}
+	while (va_arg(args, const char *))
+		n++;
 	va_end(args);
 
-	if (n >= sizeof(argptr_buf)/sizeof(argptr_buf[0]))
-		wargv = (wchar_t**)malloc((n + 1)*sizeof(*wargv));
+	if (n >= sizeof(argptr_buf)/sizeof(argptr_buf[0])) {
+		if (n >= (size_t)-1/sizeof(*argv)) {
+			errno = E2BIG;
+			return -1;
+		}
+		argv = (const char**)malloc((n + 1)*sizeof(*argv));
+		if (!argv)
+			return -1;
+	}
 
-	if (wargv) {
+	/* Collect arguments.  */
+	va_start(args, cmdname);
+	for (n = 0; NULL != (argv[n] = va_arg(args, const char *)); n++);
+	va_end(args);
 
-		/* Convert each argument.  */
-		va_start(args, cmdname);
-		for (n = 0;; n++) {
-			a = va_arg(args, const char *);
-			if (a) {
-				wchar_t *const wa = cvt_utf8_to_16_z(a, NULL, 0);
-				if (!wa)
-					break;
-				wargv[n] = wa;
+	{
+		wchar_t cmd_buf[SPAWN_CMD_BUF_SIZE];
+		wchar_t *const wcmd = CVT_UTF8_TO_16_Z(cmdname, cmd_buf);
+
+		if (wcmd) {
+			/* Convert all arguments into one block.  */
+			wchar_t **const wargv = cvt_utf8_to_16_vec(argv, NULL);
+			if (wargv) {
+				ret = _wspawnvp(mode, wcmd, (const wchar_t *const *)wargv);
+				free(wargv);
 			}
-			else
-				break;
+			if (wcmd != cmd_buf)
+				free(wcmd);
 		}
-		wargv[n] = NULL;
-		va_end(args);
+	}
 
-		if (!a)
-			ret = _wspawnvp(mode, wcmd, (const wchar_t *const *)wargv);
+	if (argv != argptr_buf)
+		free(argv);
+	return ret;
+}
 
-		for (pwa = wargv; *pwa; pwa++)
-			free(*pwa);
-		if (wargv != argptr_buf)
-			free(wargv);
+A_Use_decl_annotations
+intptr_t localerpl_spawnvp_quoted(int mode, const char *cmdname, const char *const *argv)
+{
+	wchar_t cmd_buf[SPAWN_CMD_BUF_SIZE], *wcmd, *wline;
+	intptr_t ret = -1;
+
+	if (localerpl_is_utf8()) {
+		wcmd = CVT_UTF8_TO_16_Z(cmdname, cmd_buf);
+		if (!wcmd)
+			return -1;
+		wline = arg_encode_command_line_utf8(argv);
+	}
+	else {
+		/* Quote wide-character arguments: in multibyte code pages the second byte of
+		  a character may be a backslash.  */
+		wchar_t **wargv;
+		const size_t n = mbstowcs(cmd_buf, cmdname, sizeof(cmd_buf)/sizeof(cmd_buf[0]));
+		if ((size_t)-1 == n)
+			return -1;
+		if (n >= sizeof(cmd_buf)/sizeof(cmd_buf[0])) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		wcmd = cmd_buf;
+		wargv = arg_convert_mb_args((char *const*)argv, NULL);
+		if (!wargv)
+			return -1;
+		wline = arg_encode_command_line((const wchar_t *const*)wargv);
+		arg_free_wargv(wargv);
+	}
+
+	/* _wspawnvp() joins arguments by spaces without quoting them,
+	  so pass the whole quoted command line as one argument.  */
+	if (wline) {
+		const wchar_t *wargv[2];
+		wargv[0] = wline;
+		wargv[1] = NULL;
+		ret = _wspawnvp(mode, wcmd, wargv);
+		free(wline);
 	}
 
 	if (wcmd != cmd_buf)
@@ -1478,7 +1860,7 @@ FILE *localerpl_popen(const char *command, const char *mode)
 		{
 			FILE *f;
 			wchar_t cmd_buf[POPEN_CMD_BUF_SIZE];
-			wchar_t *const wcmd = CVT_UTF8_TO_16_Z(command, cmd_buf);
+			wchar_t *const wcmd = CVT_UTF8_TO_16_Z_F(command, cmd_buf, CVT_ONE_PASS);
 			if (!wcmd)
 				return NULL;
 
@@ -1498,17 +1880,17 @@ char *localerpl_strerror(int error_number)
 		static char strerror_buf[UTF8_STRERROR_BUF_SIZE];
 		wchar_t *err = _wcserror(error_number);
 		if (err != NULL) {
-			const utf16_char_t *w = err;
-			utf8_char_t *b = (utf8_char_t*)strerror_buf;
-			size_t n = utf16_to_utf8_z_partial(&w, &b, UTF8_STRERROR_BUF_SIZE - 1);
-			if (n == 0) {
+			/* truncate too long message at utf8 character boundary */
+			const wchar_t *w = err;
+			const size_t n = cvt_utf16_to_8_part_z(&w, strerror_buf, sizeof(strerror_buf) - 1);
+			if ((size_t)-1 == n) {
 #define ERR_MSG "failed to convert error message to utf8\n"
 				(void)sizeof(int[1-2*(sizeof(strerror_buf) < sizeof(ERR_MSG))]);
 				strcpy(strerror_buf, ERR_MSG);
 #undef ERR_MSG
 			}
-			else if (n >= UTF8_STRERROR_BUF_SIZE)
-				*b = '\0';
+			else
+				strerror_buf[n] = '\0';
 			return strerror_buf;
 		}
 		return NULL;
@@ -1548,14 +1930,19 @@ size_t localerpl_strftime(char *s, size_t mx, const char *fmt, const struct tm *
 			r = wcsftime(wout_buf, mx, wfmt, t);
 		}
 
-		if (r) {
-			const utf16_char_t *w = (const utf16_char_t*)wout_buf;
-			utf8_char_t *b = (utf8_char_t*)s;
-			r = utf16_to_utf8_partial(&w, &b, mx, r);
-			if (r < mx)
-				s[r] = '\0';
-			else
+		if (r && !mx)
+			r = 0; /* Output buffer is too small.  */
+		else if (r) {
+			/* wcsftime() '\0'-terminates the output, convert it in place,
+			  without allocating memory if it does not fit */
+			const wchar_t *w = wout_buf;
+			r = cvt_utf16_to_8_part_z(&w, s, mx - 1);
+			if ((size_t)-1 == r)
+				r = 0;
+			else if (*w)
 				r = 0; /* Output buffer is too small.  */
+			else
+				s[r] = '\0';
 		}
 
 		if (wout_buf != strftime_buf + wfmt_sz)
@@ -1579,46 +1966,36 @@ out:
 
 static int utf8_rpl_mkstemp(char *templ)
 {
-	int fd;
-	wchar_t path_buf[PATH_BUF_SIZE], *wbuf, *wtempl;
+	wchar_t path_buf[PATH_BUF_SIZE], *wtempl;
 	const size_t len = strlen(templ);
-	size_t sz = len + 1;
 	if (len == 0) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	wbuf = CVT_UTF8_TO_16(templ, &sz, path_buf);
-	if (!wbuf)
+	wtempl = path_to_scratch(templ, path_buf, 0);
+	if (!wtempl)
 		return -1;
 
-	wtempl = _wmktemp(wbuf);
-	if (!wtempl) {
-		if (wbuf != path_buf)
-			free(wbuf);
+	wtempl = _wmktemp(wtempl);
+	if (!wtempl)
 		return -1;
-	}
 
 	/* update template */
 	{
-		const utf16_char_t *w = wtempl;
-		utf8_char_t *b = (utf8_char_t*)templ;
-		const size_t x = utf16_to_utf8_z_partial(&w, &b, len + 1);
-		if (x < 2 || x > len + 1) {
-			if (wbuf != path_buf)
-				free(wbuf);
+		size_t x;
+		char *const u8templ = cvt_utf16_to_8_z_sz(wtempl, templ, len + 1, &x);
+		if (u8templ != templ) {
+			if (u8templ)
+				free(u8templ);
 			errno = EINVAL;
 			return -1;
 		}
 	}
 
-	fd = _wopen(wtempl,
+	return _wopen(wtempl,
 			_O_RDWR | _O_CREAT | _O_EXCL,
 			_S_IREAD | _S_IWRITE);
-
-	if (wbuf != path_buf)
-		free(wbuf);
-	return fd;
 }
 
 
@@ -1896,24 +2273,15 @@ static int fwritemb(FILE *stream, const wchar_t *s)
 
 	if (localerpl_is_utf8()) {
 		do {
-			utf8_char_t *b = (utf8_char_t*)mb_buf;
-			const size_t sz = utf16_to_utf8_z_partial(&s, &b, sizeof(mb_buf));
-			if (!sz) {
-				errno = EILSEQ;
+			const size_t len = cvt_utf16_to_8_part_z(&s, mb_buf, sizeof(mb_buf));
+			if ((size_t)-1 == len)
 				return -1;
-			}
-
-			{
-				const size_t to_write = (sz <= sizeof(mb_buf))
-					? sz - 1/*do not write terminating '\0'*/
-					: (size_t)((char*)b - mb_buf);
 
-				assert(to_write);
+			assert(len);
 
-				if (to_write != _fwrite_nolock(mb_buf, 1, to_write, stream))
-					return -1;
-			}
-		} while (s[-1]);
+			if (len != _fwrite_nolock(mb_buf, 1, len, stream))
+				return -1;
+		} while (*s);
 	}
 	else {
 		mbstate_t ps = {
@@ -0,0 +1,532 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* localerpl_fnmatch.c */
+
+/* localerpl_fnmatch() and compiled patterns, separated from localerpl.c, so they may be
+  tested on any platform.  */
+
+#include <errno.h>
+
+#define LOCALE_RPL_IMPL
+#include "mscrtx/localerpl.h"
+#include "libutf16/utf8_cstd.h"
+#include "libutf16/utf8_to_utf16_one.h"
+
+#ifndef SAL_DEFS_H_INCLUDED /* include "sal_defs.h" for the annotations */
+#define A_Use_decl_annotations
+#endif
+
+/* Literal parts of compiled fnmatch patterns are searched for 16/32 bytes at once,
+  define LOCALERPL_NO_SIMD to use only the scalar code.  */
+#ifndef LOCALERPL_NO_SIMD
+# if defined __AVX2__
+#  include <immintrin.h>
+#  define LOCALERPL_AVX2
+#  define LOCALERPL_SSE2
+# elif defined __SSE2__ || defined _M_X64 || defined _M_AMD64 || \
+	(defined _M_IX86_FP && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define LOCALERPL_SSE2
+# endif
+#endif
+
+/* Bytes that do not form a valid character are matched as 0xDC80..0xDCFF,
+  which are never produced by decoding.  */
+#define FNM_INVALID_BYTE 0xDC00u
+
+/* Decode one character of the pattern or the string, *s must not be '\0'.
+   Returns pointer to the next character.  */
+static const char *fnm_next(const char *const s, unsigned *const c/*out*/)
+{
+	const unsigned b = (unsigned char)*s;
+	if (b < 0x80) {
+		*c = b; /* ASCII is the same in UTF-8 and in all ANSI code pages */
+		return s + 1;
+	}
+	if (localerpl_is_utf8()) {
+		utf32_char_t w;
+		const char *const n = (const char*)utf8_to_utf32_one_z(&w, (const utf8_char_t*)s);
+		if (n) {
+			*c = w;
+			return n;
+		}
+	}
+	else {
+		mbstate_t ps = {
+#ifndef __cplusplus
+			0
+#endif
+		};
+		wchar_t w;
+		const size_t n = mbrtowc(&w, s, MB_LEN_MAX, &ps);
+		if (n && n <= MB_LEN_MAX) {
+			*c = (unsigned)w;
+			return s + n;
+		}
+	}
+	*c = FNM_INVALID_BYTE + b;
+	return s + 1;
+}
+
+static unsigned fnm_fold(const unsigned c)
+{
+	if (c < 0x80)
+		return ('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+	return localerpl_c32tolower(c);
+}
+
+/* Check if the string position s requires '.' to be matched explicitly.  */
+static int fnm_period_pos(const char *const s, const char *const string, const int flags)
+{
+	return '.' == *s && (flags & LOCALERPL_FNM_PERIOD) &&
+		(s == string || ((flags & LOCALERPL_FNM_PATHNAME) && '/' == s[-1]));
+}
+
+/* Find the end of the character class name in a bracket expression, p points
+  after "[:".  Returns pointer to ":]", or NULL.  */
+static const char *fnm_class_end(const char *p)
+{
+	for (; *p && ']' != *p; p++) {
+		if (':' == p[0] && ']' == p[1])
+			return p;
+	}
+	return NULL;
+}
+
+/* Skip one character of the bracket expression, possibly escaped.
+   Returns NULL if it is the end of the pattern or, with LOCALERPL_FNM_PATHNAME, '/'.  */
+static const char *fnm_bracket_char(const char *p, const int flags)
+{
+	unsigned c;
+	if ('\\' == *p && !(flags & LOCALERPL_FNM_NOESCAPE) && p[1])
+		p++;
+	if (!*p || ('/' == *p && (flags & LOCALERPL_FNM_PATHNAME)))
+		return NULL;
+	return fnm_next(p, &c);
+}
+
+/* Find the end of the bracket expression, p points after '['.
+   Returns pointer to the closing ']', or NULL if the bracket expression is not
+  terminated - then '[' is an ordinary character.
+   With LOCALERPL_FNM_PATHNAME, '[' is also an ordinary character if there is '/'
+  before the closing ']', as in POSIX pathname expansion.  */
+static const char *fnm_bracket_end(const char *p, const int flags)
+{
+	if ('!' == *p || '^' == *p)
+		p++;
+	/* ']' at the start of the set is an ordinary character */
+	do {
+		if ('[' == p[0] && ':' == p[1]) {
+			const char *const e = fnm_class_end(p + 2);
+			if (e) {
+				p = e + 2;
+				continue;
+			}
+		}
+		p = fnm_bracket_char(p, flags);
+		if (!p)
+			return NULL;
+		/* the end of a range is a character, even if it is '[' */
+		if ('-' == *p && p[1] && ']' != p[1]) {
+			p = fnm_bracket_char(p + 1, flags);
+			if (!p)
+				return NULL;
+		}
+	} while (']' != *p);
+	return p;
+}
+
+static int fnm_in_range(const unsigned c, const unsigned lo, const unsigned hi, const int flags)
+{
+	unsigned l, u;
+	if (lo <= c && c <= hi)
+		return 1;
+	if (!(flags & LOCALERPL_FNM_CASEFOLD))
+		return 0;
+	l = localerpl_c32tolower(c);
+	u = localerpl_c32toupper(c);
+	return (lo <= l && l <= hi) || (lo <= u && u <= hi);
+}
+
+static int fnm_in_class(const unsigned c, const c32ctype_t desc, const int flags)
+{
+	if (localerpl_c32isctype(c, desc))
+		return 1;
+	if (!(flags & LOCALERPL_FNM_CASEFOLD))
+		return 0;
+	return localerpl_c32isctype(localerpl_c32tolower(c), desc) ||
+		localerpl_c32isctype(localerpl_c32toupper(c), desc);
+}
+
+/* Check if the character c is in the set of the bracket expression: p points after
+  the opening '[', end - to the closing ']'.  */
+static int fnm_match_bracket(const char *p, const char *const end, const unsigned c, const int flags)
+{
+	int negate = 0;
+	int found = 0;
+	if ('!' == *p || '^' == *p) {
+		negate = 1;
+		p++;
+	}
+	do {
+		unsigned lo, hi;
+		if ('[' == p[0] && ':' == p[1]) {
+			const char *const e = fnm_class_end(p + 2);
+			if (e) {
+				char name[16];
+				const size_t len = (size_t)(e - (p + 2));
+				if (!found && len < sizeof(name)) {
+					c32ctype_t desc;
+					memcpy(name, p + 2, len);
+					name[len] = '\0';
+					desc = localerpl_c32ctype(name);
+					found = desc && fnm_in_class(c, desc, flags);
+				}
+				p = e + 2;
+				continue;
+			}
+		}
+		if ('\\' == *p && !(flags & LOCALERPL_FNM_NOESCAPE) && p + 1 != end)
+			p++;
+		p = fnm_next(p, &lo);
+		hi = lo;
+		if ('-' == *p && p + 1 != end) {
+			p++;
+			if ('\\' == *p && !(flags & LOCALERPL_FNM_NOESCAPE) && p + 1 != end)
+				p++;
+			p = fnm_next(p, &hi);
+		}
+		if (!found)
+			found = fnm_in_range(c, lo, hi, flags);
+	} while (p < end);
+	return found != negate;
+}
+
+/* Match the rest of the string s against the rest of the pattern p, string - the
+  beginning of the whole string.
+   Only the last '*' needs to be backtracked: the parts of the pattern after it match
+  a fixed number of characters.  */
+static int fnm_match(const char *p, const char *s, const char *const string, const int flags)
+{
+	const char *star_p = NULL; /* pattern after the last '*' */
+	const char *star_s = NULL; /* where that '*' ends in the string */
+
+	for (;;) {
+		unsigned sc;
+		const char *sn;
+
+		if ('*' == *p) {
+			if (fnm_period_pos(s, string, flags))
+				goto backtrack; /* leading period must be matched by a period in the pattern */
+			while ('*' == *++p);
+			if (!*p && !(flags & LOCALERPL_FNM_PATHNAME))
+				return 0; /* trailing '*' matches the rest of the string */
+			star_p = p;
+			star_s = s;
+			continue;
+		}
+
+		if (!*p) {
+			if (!*s)
+				return 0;
+			goto backtrack;
+		}
+
+		if (!*s)
+			return LOCALERPL_FNM_NOMATCH; /* a later '*' end would leave even less */
+
+		sn = fnm_next(s, &sc);
+
+		if ('?' == *p) {
+			if (('/' == sc && (flags & LOCALERPL_FNM_PATHNAME)) || fnm_period_pos(s, string, flags))
+				goto backtrack;
+			p++;
+		}
+		else {
+			const char *const b = '[' == *p ? fnm_bracket_end(p + 1, flags) : NULL;
+			if (b) {
+				if (('/' == sc && (flags & LOCALERPL_FNM_PATHNAME)) || fnm_period_pos(s, string, flags) ||
+					!fnm_match_bracket(p + 1, b, sc, flags))
+				{
+					goto backtrack;
+				}
+				p = b + 1;
+			}
+			else {
+				unsigned pc;
+				if ('\\' == *p && !(flags & LOCALERPL_FNM_NOESCAPE)) {
+					if (!*++p)
+						return LOCALERPL_FNM_NOMATCH; /* unfinished escape sequence */
+				}
+				p = fnm_next(p, &pc);
+				if (pc != sc && (!(flags & LOCALERPL_FNM_CASEFOLD) || fnm_fold(pc) != fnm_fold(sc)))
+					goto backtrack;
+			}
+		}
+		s = sn;
+		continue;
+
+backtrack:
+		if (!star_p || !*star_s ||
+			('/' == *star_s && (flags & LOCALERPL_FNM_PATHNAME)) ||
+			fnm_period_pos(star_s, string, flags))
+		{
+			return LOCALERPL_FNM_NOMATCH;
+		}
+		star_s = fnm_next(star_s, &sc);
+		p = star_p;
+		s = star_s;
+	}
+}
+
+A_Use_decl_annotations
+int localerpl_fnmatch(const char *pattern, const char *string, int flags)
+{
+	return fnm_match(pattern, string, string, flags);
+}
+
+struct localerpl_fnpat {
+	const char *pattern; /* pattern after the literal prefix */
+	const char *prefix;  /* literal prefix, lowered if LOCALERPL_FNM_CASEFOLD */
+	const char *lit;     /* longest literal part after the prefix, lowered if LOCALERPL_FNM_CASEFOLD */
+	size_t prefix_len;   /* in bytes */
+	size_t lit_len;      /* in bytes, 0 if there is no literal part */
+	int flags;
+};
+
+static char fnm_lower_byte(const char b)
+{
+	return ('A' <= b && b <= 'Z') ? (char)(b + ('a' - 'A')) : b;
+}
+
+/* Compare n bytes of the string with the lowered literal, lowering ASCII letters
+  of the string.  */
+static int fnm_equal_fold(const char *const s, const char *const lit, const size_t n)
+{
+	size_t i = 0;
+	for (; i < n; i++) {
+		if (fnm_lower_byte(s[i]) != lit[i])
+			return 0;
+	}
+	return 1;
+}
+
+#ifdef LOCALERPL_SSE2
+static __m128i fnm_lower16(const __m128i v)
+{
+	/* 'A'..'Z' -> 'a'..'z' */
+	const __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('A'));
+	const __m128i upper = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('Z' - 'A')), t);
+	return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+#endif
+
+#ifdef LOCALERPL_AVX2
+static __m256i fnm_lower32(const __m256i v)
+{
+	const __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('A'));
+	const __m256i upper = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8('Z' - 'A')), t);
+	return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+}
+#endif
+
+/* Check if the string s of n bytes contains the literal of len > 0 bytes.
+   If fold != 0, the literal is lowered and ASCII letters of the string are lowered.
+   Positions where both the first and the last bytes of the literal match are found
+  16/32 at once, then the bytes between them are compared.  */
+static int fnm_find_literal(const char *const s, const size_t n,
+	const char *const lit, const size_t len, const int fold)
+{
+	size_t i = 0;
+	if (len > n)
+		return 0;
+#ifdef LOCALERPL_SSE2
+	{
+		const size_t last = len - 1;
+#ifdef LOCALERPL_AVX2
+		const __m256i first32 = _mm256_set1_epi8(lit[0]);
+		const __m256i last32 = _mm256_set1_epi8(lit[last]);
+		for (; n - last - i >= 32; i += 32) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(s + i + last));
+			unsigned m;
+			if (fold) {
+				a = fnm_lower32(a);
+				b = fnm_lower32(b);
+			}
+			m = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+				_mm256_cmpeq_epi8(a, first32), _mm256_cmpeq_epi8(b, last32)));
+			for (; m; m &= m - 1) {
+				unsigned k = 0;
+				while (!(m & (1u << k)))
+					k++;
+				if (fold ? fnm_equal_fold(s + i + k + 1, lit + 1, len - 1)
+					: !memcmp(s + i + k + 1, lit + 1, len - 1))
+				{
+					return 1;
+				}
+			}
+		}
+#endif
+		{
+			const __m128i first16 = _mm_set1_epi8(lit[0]);
+			const __m128i last16 = _mm_set1_epi8(lit[last]);
+			for (; n - last - i >= 16; i += 16) {
+				__m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+				__m128i b = _mm_loadu_si128((const __m128i*)(s + i + last));
+				unsigned m;
+				if (fold) {
+					a = fnm_lower16(a);
+					b = fnm_lower16(b);
+				}
+				m = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+					_mm_cmpeq_epi8(a, first16), _mm_cmpeq_epi8(b, last16)));
+				for (; m; m &= m - 1) {
+					unsigned k = 0;
+					while (!(m & (1u << k)))
+						k++;
+					if (fold ? fnm_equal_fold(s + i + k + 1, lit + 1, len - 1)
+						: !memcmp(s + i + k + 1, lit + 1, len - 1))
+					{
+						return 1;
+					}
+				}
+			}
+		}
+	}
+#endif
+	for (; i <= n - len; i++) {
+		if (fold ? fnm_equal_fold(s + i, lit, len) : !memcmp(s + i, lit, len))
+			return 1;
+	}
+	return 0;
+}
+
+/* Check if the literal character c of the pattern may be compared byte by byte:
+  no other character matches it.
+   In ANSI code pages, different multibyte characters may map to the same Unicode one.
+   Case-insensitively, only ASCII letters are lowered, except 'i' and 'k': U+0130 and
+  U+212A are lowered to them.  */
+static int fnm_literal_char(const unsigned c, const int flags)
+{
+	if (flags & LOCALERPL_FNM_CASEFOLD) {
+		const unsigned l = fnm_fold(c);
+		return c < 0x80 && 'i' != l && 'k' != l;
+	}
+	return c < 0x80 || localerpl_is_utf8();
+}
+
+/* Get the literal character of the pattern at p, which must not be '\0'.
+   Returns pointer to the next character of the pattern, sets *begin to the first byte
+  of the character (after the escaping '\\') and *c to the character, or returns NULL
+  if there is a wildcard at p.  */
+static const char *fnm_literal(const char *p, const int flags,
+	const char **const begin/*out*/, unsigned *const c/*out*/)
+{
+	if ('*' == *p || '?' == *p || ('[' == *p && fnm_bracket_end(p + 1, flags)))
+		return NULL;
+	if ('\\' == *p && !(flags & LOCALERPL_FNM_NOESCAPE)) {
+		if (!*++p)
+			return NULL; /* unfinished escape sequence never matches */
+	}
+	*begin = p;
+	return fnm_next(p, c);
+}
+
+A_Use_decl_annotations
+struct localerpl_fnpat *localerpl_fnmatch_compile(const char *pattern, int flags)
+{
+	const size_t pattern_len = strlen(pattern);
+	struct localerpl_fnpat *pat;
+	char *buf;
+	const char *p = pattern;
+	const char *lit = NULL;
+	size_t lit_len = 0;
+
+	/* The prefix and the literal are not longer than the pattern.  */
+	if (pattern_len >= ((size_t)-1 - sizeof(*pat))/2) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	pat = (struct localerpl_fnpat*)malloc(sizeof(*pat) + 2*pattern_len + 1);
+	if (!pat)
+		return NULL;
+	buf = (char*)(pat + 1);
+	pat->flags = flags;
+
+	/* Literal prefix: characters matched byte by byte before the first wildcard.  */
+	pat->prefix = buf;
+	for (;;) {
+		const char *b;
+		unsigned c;
+		const char *const n = *p ? fnm_literal(p, flags, &b, &c) : NULL;
+		if (!n || !fnm_literal_char(c, flags))
+			break;
+		for (; b != n; b++)
+			*buf++ = (flags & LOCALERPL_FNM_CASEFOLD) ? fnm_lower_byte(*b) : *b;
+		p = n;
+	}
+	pat->prefix_len = (size_t)(buf - pat->prefix);
+	pat->pattern = p;
+
+	/* The longest literal part of the rest of the pattern.  */
+	while (*p) {
+		char *const run = buf;
+		for (;;) {
+			const char *b;
+			unsigned c;
+			const char *const n = *p ? fnm_literal(p, flags, &b, &c) : NULL;
+			if (!n) {
+				if (*p)
+					p = ('[' == *p) ? fnm_bracket_end(p + 1, flags) + 1 : p + 1; /* skip the wildcard */
+				break;
+			}
+			p = n;
+			if (!fnm_literal_char(c, flags))
+				break;
+			for (; b != n; b++)
+				*buf++ = (flags & LOCALERPL_FNM_CASEFOLD) ? fnm_lower_byte(*b) : *b;
+		}
+		if ((size_t)(buf - run) > lit_len) {
+			lit = run;
+			lit_len = (size_t)(buf - run);
+		}
+		else
+			buf = run; /* reuse the space */
+	}
+	pat->lit = lit;
+	pat->lit_len = lit_len;
+
+	/* Keep the pattern after the prefix.  */
+	memcpy(buf, pat->pattern, pattern_len + 1 - (size_t)(pat->pattern - pattern));
+	pat->pattern = buf;
+	return pat;
+}
+
+A_Use_decl_annotations
+int localerpl_fnmatch_exec(const struct localerpl_fnpat *pat, const char *string)
+{
+	const int fold = pat->flags & LOCALERPL_FNM_CASEFOLD;
+	const char *s = string;
+	if (pat->prefix_len) {
+		if (fold ? !fnm_equal_fold(s, pat->prefix, pat->prefix_len)
+			: strncmp(s, pat->prefix, pat->prefix_len))
+		{
+			return LOCALERPL_FNM_NOMATCH;
+		}
+		s += pat->prefix_len;
+	}
+	if (pat->lit_len && !fnm_find_literal(s, strlen(s), pat->lit, pat->lit_len, fold))
+		return LOCALERPL_FNM_NOMATCH;
+	return fnm_match(pat->pattern, s, string, pat->flags);
+}
+
+A_Use_decl_annotations
+void localerpl_fnmatch_free(struct localerpl_fnpat *pat/*NULL?*/)
+{
+	free(pat);
+}
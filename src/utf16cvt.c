@@ -18,15 +18,1053 @@
 #define A_Use_decl_annotations
 #endif
 
+/* Runs of ASCII characters are widened by 16/32 bytes at once,
+  define UTF16CVT_NO_SIMD to use only the scalar code.  */
+#ifndef UTF16CVT_NO_SIMD
+# if defined __AVX2__
+#  include <immintrin.h>
+#  define UTF16CVT_AVX2
+#  define UTF16CVT_SSE2
+# elif defined __SSE2__ || defined _M_X64 || defined _M_AMD64 || \
+	(defined _M_IX86_FP && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define UTF16CVT_SSE2
+# endif
+#endif
+
+#ifdef UTF16CVT_AVX2
+# define SIMD_ALIGN 32u
+#else
+# define SIMD_ALIGN 16u
+#endif
+
+/* Aligned loads may read past the terminating '\0' (never crossing the page boundary),
+  do not let the address sanitizer report that.  */
+#ifndef UTF16CVT_NO_SANITIZE
+# if defined UTF16CVT_SSE2 && defined __SANITIZE_ADDRESS__
+#  ifdef _MSC_VER
+#   define UTF16CVT_NO_SANITIZE __declspec(no_sanitize_address)
+#  else
+#   define UTF16CVT_NO_SANITIZE __attribute__((no_sanitize_address))
+#  endif
+# elif defined UTF16CVT_SSE2 && defined __clang__ && defined __has_feature
+#  if __has_feature(address_sanitizer)
+#   define UTF16CVT_NO_SANITIZE __attribute__((no_sanitize_address))
+#  endif
+# endif
+# ifndef UTF16CVT_NO_SANITIZE
+#  define UTF16CVT_NO_SANITIZE
+# endif
+#endif
+
+/* Widen leading ASCII characters of '\0'-terminated utf8 string.
+   Stops at the first non-ASCII character or '\0', or after storing sz utf16 characters.
+   Returns number of stored utf16 characters.  */
+UTF16CVT_NO_SANITIZE
+static size_t ascii_to_utf16_z(const utf8_char_t s[], utf16_char_t d[], const size_t sz)
+{
+	size_t i = 0;
+
+	/* utf16 character must be 16-bit */
+	(void)sizeof(int[1-2*(sizeof(utf16_char_t) != 2)]);
+
+#ifdef UTF16CVT_SSE2
+	{
+		/* Aligned loads never cross the page boundary,
+		  so it is safe to read past the terminating '\0'.  */
+		const size_t head = (SIMD_ALIGN - ((size_t)s & (SIMD_ALIGN - 1))) & (SIMD_ALIGN - 1);
+		const __m128i zero = _mm_setzero_si128();
+
+		for (; i < head; i++) {
+			const utf8_char_t c = s[i];
+			if (i == sz || !c || c >= 0x80)
+				return i;
+			d[i] = c;
+		}
+
+#ifdef UTF16CVT_AVX2
+		for (; sz - i >= 32; i += 32) {
+			const __m256i v = _mm256_load_si256((const __m256i*)&s[i]);
+			if (_mm256_movemask_epi8(v) |
+				_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())))
+			{
+				break;
+			}
+			_mm256_storeu_si256((__m256i*)&d[i],
+				_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+			_mm256_storeu_si256((__m256i*)&d[i + 16],
+				_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+		}
+#endif
+
+		for (; sz - i >= 16; i += 16) {
+			const __m128i v = _mm_load_si128((const __m128i*)&s[i]);
+			if (_mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)))
+				break;
+			_mm_storeu_si128((__m128i*)&d[i], _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128((__m128i*)&d[i + 8], _mm_unpackhi_epi8(v, zero));
+		}
+	}
+#endif
+
+	for (; i < sz; i++) {
+		const utf8_char_t c = s[i];
+		if (!c || c >= 0x80)
+			break;
+		d[i] = c;
+	}
+
+	return i;
+}
+
+/* Count leading ASCII characters of '\0'-terminated utf8 string.  */
+UTF16CVT_NO_SANITIZE
+static size_t ascii_len_z(const utf8_char_t s[])
+{
+	size_t i = 0;
+
+#ifdef UTF16CVT_SSE2
+	{
+		const size_t head = (SIMD_ALIGN - ((size_t)s & (SIMD_ALIGN - 1))) & (SIMD_ALIGN - 1);
+		const __m128i zero = _mm_setzero_si128();
+
+		for (; i < head; i++) {
+			const utf8_char_t c = s[i];
+			if (!c || c >= 0x80)
+				return i;
+		}
+
+#ifdef UTF16CVT_AVX2
+		for (;; i += 32) {
+			const __m256i v = _mm256_load_si256((const __m256i*)&s[i]);
+			if (_mm256_movemask_epi8(v) |
+				_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())))
+			{
+				break;
+			}
+		}
+#endif
+
+		for (;; i += 16) {
+			const __m128i v = _mm_load_si128((const __m128i*)&s[i]);
+			if (_mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)))
+				break;
+		}
+	}
+#endif
+
+	for (;; i++) {
+		const utf8_char_t c = s[i];
+		if (!c || c >= 0x80)
+			return i;
+	}
+}
+
+/* Widen leading ASCII characters of utf8 string of n bytes.
+   Stops at the first non-ASCII character.
+   Returns number of stored utf16 characters.  */
+static size_t ascii_to_utf16(const utf8_char_t s[], utf16_char_t d[], const size_t n)
+{
+	size_t i = 0;
+
+#ifdef UTF16CVT_SSE2
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+#ifdef UTF16CVT_AVX2
+		for (; n - i >= 32; i += 32) {
+			const __m256i v = _mm256_loadu_si256((const __m256i*)&s[i]);
+			if (_mm256_movemask_epi8(v))
+				break;
+			_mm256_storeu_si256((__m256i*)&d[i],
+				_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+			_mm256_storeu_si256((__m256i*)&d[i + 16],
+				_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+		}
+#endif
+
+		for (; n - i >= 16; i += 16) {
+			const __m128i v = _mm_loadu_si128((const __m128i*)&s[i]);
+			if (_mm_movemask_epi8(v))
+				break;
+			_mm_storeu_si128((__m128i*)&d[i], _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128((__m128i*)&d[i + 8], _mm_unpackhi_epi8(v, zero));
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		const utf8_char_t c = s[i];
+		if (c >= 0x80)
+			break;
+		d[i] = c;
+	}
+
+	return i;
+}
+
+/* Count leading ASCII characters of utf8 string of n bytes.  */
+static size_t ascii_len(const utf8_char_t s[], const size_t n)
+{
+	size_t i = 0;
+
+#ifdef UTF16CVT_SSE2
+	for (; n - i >= 16; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)&s[i]);
+		if (_mm_movemask_epi8(v))
+			break;
+	}
+#endif
+
+	for (; i < n; i++) {
+		if (s[i] >= 0x80)
+			break;
+	}
+
+	return i;
+}
+
+/* Same as utf8_to_utf16_z(), but leading ASCII characters are converted by the fast path.  */
+static size_t utf8_to_16_z(const utf8_char_t **const q, utf16_char_t **const b, const size_t sz)
+{
+	const utf8_char_t *s = *q;
+	const size_t a = sz ? ascii_to_utf16_z(s, *b, sz) : 0;
+	size_t n;
+
+	if (a) {
+		s += a;
+		*q = s;
+		*b += a;
+	}
+
+	if (a < sz) {
+		if (!*s) {
+			*(*b)++ = L'\0';
+			*q = s + 1;
+			return a + 1;
+		}
+		n = utf8_to_utf16_z(q, b, sz - a);
+	}
+	else {
+		/* The buffer is full, only count the rest.  */
+		utf16_char_t *e = *b;
+		const size_t c = ascii_len_z(s);
+
+		s += c;
+		if (!*s)
+			return a + c + 1;
+
+		n = utf8_to_utf16_z(&s, &e, 0);
+		if (n)
+			n += c;
+	}
+
+	return n ? a + n : 0;
+}
+
+/* Same as utf8_to_utf16_z_unsafe(), but leading ASCII characters are converted by the fast path.  */
+static const utf8_char_t *utf8_to_16_z_unsafe(const utf8_char_t *const q, utf16_char_t *const b)
+{
+	const size_t a = ascii_to_utf16_z(q, b, (size_t)-1);
+	if (!q[a]) {
+		b[a] = L'\0';
+		return q + a + 1;
+	}
+	return utf8_to_utf16_z_unsafe(q + a, b + a);
+}
+
+/* Same as utf8_to_utf16(), but leading ASCII characters are converted by the fast path.  */
+static size_t utf8_to_16(const utf8_char_t **const q, utf16_char_t **const b,
+	const size_t sz, const size_t n/*>0*/)
+{
+	const utf8_char_t *s = *q;
+	const size_t a = ascii_to_utf16(s, *b, n < sz ? n : sz);
+	size_t r;
+
+	if (a) {
+		s += a;
+		*q = s;
+		*b += a;
+		if (a == n)
+			return n;
+	}
+
+	if (a < sz)
+		r = utf8_to_utf16(q, b, sz - a, n - a);
+	else {
+		/* The buffer is full, only count the rest.  */
+		utf16_char_t *e = *b;
+		const size_t c = ascii_len(s, n - a);
+
+		if (c == n - a)
+			return n;
+
+		s += c;
+		r = utf8_to_utf16(&s, &e, 0, n - a - c);
+		if (r)
+			r += c;
+	}
+
+	return r ? a + r : 0;
+}
+
+/* Same as utf8_to_utf16_unsafe(), but leading ASCII characters are converted by the fast path.  */
+static void utf8_to_16_unsafe(const utf8_char_t *const q, utf16_char_t *const b, const size_t n/*>0*/)
+{
+	const size_t a = ascii_to_utf16(q, b, n);
+	if (a != n)
+		(void)utf8_to_utf16_unsafe(q + a, b + a, n - a);
+}
+
+/* Allocate worst-case sized buffer - one utf16 character per utf8 byte,
+  convert in one pass, then, optionally, shrink the buffer.  */
+static wchar_t *utf8_to_16_z_one_pass(const char str[], const size_t len,
+	size_t *const sz/*in,out*/, size_t *const u8sz/*out*/, const unsigned flags)
+{
+	const utf8_char_t *q = (const utf8_char_t*)str;
+	const size_t reserve = *sz; /* <= (size_t)-1/sizeof(wchar_t) */
+	utf16_char_t *b;
+	size_t n;
+	wchar_t *r;
+
+	if (len >= (size_t)-1/sizeof(wchar_t) - reserve) {
+		errno = E2BIG;
+		return NULL;
+	}
+
+	r = (wchar_t*)malloc((reserve + len + 1)*sizeof(wchar_t));
+	if (!r)
+		return NULL;
+
+	b = r + reserve;
+	n = utf8_to_16_z(&q, &b, len + 1);
+
+	if (!n) {
+		free(r);
+		errno = EILSEQ;
+		return NULL;
+	}
+
+	if ((flags & CVT_SHRINK) && n <= len) {
+		wchar_t *const s = (wchar_t*)realloc(r, (reserve + n)*sizeof(wchar_t));
+		if (s)
+			r = s;
+	}
+
+	*u8sz = len + 1;
+	*sz = n;
+	return r;
+}
+
+/* Narrow leading ASCII characters of L'\0'-terminated utf16 string.
+   Stops at the first non-ASCII character or L'\0', or after storing sz utf8 bytes.
+   Returns number of stored utf8 bytes.  */
+UTF16CVT_NO_SANITIZE
+static size_t ascii16_to_utf8_z(const utf16_char_t s[], utf8_char_t d[], const size_t sz)
+{
+	size_t i = 0;
+
+#ifdef UTF16CVT_SSE2
+	if (!((size_t)s & 1)) {
+		/* Aligned loads never cross the page boundary,
+		  so it is safe to read past the terminating L'\0'.  */
+		const size_t head = ((SIMD_ALIGN - ((size_t)s & (SIMD_ALIGN - 1))) & (SIMD_ALIGN - 1))/2;
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i non_ascii = _mm_set1_epi16((short)0xFF80);
+
+		for (; i < head; i++) {
+			const utf16_char_t c = s[i];
+			if (i == sz || !c || c >= 0x80)
+				return i;
+			d[i] = (utf8_char_t)c;
+		}
+
+#ifdef UTF16CVT_AVX2
+		for (; sz - i >= 16; i += 16) {
+			const __m256i v = _mm256_load_si256((const __m256i*)&s[i]);
+			if (~_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+					_mm256_and_si256(v, _mm256_set1_epi16((short)0xFF80)), _mm256_setzero_si256())) |
+				_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_setzero_si256())))
+			{
+				break;
+			}
+			_mm_storeu_si128((__m128i*)&d[i], _mm_packus_epi16(
+				_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+		}
+#endif
+
+		for (; sz - i >= 8; i += 8) {
+			const __m128i v = _mm_load_si128((const __m128i*)&s[i]);
+			if ((0xFFFF ^ _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, non_ascii), zero))) |
+				_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)))
+			{
+				break;
+			}
+			_mm_storel_epi64((__m128i*)&d[i], _mm_packus_epi16(v, v));
+		}
+	}
+#endif
+
+	for (; i < sz; i++) {
+		const utf16_char_t c = s[i];
+		if (!c || c >= 0x80)
+			break;
+		d[i] = (utf8_char_t)c;
+	}
+
+	return i;
+}
+
+/* Narrow leading ASCII characters of utf16 string of n characters.
+   Stops at the first non-ASCII character.
+   Returns number of stored utf8 bytes.  */
+static size_t ascii16_to_utf8(const utf16_char_t s[], utf8_char_t d[], const size_t n)
+{
+	size_t i = 0;
+
+#ifdef UTF16CVT_SSE2
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i non_ascii = _mm_set1_epi16((short)0xFF80);
+
+		for (; n - i >= 16; i += 16) {
+			const __m128i v0 = _mm_loadu_si128((const __m128i*)&s[i]);
+			const __m128i v1 = _mm_loadu_si128((const __m128i*)&s[i + 8]);
+			if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi16(
+					_mm_and_si128(_mm_or_si128(v0, v1), non_ascii), zero)))
+			{
+				break;
+			}
+			_mm_storeu_si128((__m128i*)&d[i], _mm_packus_epi16(v0, v1));
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		const utf16_char_t c = s[i];
+		if (c >= 0x80)
+			break;
+		d[i] = (utf8_char_t)c;
+	}
+
+	return i;
+}
+
+/* Store utf8 encoding of non-ASCII utf16 character c (second is the next utf16 character,
+  used only if c is a high surrogate).
+   Returns number of utf8 bytes (2, 3 or 4), or 0 if c is an unpaired surrogate.  */
+static unsigned utf16_to_8_one(utf8_char_t d[4], const unsigned c, const unsigned second)
+{
+	if (c < 0x800) {
+		d[0] = (utf8_char_t)(0xC0 | (c >> 6));
+		d[1] = (utf8_char_t)(0x80 | (c & 0x3F));
+		return 2;
+	}
+	if ((c & 0xF800) != 0xD800) {
+		d[0] = (utf8_char_t)(0xE0 | (c >> 12));
+		d[1] = (utf8_char_t)(0x80 | ((c >> 6) & 0x3F));
+		d[2] = (utf8_char_t)(0x80 | (c & 0x3F));
+		return 3;
+	}
+	if (c < 0xDC00 && (second & 0xFC00) == 0xDC00) {
+		const unsigned u = 0x10000 + ((c - 0xD800) << 10) + (second - 0xDC00);
+		d[0] = (utf8_char_t)(0xF0 | (u >> 18));
+		d[1] = (utf8_char_t)(0x80 | ((u >> 12) & 0x3F));
+		d[2] = (utf8_char_t)(0x80 | ((u >> 6) & 0x3F));
+		d[3] = (utf8_char_t)(0x80 | (u & 0x3F));
+		return 4;
+	}
+	return 0; /* unpaired surrogate */
+}
+
+#ifdef UTF16CVT_SSE2
+#ifdef UTF16CVT_AVX2
+/* For 4 utf16 characters < 0x800, converted to 16-bit words (first byte of
+  utf8 character in the low byte), indexed by the mask of ASCII characters:
+  shuffle indices to pack utf8 bytes, and the number of packed bytes.  */
+static const unsigned char utf16_pack_shuf[16][8] = {
+	{0, 1, 2, 3, 4, 5, 6, 7},             {0, 2, 3, 4, 5, 6, 7, 0x80},
+	{0, 1, 2, 4, 5, 6, 7, 0x80},          {0, 2, 4, 5, 6, 7, 0x80, 0x80},
+	{0, 1, 2, 3, 4, 6, 7, 0x80},          {0, 2, 3, 4, 6, 7, 0x80, 0x80},
+	{0, 1, 2, 4, 6, 7, 0x80, 0x80},       {0, 2, 4, 6, 7, 0x80, 0x80, 0x80},
+	{0, 1, 2, 3, 4, 5, 6, 0x80},          {0, 2, 3, 4, 5, 6, 0x80, 0x80},
+	{0, 1, 2, 4, 5, 6, 0x80, 0x80},       {0, 2, 4, 5, 6, 0x80, 0x80, 0x80},
+	{0, 1, 2, 3, 4, 6, 0x80, 0x80},       {0, 2, 3, 4, 6, 0x80, 0x80, 0x80},
+	{0, 1, 2, 4, 6, 0x80, 0x80, 0x80},    {0, 2, 4, 6, 0x80, 0x80, 0x80, 0x80}
+};
+static const unsigned char utf16_pack_len[16] = {
+	8, 7, 7, 6, 7, 6, 6, 5, 7, 6, 6, 5, 6, 5, 5, 4
+};
+#endif
+
+/* Convert leading utf16 characters in range [1, 0x7FF] to 1- or 2-byte utf8
+  characters, by blocks of 8 characters.
+   If se is NULL, utf16 string is L'\0'-terminated.
+   Stops at the block containing other characters, or if less than 16 bytes are available.
+   Updates *w and *b to point after the last converted character.
+   Returns number of stored utf8 bytes.  */
+UTF16CVT_NO_SANITIZE
+static size_t utf16_2byte_to_utf8(const utf16_char_t **const w, utf8_char_t **const b,
+	const size_t avail, const utf16_char_t *const se/*NULL?*/)
+{
+	const utf16_char_t *s = *w;
+	utf8_char_t *d = *b;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i non_2byte = _mm_set1_epi16((short)0xF800);
+	const __m128i non_ascii = _mm_set1_epi16((short)0xFF80);
+
+	while (avail - (size_t)(d - *b) >= 16) {
+		__m128i v, lead, trail, ascii;
+
+		/* If the string is L'\0'-terminated, unaligned load is safe
+		  if it does not cross the page boundary.  */
+		if (se ? se - s < 8 : ((size_t)s & 4095) > 4096 - 16)
+			break;
+
+		v = _mm_loadu_si128((const __m128i*)s);
+		if ((0xFFFF ^ _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, non_2byte), zero))) |
+			(se ? 0 : _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero))))
+		{
+			break;
+		}
+
+		/* 110xxxxx 10xxxxxx, lead byte goes first */
+		lead = _mm_or_si128(_mm_srli_epi16(v, 6), _mm_set1_epi16(0xC0));
+		trail = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+		lead = _mm_or_si128(lead, _mm_slli_epi16(trail, 8));
+
+		ascii = _mm_cmpeq_epi16(_mm_and_si128(v, non_ascii), zero);
+		if (!_mm_movemask_epi8(ascii)) {
+			_mm_storeu_si128((__m128i*)d, lead);
+			d += 16;
+		}
+		else {
+#ifdef UTF16CVT_AVX2
+			const unsigned m = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(ascii, zero));
+			const __m128i x = _mm_blendv_epi8(lead, v, ascii);
+			_mm_storel_epi64((__m128i*)d, _mm_shuffle_epi8(x,
+				_mm_loadl_epi64((const __m128i*)utf16_pack_shuf[m & 15])));
+			d += utf16_pack_len[m & 15];
+			_mm_storel_epi64((__m128i*)d, _mm_shuffle_epi8(x,
+				_mm_add_epi8(_mm_loadl_epi64((const __m128i*)utf16_pack_shuf[m >> 4]),
+					_mm_set1_epi8(8))));
+			d += utf16_pack_len[m >> 4];
+#else
+			/* no byte shuffle in SSE2: pack utf8 characters one by one */
+			unsigned m = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(ascii, zero));
+			utf16_char_t x[8];
+			unsigned i = 0;
+			_mm_storeu_si128((__m128i*)x,
+				_mm_or_si128(_mm_andnot_si128(ascii, lead), _mm_and_si128(ascii, v)));
+			for (; i < 8; i++, m >>= 1) {
+				d[0] = (utf8_char_t)x[i];
+				d[1] = (utf8_char_t)(x[i] >> 8);
+				d += 2 - (m & 1);
+			}
+#endif
+		}
+		s += 8;
+	}
+
+	*w = s;
+	{
+		const size_t r = (size_t)(d - *b);
+		*b = d;
+		return r;
+	}
+}
+#endif /* UTF16CVT_SSE2 */
+
+/* Convert utf16 string of n characters to utf8, or, if n is (size_t)-1,
+  L'\0'-terminated utf16 string, including terminating L'\0'.
+   Stores only whole utf8 characters, at most sz bytes.
+   Updates *w and *b to point after the last stored character.
+   Returns 1 if the whole string was converted, 0 if the buffer is full,
+  -1 if utf16 string has an unpaired surrogate.  */
+static int utf16_to_8_fill(const utf16_char_t **const w, utf8_char_t **const b,
+	const size_t sz, const size_t n/*>0*/)
+{
+	const int z = ((size_t)-1 == n);
+	const utf16_char_t *s = *w;
+	const utf16_char_t *const se = z ? NULL : s + n;
+	utf8_char_t *d = *b;
+	size_t avail = sz;
+
+	for (;;) {
+		unsigned c;
+
+		if (avail) {
+			const size_t a = z
+				? ascii16_to_utf8_z(s, d, avail)
+				: ascii16_to_utf8(s, d, (size_t)(se - s) < avail ? (size_t)(se - s) : avail);
+			s += a;
+			d += a;
+			avail -= a;
+		}
+
+		if (z ? !*s : s == se) {
+			if (z) {
+				if (!avail)
+					break;
+				*d++ = '\0';
+				s++;
+			}
+			*w = s;
+			*b = d;
+			return 1;
+		}
+
+		c = *s;
+		if (c < 0x80)
+			break; /* the buffer is full */
+
+		/* convert the run of non-ASCII characters */
+		do {
+			utf8_char_t tmp[4];
+			unsigned k;
+
+#ifdef UTF16CVT_SSE2
+			if (c < 0x800 && avail >= 16) {
+				const size_t a = utf16_2byte_to_utf8(&s, &d, avail, se);
+				if (a) {
+					avail -= a;
+					if (s == se)
+						break;
+					c = *s;
+					continue;
+				}
+			}
+#endif
+
+			k = utf16_to_8_one(tmp, c, (z || se - s > 1) ? s[1] : 0u);
+			if (!k)
+				return -1; /* unpaired surrogate */
+
+			if (k > avail)
+				goto full;
+
+			memcpy(d, tmp, k);
+			d += k;
+			avail -= k;
+			s += 1 + (4 == k);
+			if (s == se)
+				break;
+			c = *s;
+		} while (c >= 0x80);
+	}
+
+full:
+	*w = s;
+	*b = d;
+	return 0;
+}
+
+/* Convert utf16 string of n characters to utf8, or, if n is (size_t)-1,
+  L'\0'-terminated utf16 string, including terminating L'\0'.
+   Stores only whole utf8 characters, at most sz bytes, then only counts the rest.
+   Updates *w and *b to point after the last stored character.
+   Returns number of bytes in utf8 string, 0 if utf16 string has an unpaired surrogate.  */
+static size_t utf16_to_8_(const utf16_char_t **const w, utf8_char_t **const b,
+	const size_t sz, const size_t n/*>0*/)
+{
+	const int z = ((size_t)-1 == n);
+	const utf16_char_t *s = *w;
+	const utf16_char_t *const se = z ? NULL : s + n;
+	utf8_char_t *const d = *b;
+	size_t count;
+
+	const int r = utf16_to_8_fill(w, b, sz, n);
+	if (r < 0)
+		return 0; /* unpaired surrogate */
+
+	count = (size_t)(*b - d);
+	if (r)
+		return count;
+
+	/* The buffer is full, only count the rest.  */
+	for (s = *w;;) {
+		unsigned c;
+
+		if (z ? !*s : s == se)
+			break;
+
+		c = *s;
+		if (c < 0x80)
+			count++;
+		else if (c < 0x800)
+			count += 2;
+		else if ((c & 0xF800) != 0xD800)
+			count += 3;
+		else if (c < 0xDC00 && (z || se - s > 1) && (s[1] & 0xFC00) == 0xDC00) {
+			count += 4;
+			s++;
+		}
+		else
+			return 0; /* unpaired surrogate */
+		s++;
+	}
+
+	return count + z;
+}
+
+#ifndef UTF16CVT_AVX2
+/* Validate one non-ASCII utf8 character (first byte is c, s points after it).
+   Returns number of continuation bytes (1, 2 or 3), 0 if the character is invalid.  */
+static inline unsigned utf8_check_one(const unsigned c, const utf8_char_t s[])
+{
+	if (c < 0xC2)
+		return 0; /* continuation byte or overlong 2-byte form */
+	if ((s[0] & 0xC0) != 0x80)
+		return 0;
+	if (c < 0xE0)
+		return 1;
+	if ((s[1] & 0xC0) != 0x80)
+		return 0;
+	if (c < 0xF0) {
+		if (c == 0xE0 && s[0] < 0xA0)
+			return 0; /* overlong */
+		if (c == 0xED && s[0] >= 0xA0)
+			return 0; /* surrogate */
+		return 2;
+	}
+	if (c > 0xF4 || (s[2] & 0xC0) != 0x80)
+		return 0;
+	if (c == 0xF0 && s[0] < 0x90)
+		return 0; /* overlong */
+	if (c == 0xF4 && s[0] >= 0x90)
+		return 0; /* > 0x10FFFF */
+	return 3;
+}
+
+/* Count characters of valid utf8 string starting at s, validating it.
+   Returns pointer to the terminating '\0', NULL if the string is invalid.  */
+static const utf8_char_t *utf8_count_scalar(const utf8_char_t *s,
+	size_t *const cps/*in,out*/, size_t *const u16/*in,out*/)
+{
+	size_t n = 0, m = 0;
+	for (;;) {
+		const unsigned c = *s;
+		if (c < 0x80) {
+			if (!c)
+				break;
+			s++;
+		}
+		else {
+			const unsigned k = utf8_check_one(c, s + 1);
+			if (!k)
+				return NULL;
+			s += 1 + k;
+			m += (3 == k);
+		}
+		n++;
+	}
+	*cps += n;
+	*u16 += n + m;
+	return s;
+}
+
+#ifdef UTF16CVT_SSE2
+/* Same as utf8_count_scalar(), but also stops at the ASCII character on the
+  SIMD_ALIGN boundary.  */
+static const utf8_char_t *utf8_count_scalar_run(const utf8_char_t *s,
+	size_t *const cps/*in,out*/, size_t *const u16/*in,out*/)
+{
+	size_t n = 0, m = 0;
+	for (;;) {
+		const unsigned c = *s;
+		if (c < 0x80) {
+			if (!c)
+				break;
+			if (!((size_t)s & (SIMD_ALIGN - 1)))
+				break;
+			s++;
+		}
+		else {
+			const unsigned k = utf8_check_one(c, s + 1);
+			if (!k)
+				return NULL;
+			s += 1 + k;
+			m += (3 == k);
+		}
+		n++;
+	}
+	*cps += n;
+	*u16 += n + m;
+	return s;
+}
+#endif
+#endif /* !UTF16CVT_AVX2 */
+
+#ifdef UTF16CVT_SSE2
+/* Index of the lowest bit set in x != 0.  */
+static unsigned lowest_bit(unsigned x)
+{
+	unsigned i = 0;
+	for (; !(x & 1); x >>= 1)
+		i++;
+	return i;
+}
+#endif
+
+#ifdef UTF16CVT_AVX2
+/* Count bits set in x.  */
+static unsigned popcount32(unsigned x)
+{
+	x = x - ((x >> 1) & 0x55555555u);
+	x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+	x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+	return (x*0x01010101u) >> 24;
+}
+
+/* first SIMD_ALIGN bytes - 0xFF, next SIMD_ALIGN bytes - 0 */
+static const unsigned char utf8_count_mask[SIMD_ALIGN*2] = {
+	0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+	0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+};
+
+/* Classification of pairs of bytes (Keiser & Lemire, "Validating UTF-8 In Less Than
+  One Instruction Per Byte"): bits are set by lookups on the high and low nibbles
+  of the previous byte and the high nibble of the current one, an error is when
+  all three lookups agree on some bit.  */
+#define U8_TOO_SHORT  0x01 /* 11______ 0_______ or 11______ 11______ */
+#define U8_TOO_LONG   0x02 /* 0_______ 10______ */
+#define U8_OVERLONG_3 0x04 /* 11100000 100_____ */
+#define U8_TOO_LARGE  0x08 /* 11110100 1001____, 11110100 101_____, 11110101+ 1_______ */
+#define U8_SURROGATE  0x10 /* 11101101 101_____ */
+#define U8_OVERLONG_2 0x20 /* 1100000_ 10______ */
+#define U8_TOO_LARGE_1000 0x40 /* 11110101+ 1000____ */
+#define U8_OVERLONG_4 0x40 /* 11110000 1000____ */
+#define U8_TWO_CONTS  0x80 /* 10______ 10______ */
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+#define U8_TAB16(a0,a1,a2,a3,a4,a5,a6,a7,a8,a9,a10,a11,a12,a13,a14,a15) \
+	_mm256_setr_epi8( \
+		(char)(a0),(char)(a1),(char)(a2),(char)(a3),(char)(a4),(char)(a5),(char)(a6),(char)(a7), \
+		(char)(a8),(char)(a9),(char)(a10),(char)(a11),(char)(a12),(char)(a13),(char)(a14),(char)(a15), \
+		(char)(a0),(char)(a1),(char)(a2),(char)(a3),(char)(a4),(char)(a5),(char)(a6),(char)(a7), \
+		(char)(a8),(char)(a9),(char)(a10),(char)(a11),(char)(a12),(char)(a13),(char)(a14),(char)(a15))
+
+/* Returns non-zero vector if there are errors in the block v, prev - previous block.  */
+static __m256i utf8_check_block(const __m256i v, const __m256i prev)
+{
+	const __m256i nib = _mm256_set1_epi8(0x0F);
+	const __m256i t = _mm256_permute2x128_si256(prev, v, 0x21);
+	const __m256i prev1 = _mm256_alignr_epi8(v, t, 16 - 1);
+	const __m256i prev2 = _mm256_alignr_epi8(v, t, 16 - 2);
+	const __m256i prev3 = _mm256_alignr_epi8(v, t, 16 - 3);
+
+	const __m256i byte_1_high = _mm256_shuffle_epi8(U8_TAB16(
+		U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+		U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+		U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+		U8_TOO_SHORT | U8_OVERLONG_2,
+		U8_TOO_SHORT,
+		U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+		U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4),
+		_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib));
+
+	const __m256i byte_1_low = _mm256_shuffle_epi8(U8_TAB16(
+		U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+		U8_CARRY | U8_OVERLONG_2,
+		U8_CARRY,
+		U8_CARRY,
+		U8_CARRY | U8_TOO_LARGE,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+		U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),
+		_mm256_and_si256(prev1, nib));
+
+	const __m256i byte_2_high = _mm256_shuffle_epi8(U8_TAB16(
+		U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+		U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+		U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+		U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+		U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+		U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+		U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT),
+		_mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+
+	const __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+	/* 3rd and 4th bytes of 3- and 4-byte sequences must be continuation bytes */
+	const __m256i must23 = _mm256_or_si256(
+		_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+		_mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+	const __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+
+	return _mm256_xor_si256(must23_80, special);
+}
+
+/* Validate and count characters of '\0'-terminated utf8 string, 32 bytes at once.  */
+UTF16CVT_NO_SANITIZE
+static size_t utf8_count_z_avx2(const utf8_char_t str[], size_t *const u16len)
+{
+	/* Aligned loads never cross the page boundary,
+	  so it is safe to read before the start and past the terminating '\0'.  */
+	const unsigned off = (unsigned)((size_t)str & (SIMD_ALIGN - 1));
+	const utf8_char_t *p = str - off;
+	__m256i prev = _mm256_setzero_si256();
+	__m256i err = _mm256_setzero_si256();
+	size_t cps = 0, u16 = 0;
+	/* bit mask of counted positions in the block */
+	unsigned keep = ~0u << off;
+
+	for (;; p += SIMD_ALIGN) {
+		__m256i v = _mm256_load_si256((const __m256i*)p);
+		unsigned z;
+
+		if (keep != ~0u) {
+			/* bytes before the start of the string are treated as ASCII */
+			const __m256i m = _mm256_loadu_si256((const __m256i*)&utf8_count_mask[SIMD_ALIGN - off]);
+			v = _mm256_blendv_epi8(v, _mm256_set1_epi8(1), m);
+		}
+
+		z = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		if (z) {
+			/* zero bytes after the terminating '\0' */
+			const unsigned idx = lowest_bit(z);
+			v = _mm256_and_si256(v, _mm256_loadu_si256((const __m256i*)&utf8_count_mask[SIMD_ALIGN - idx]));
+			keep &= ~(~0u << idx);
+		}
+
+		if (_mm256_movemask_epi8(_mm256_or_si256(v, prev))) {
+			/* non-ASCII characters */
+			err = _mm256_or_si256(err, utf8_check_block(v, prev));
+			{
+				/* count all but continuation bytes */
+				const unsigned lead = keep & ~(unsigned)_mm256_movemask_epi8(
+					_mm256_cmpgt_epi8(_mm256_set1_epi8((char)0xC0), v));
+				const unsigned four = keep & (unsigned)_mm256_movemask_epi8(
+					_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8((char)0xF0)), v));
+				const unsigned k = popcount32(lead);
+				cps += k;
+				u16 += k + popcount32(four);
+			}
+		}
+		else {
+			const unsigned k = popcount32(keep);
+			cps += k;
+			u16 += k;
+		}
+
+		if (z)
+			break;
+
+		prev = v;
+		keep = ~0u;
+	}
+
+	if (!_mm256_testz_si256(err, err))
+		return (size_t)-1;
+
+	if (u16len)
+		*u16len = u16;
+	return cps;
+}
+#endif /* UTF16CVT_AVX2 */
+
 A_Use_decl_annotations
-wchar_t *cvt_utf8_to_16_z_reserve(const char str[], wchar_t buf[]/*NULL?*/,
-	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/)
+UTF16CVT_NO_SANITIZE
+size_t cvt_utf8_count_z(const char str[], size_t *const u16len/*NULL?,out*/)
+{
+#ifdef UTF16CVT_AVX2
+	const size_t n = utf8_count_z_avx2((const utf8_char_t*)str, u16len);
+	if ((size_t)-1 == n)
+		errno = EILSEQ;
+	return n;
+#else
+	const utf8_char_t *s = (const utf8_char_t*)str;
+	size_t cps = 0, u16 = 0;
+#ifdef UTF16CVT_SSE2
+	/* Aligned loads never cross the page boundary,
+	  so it is safe to read past the terminating '\0'.  */
+	const __m128i zero = _mm_setzero_si128();
+	unsigned misses = 0;
+
+	/* if the text is too mixed to benefit from SIMD code, count the rest by the scalar code */
+	while (misses <= 16) {
+		s = utf8_count_scalar_run(s, &cps, &u16);
+		if (!s)
+			goto bad;
+		if (!*s)
+			goto done;
+		misses++;
+		for (;; s += 16) {
+			const __m128i v = _mm_load_si128((const __m128i*)s);
+			const unsigned z = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+			const unsigned a = (unsigned)_mm_movemask_epi8(v);
+			if (z | a) {
+				/* count leading ASCII characters of the block */
+				const unsigned i = lowest_bit(z | a);
+				cps += i;
+				u16 += i;
+				s += i;
+				break;
+			}
+			cps += 16;
+			u16 += 16;
+			/* the text looks like ASCII */
+			misses = 0;
+		}
+		if (!*s)
+			goto done;
+	}
+#endif
+	if (!utf8_count_scalar(s, &cps, &u16))
+		goto bad;
+#ifdef UTF16CVT_SSE2
+done:
+#endif
+	if (u16len)
+		*u16len = u16;
+	return cps;
+
+bad:
+	errno = EILSEQ;
+	return (size_t)-1;
+#endif
+}
+
+static void *cvt_malloc(void *ctx, size_t sz)
+{
+	(void)ctx;
+	return malloc(sz);
+}
+
+static void *cvt_alloc(void *(*alloc)(void *ctx, size_t sz), void *ctx, const size_t sz)
+{
+	void *const p = (*alloc)(ctx, sz);
+	if (!p)
+		errno = ENOMEM;
+	return p;
+}
+
+/* Note: CVT_ONE_PASS is supported only for the malloc() allocator.  */
+static wchar_t *cvt_utf8_to_16_z_reserve_(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/,
+	const unsigned flags, void *(*alloc)(void *ctx, size_t sz), void *ctx)
 {
 	const utf8_char_t *q = (const utf8_char_t*)str;
 	utf16_char_t *b = buf;
-	const size_t n = utf8_to_utf16_z(&q, &b, buf_sz);
+	size_t n;
 	wchar_t *r = buf;
 
+	if (flags & CVT_ONE_PASS) {
+		const size_t len = strlen(str);
+		if (len >= buf_sz)
+			return utf8_to_16_z_one_pass(str, len, sz, u8sz, flags);
+	}
+
+	n = utf8_to_16_z(&q, &b, buf_sz);
+
 	if (!n) {
 		errno = EILSEQ;
 		return NULL;
@@ -41,7 +1079,7 @@ wchar_t *cvt_utf8_to_16_z_reserve(const char str[], wchar_t buf[]/*NULL?*/,
 			return NULL;
 		}
 
-		r = (wchar_t*)malloc((n + reserve)*sizeof(wchar_t));
+		r = (wchar_t*)cvt_alloc(alloc, ctx, (n + reserve)*sizeof(wchar_t));
 		if (!r)
 			return NULL;
 
@@ -50,7 +1088,7 @@ wchar_t *cvt_utf8_to_16_z_reserve(const char str[], wchar_t buf[]/*NULL?*/,
 			memcpy(r + reserve, buf, conveted*sizeof(wchar_t));
 		}
 
-		q = utf8_to_utf16_z_unsafe(q, &r[reserve + conveted]);
+		q = utf8_to_16_z_unsafe(q, &r[reserve + conveted]);
 	}
 
 	*u8sz = (size_t)(q - (const utf8_char_t*)str);
@@ -58,6 +1096,29 @@ wchar_t *cvt_utf8_to_16_z_reserve(const char str[], wchar_t buf[]/*NULL?*/,
 	return r;
 }
 
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_reserve(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/)
+{
+	return cvt_utf8_to_16_z_reserve_(str, buf, buf_sz, sz, u8sz, /*flags:*/0, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_reserve_f(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/,
+	const unsigned flags)
+{
+	return cvt_utf8_to_16_z_reserve_(str, buf, buf_sz, sz, u8sz, flags, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_reserve_a(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u8sz/*out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	return cvt_utf8_to_16_z_reserve_(str, buf, buf_sz, sz, u8sz, /*flags:*/0, alloc, ctx);
+}
+
 A_Use_decl_annotations
 wchar_t *cvt_utf8_to_16_z_sz(const char str[], wchar_t buf[]/*NULL?*/,
 	const size_t buf_sz, size_t *const sz/*out*/)
@@ -75,15 +1136,139 @@ wchar_t *cvt_utf8_to_16_z(const char str[], wchar_t buf[]/*NULL?*/, const size_t
 }
 
 A_Use_decl_annotations
-wchar_t *cvt_utf8_to_16(const char str[], size_t *const len/*>0,in,out*/,
-	wchar_t buf[]/*NULL?*/, const size_t buf_sz)
+wchar_t *cvt_utf8_to_16_z_sz_a(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t u8sz;
+	*sz = 0;
+	return cvt_utf8_to_16_z_reserve_a(str, buf, buf_sz, sz, &u8sz, alloc, ctx);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_a(const char str[], wchar_t buf[]/*NULL?*/, const size_t buf_sz,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t sz = 0, u8sz;
+	return cvt_utf8_to_16_z_reserve_a(str, buf, buf_sz, &sz, &u8sz, alloc, ctx);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_f(const char str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, const unsigned flags)
+{
+	size_t sz = 0, u8sz;
+	return cvt_utf8_to_16_z_reserve_f(str, buf, buf_sz, &sz, &u8sz, flags);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_n_sz(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/)
+{
+	return cvt_utf8_to_16_z_n_sz_a(str, len, buf, buf_sz, sz, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_n_sz_a(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	const utf8_char_t *q = (const utf8_char_t*)str;
+	utf16_char_t *b = buf;
+	size_t n = 0;
+	wchar_t *r = buf;
+
+	/* reserve a place for the terminating L'\0' */
+	if (len) {
+		n = utf8_to_16(&q, &b, buf_sz ? buf_sz - 1 : 0, len);
+		if (!n) {
+			errno = EILSEQ;
+			return NULL;
+		}
+	}
+
+	if (n >= buf_sz) {
+		size_t conveted = 0;
+
+		if (n > (size_t)-1/sizeof(wchar_t) - 1) {
+			errno = E2BIG;
+			return NULL;
+		}
+
+		r = (wchar_t*)cvt_alloc(alloc, ctx, (n + 1)*sizeof(wchar_t));
+		if (!r)
+			return NULL;
+
+		if (b != buf) {
+			conveted = (size_t)(b - buf);
+			memcpy(r, buf, conveted*sizeof(wchar_t));
+		}
+
+		utf8_to_16_unsafe(q, &r[conveted], len - (size_t)(q - (const utf8_char_t*)str));
+	}
+
+	r[n] = L'\0';
+	*sz = n + 1;
+	return r;
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_n(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz)
+{
+	size_t sz;
+	return cvt_utf8_to_16_z_n_sz(str, len, buf, buf_sz, &sz);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_z_n_a(const char str[], const size_t len, wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t sz;
+	return cvt_utf8_to_16_z_n_sz_a(str, len, buf, buf_sz, &sz, alloc, ctx);
+}
+
+/* Note: CVT_ONE_PASS is supported only for the malloc() allocator.  */
+static wchar_t *cvt_utf8_to_16_(const char str[], size_t *const len/*>0,in,out*/,
+	wchar_t buf[]/*NULL?*/, const size_t buf_sz, const unsigned flags,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
 {
 	const utf8_char_t *q = (const utf8_char_t*)str;
 	const utf8_char_t *const qe = q + *len;
 	utf16_char_t *b = buf;
-	const size_t n = utf8_to_utf16(&q, &b, buf_sz, (size_t)(qe - q)/*>0*/);
+	size_t n;
 	wchar_t *r = buf;
 
+	if ((flags & CVT_ONE_PASS) && *len > buf_sz) {
+		/* Allocate worst-case sized buffer - one utf16 character per utf8 byte.  */
+		if (*len > (size_t)-1/sizeof(wchar_t)) {
+			errno = E2BIG;
+			return NULL;
+		}
+
+		r = (wchar_t*)malloc(*len*sizeof(wchar_t));
+		if (!r)
+			return NULL;
+
+		b = r;
+		n = utf8_to_16(&q, &b, *len, *len);
+
+		if (!n) {
+			free(r);
+			errno = EILSEQ;
+			return NULL;
+		}
+
+		if ((flags & CVT_SHRINK) && n < *len) {
+			wchar_t *const s = (wchar_t*)realloc(r, n*sizeof(wchar_t));
+			if (s)
+				r = s;
+		}
+
+		*len = n;
+		return r;
+	}
+
+	n = utf8_to_16(&q, &b, buf_sz, (size_t)(qe - q)/*>0*/);
+
 	if (!n) {
 		errno = EILSEQ;
 		return NULL;
@@ -97,7 +1282,7 @@ wchar_t *cvt_utf8_to_16(const char str[], size_t *const len/*>0,in,out*/,
 			return NULL;
 		}
 
-		r = (wchar_t*)malloc(n*sizeof(wchar_t));
+		r = (wchar_t*)cvt_alloc(alloc, ctx, n*sizeof(wchar_t));
 		if (!r)
 			return NULL;
 
@@ -106,16 +1291,44 @@ wchar_t *cvt_utf8_to_16(const char str[], size_t *const len/*>0,in,out*/,
 			memcpy(r, buf, conveted*sizeof(wchar_t));
 		}
 
-		(void)utf8_to_utf16_unsafe(q, &r[conveted], (size_t)(qe - q));
+		utf8_to_16_unsafe(q, &r[conveted], (size_t)(qe - q));
 	}
 
 	*len = n;
 	return r;
 }
 
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16(const char str[], size_t *const len/*>0,in,out*/,
+	wchar_t buf[]/*NULL?*/, const size_t buf_sz)
+{
+	return cvt_utf8_to_16_(str, len, buf, buf_sz, /*flags:*/0, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_f(const char str[], size_t *const len/*>0,in,out*/,
+	wchar_t buf[]/*NULL?*/, const size_t buf_sz, const unsigned flags)
+{
+	return cvt_utf8_to_16_(str, len, buf, buf_sz, flags, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf8_to_16_a(const char str[], size_t *const len/*>0,in,out*/,
+	wchar_t buf[]/*NULL?*/, const size_t buf_sz, void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	return cvt_utf8_to_16_(str, len, buf, buf_sz, /*flags:*/0, alloc, ctx);
+}
+
 A_Use_decl_annotations
 wchar_t *cvt_utf32_to_16_z_sz(const unsigned str[], wchar_t buf[]/*NULL?*/,
 	const size_t buf_sz, size_t *const sz/*out*/)
+{
+	return cvt_utf32_to_16_z_sz_a(str, buf, buf_sz, sz, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+wchar_t *cvt_utf32_to_16_z_sz_a(const unsigned str[], wchar_t buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx)
 {
 	const utf32_char_t *w = (const utf32_char_t*)str;
 	utf16_char_t *b = buf;
@@ -130,7 +1343,12 @@ wchar_t *cvt_utf32_to_16_z_sz(const unsigned str[], wchar_t buf[]/*NULL?*/,
 	if (n > buf_sz) {
 		size_t conveted = 0;
 
-		r = (wchar_t*)malloc(n*sizeof(wchar_t));
+		if (n > (size_t)-1/sizeof(wchar_t)) {
+			errno = E2BIG;
+			return NULL;
+		}
+
+		r = (wchar_t*)cvt_alloc(alloc, ctx, n*sizeof(wchar_t));
 		if (!r)
 			return NULL;
 
@@ -152,3 +1370,278 @@ wchar_t *cvt_utf32_to_16_z(const unsigned str[], wchar_t buf[]/*NULL?*/, const s
 	size_t sz;
 	return cvt_utf32_to_16_z_sz(str, buf, buf_sz, &sz);
 }
+
+A_Use_decl_annotations
+wchar_t *cvt_utf32_to_16_z_a(const unsigned str[], wchar_t buf[]/*NULL?*/, const size_t buf_sz,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t sz;
+	return cvt_utf32_to_16_z_sz_a(str, buf, buf_sz, &sz, alloc, ctx);
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8_z_reserve(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u16sz/*out*/)
+{
+	return cvt_utf16_to_8_z_reserve_a(str, buf, buf_sz, sz, u16sz, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8_z_reserve_a(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*in,out*/, size_t *const u16sz/*out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	const utf16_char_t *w = (const utf16_char_t*)str;
+	utf8_char_t *b = (utf8_char_t*)buf;
+	const size_t n = utf16_to_8_(&w, &b, buf_sz, (size_t)-1);
+	char *r = buf;
+
+	if (!n) {
+		errno = EILSEQ;
+		return NULL;
+	}
+
+	if (n > buf_sz) {
+		size_t conveted = 0;
+		const size_t reserve = *sz;
+
+		if (n > (size_t)-1 - reserve) {
+			errno = E2BIG;
+			return NULL;
+		}
+
+		r = (char*)cvt_alloc(alloc, ctx, n + reserve);
+		if (!r)
+			return NULL;
+
+		if (b != (utf8_char_t*)buf) {
+			conveted = (size_t)(b - (utf8_char_t*)buf);
+			memcpy(r + reserve, buf, conveted);
+		}
+
+		b = (utf8_char_t*)&r[reserve + conveted];
+		(void)utf16_to_8_(&w, &b, n - conveted, (size_t)-1);
+	}
+
+	*u16sz = (size_t)(w - (const utf16_char_t*)str);
+	*sz = n;
+	return r;
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8_z_sz(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/)
+{
+	size_t u16sz;
+	*sz = 0;
+	return cvt_utf16_to_8_z_reserve(str, buf, buf_sz, sz, &u16sz);
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8_z(const wchar_t str[], char buf[]/*NULL?*/, const size_t buf_sz)
+{
+	size_t sz = 0, u16sz;
+	return cvt_utf16_to_8_z_reserve(str, buf, buf_sz, &sz, &u16sz);
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8_z_sz_a(const wchar_t str[], char buf[]/*NULL?*/,
+	const size_t buf_sz, size_t *const sz/*out*/, void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t u16sz;
+	*sz = 0;
+	return cvt_utf16_to_8_z_reserve_a(str, buf, buf_sz, sz, &u16sz, alloc, ctx);
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8_z_a(const wchar_t str[], char buf[]/*NULL?*/, const size_t buf_sz,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t sz = 0, u16sz;
+	return cvt_utf16_to_8_z_reserve_a(str, buf, buf_sz, &sz, &u16sz, alloc, ctx);
+}
+
+A_Use_decl_annotations
+size_t cvt_utf16_to_8_part_z(const wchar_t **const str/*in,out*/, char buf[], const size_t buf_sz)
+{
+	const utf16_char_t *w = (const utf16_char_t*)*str;
+	utf8_char_t *b = (utf8_char_t*)buf;
+	const int r = utf16_to_8_fill(&w, &b, buf_sz, (size_t)-1);
+
+	if (r < 0) {
+		*str = (const wchar_t*)w;
+		errno = EILSEQ;
+		return (size_t)-1;
+	}
+
+	if (r) {
+		/* do not count the stored terminating '\0' */
+		w--;
+		b--;
+	}
+
+	*str = (const wchar_t*)w;
+	return (size_t)(b - (utf8_char_t*)buf);
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8(const wchar_t str[], size_t *const len/*>0,in,out*/,
+	char buf[]/*NULL?*/, const size_t buf_sz)
+{
+	return cvt_utf16_to_8_a(str, len, buf, buf_sz, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+char *cvt_utf16_to_8_a(const wchar_t str[], size_t *const len/*>0,in,out*/,
+	char buf[]/*NULL?*/, const size_t buf_sz, void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	const utf16_char_t *w = (const utf16_char_t*)str;
+	const utf16_char_t *const we = w + *len;
+	utf8_char_t *b = (utf8_char_t*)buf;
+	const size_t n = utf16_to_8_(&w, &b, buf_sz, *len/*>0*/);
+	char *r = buf;
+
+	if (!n) {
+		errno = EILSEQ;
+		return NULL;
+	}
+
+	if (n > buf_sz) {
+		size_t conveted = 0;
+
+		r = (char*)cvt_alloc(alloc, ctx, n);
+		if (!r)
+			return NULL;
+
+		if (b != (utf8_char_t*)buf) {
+			conveted = (size_t)(b - (utf8_char_t*)buf);
+			memcpy(r, buf, conveted);
+		}
+
+		b = (utf8_char_t*)&r[conveted];
+		(void)utf16_to_8_(&w, &b, n - conveted, (size_t)(we - w));
+	}
+
+	*len = n;
+	return r;
+}
+
+A_Use_decl_annotations
+wchar_t **cvt_utf8_to_16_vec(const char *const vec[], size_t *const bad/*NULL?,out*/)
+{
+	return cvt_utf8_to_16_vec_a(vec, bad, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+wchar_t **cvt_utf8_to_16_vec_a(const char *const vec[], size_t *const bad/*NULL?,out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t n = 0, total = 0, i;
+	wchar_t **r;
+	utf16_char_t *d;
+
+	/* Compute the size of the block.  */
+	for (; vec[n]; n++) {
+		const utf8_char_t *q = (const utf8_char_t*)vec[n];
+		utf16_char_t *b = NULL;
+		const size_t sz = utf8_to_16_z(&q, &b, 0);
+
+		if (!sz) {
+			if (bad)
+				*bad = n;
+			errno = EILSEQ;
+			return NULL;
+		}
+
+		if (sz > (size_t)-1/sizeof(wchar_t) - total)
+			goto too_big;
+
+		total += sz;
+	}
+
+	if (n >= ((size_t)-1 - total*sizeof(wchar_t))/sizeof(*r))
+		goto too_big;
+
+	r = (wchar_t**)cvt_alloc(alloc, ctx, (n + 1)*sizeof(*r) + total*sizeof(wchar_t));
+	if (!r)
+		goto fail;
+
+	/* Strings are placed after the array of pointers.  */
+	d = (utf16_char_t*)(r + n + 1);
+
+	for (i = 0; i < n; i++) {
+		const utf8_char_t *q = (const utf8_char_t*)vec[i];
+		r[i] = d;
+		total -= utf8_to_16_z(&q, &d, total);
+	}
+
+	r[n] = NULL;
+	return r;
+
+too_big:
+	errno = E2BIG;
+fail:
+	if (bad)
+		*bad = (size_t)-1;
+	return NULL;
+}
+
+A_Use_decl_annotations
+char **cvt_utf16_to_8_vec(const wchar_t *const vec[], size_t *const bad/*NULL?,out*/)
+{
+	return cvt_utf16_to_8_vec_a(vec, bad, cvt_malloc, NULL);
+}
+
+A_Use_decl_annotations
+char **cvt_utf16_to_8_vec_a(const wchar_t *const vec[], size_t *const bad/*NULL?,out*/,
+	void *(*alloc)(void *ctx, size_t sz), void *ctx)
+{
+	size_t n = 0, total = 0, i;
+	char **r;
+	utf8_char_t *d;
+
+	/* Compute the size of the block.  */
+	for (; vec[n]; n++) {
+		const utf16_char_t *w = (const utf16_char_t*)vec[n];
+		utf8_char_t *b = NULL;
+		const size_t sz = utf16_to_8_(&w, &b, 0, (size_t)-1);
+
+		if (!sz) {
+			if (bad)
+				*bad = n;
+			errno = EILSEQ;
+			return NULL;
+		}
+
+		if (sz > (size_t)-1 - total)
+			goto too_big;
+
+		total += sz;
+	}
+
+	if (n >= ((size_t)-1 - total)/sizeof(*r))
+		goto too_big;
+
+	r = (char**)cvt_alloc(alloc, ctx, (n + 1)*sizeof(*r) + total);
+	if (!r)
+		goto fail;
+
+	/* Strings are placed after the array of pointers.  */
+	d = (utf8_char_t*)(r + n + 1);
+
+	for (i = 0; i < n; i++) {
+		const utf16_char_t *w = (const utf16_char_t*)vec[i];
+		r[i] = (char*)d;
+		total -= utf16_to_8_(&w, &d, total, (size_t)-1);
+	}
+
+	r[n] = NULL;
+	return r;
+
+too_big:
+	errno = E2BIG;
+fail:
+	if (bad)
+		*bad = (size_t)-1;
+	return NULL;
+}
@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include "libutf16/utf16_to_utf8.h"
+#include "libutf16/utf8_to_utf16_one.h"
 #include "unicode_ctype/unicode_toupper.h"
 #include "mscrtx/utf16cvt.h"
 #include "mscrtx/utf8env.h"
@@ -29,20 +30,41 @@
 # endif
 #endif
 
-#define UTF8_ENV_TAB_SIZE     32
+#define UTF8_ENV_TAB_SIZE     32 /* minimal number of buckets, a power of two */
 #define UTF8_ENV_REALLOC_BY   16
 #define ENV_NAME_BUF_SIZE     128
 
 struct utf8_env_entry {
 	struct utf8_env_entry *next;
+	unsigned hash;                /* hash of the name, converted to upper case */
+	size_t idx;                   /* index of name_eq_value in utf8_env array or UTF8_ENV_NO_IDX */
 	size_t u8name_len;
-	size_t name_len;
-	wchar_t name[1];              /* uppercase */
-	/* ... */
-	/*char u8_name_eq_value[1]*/  /* string in form 'name=value' */
+	char name_eq_value[1];        /* string in form 'name=value' */
 };
 
-static struct utf8_env_entry *utf8_env_tab[UTF8_ENV_TAB_SIZE];
+/* Names are compared case-insensitively directly in UTF-8, as Windows compares them:
+  by upper-casing each UTF-16 character - characters outside of the BMP are not converted.  */
+
+/* By default, the whole environment is converted by the first call of any function.
+   In lazy mode, set by utf8_env_set_lazy(), entries are created on demand: utf8_getenv()
+  converts and caches only the requested variable, looking it up by _wgetenv(), and the
+  whole environment is converted only when utf8_environ() is called - until then utf8_env
+  is NULL.  */
+
+/* non-zero if entries are created on demand */
+static int utf8_env_lazy = 0;
+
+/* index of a cached entry which is not in utf8_env array */
+#define UTF8_ENV_NO_IDX ((size_t)-1)
+
+/* hash table of entries, chained in buckets */
+static struct utf8_env_entry **utf8_env_tab = NULL;
+
+/* number of buckets in utf8_env_tab, a power of two */
+static size_t utf8_env_tab_size;
+
+/* number of entries in utf8_env_tab */
+static size_t utf8_env_tab_count;
 
 /* NULL-terminated array of pointers to 'name=value' strings */
 static char **utf8_env = NULL;
@@ -53,99 +75,337 @@ static size_t utf8_env_filled;
 /* total number of pointers in utf8_env array, not counting trailing NULL */
 static size_t utf8_env_size;
 
+/* entries created by utf8_environ() are allocated in one block,
+  entries created later by utf8_getenv() or utf8_setenv() - separately */
+static char *utf8_env_arena = NULL;
+
+/* size of utf8_env_arena in bytes */
+static size_t utf8_env_arena_size;
+
+/* entries cached by utf8_getenv() and then replaced by utf8_environ(),
+  kept until utf8_env_shadow_reset() - values returned by utf8_getenv() remain valid */
+static struct utf8_env_entry *utf8_env_retired = NULL;
+
+/* alignment of entries in utf8_env_arena */
+struct utf8_env_align_ {
+	char c;
+	struct utf8_env_entry e;
+};
+#define UTF8_ENV_ALIGN OFFSETOF(struct utf8_env_align_, e)
+
+static void utf8_env_free(struct utf8_env_entry *e)
+{
+	/* entries in the arena are freed all at once */
+	if ((size_t)e - (size_t)utf8_env_arena >= utf8_env_arena_size)
+		free(e);
+}
+
 void utf8_env_shadow_reset(void)
 {
-	if (utf8_env) {
-		unsigned i = 0;
-		for (; i < sizeof(utf8_env_tab)/sizeof(utf8_env_tab[0]); i++) {
+	if (utf8_env_tab) {
+		size_t i = 0;
+		for (; i < utf8_env_tab_size; i++) {
 			struct utf8_env_entry *e = utf8_env_tab[i];
 			while (e) {
 				struct utf8_env_entry *n = e->next;
-				free(e);
+				utf8_env_free(e);
 				e = n;
 			}
 		}
-		for (i = 0; i < sizeof(utf8_env_tab)/sizeof(utf8_env_tab[0]); i++)
-			utf8_env_tab[i] = NULL;
+		free(utf8_env_tab);
+		utf8_env_tab = NULL;
+		utf8_env_tab_size = 0;
+		utf8_env_tab_count = 0;
+	}
+	while (utf8_env_retired) {
+		struct utf8_env_entry *n = utf8_env_retired->next;
+		utf8_env_free(utf8_env_retired);
+		utf8_env_retired = n;
+	}
+	if (utf8_env) {
 		free(utf8_env);
 		utf8_env = NULL;
+		utf8_env_filled = 0;
+		utf8_env_size = 0;
+	}
+	if (utf8_env_arena) {
+		free(utf8_env_arena);
+		utf8_env_arena = NULL;
+		utf8_env_arena_size = 0;
 	}
 }
 
-static unsigned utf8_env_tab_idx(wchar_t c)
+/* get the next character of the name, converted to upper case,
+  returns pointer after the character or NULL if the name is not a valid UTF-8 */
+static const char *utf8_env_name_char(const char s[], unsigned *const c/*out*/)
 {
-	/* compute hash from one letter */
-	unsigned hash = (unsigned)c - (L'A' - 1);
-	unsigned idx = hash % (sizeof(utf8_env_tab)/sizeof(utf8_env_tab[0]));
-	return idx;
+	const unsigned b = (unsigned char)*s;
+	if (b < 0x80) {
+		/* fast path for ASCII */
+		*c = b - 'a' <= 'z' - 'a' ? b - ('a' - 'A') : b;
+		return s + 1;
+	}
+	{
+		utf32_char_t w;
+		s = (const char*)utf8_to_utf32_one_z(&w, (const utf8_char_t*)s);
+		if (s)
+			*c = w <= 0xFFFF ? unicode_toupper((unsigned)w) : (unsigned)w;
+		return s;
+	}
 }
 
-static void name_to_upper(wchar_t out[], const wchar_t wname[], size_t name_len)
+/* compute FNV-1a hash of the name of len bytes, converted to upper case,
+  returns 0 if the name is not a valid UTF-8 */
+static int utf8_env_hash(const char name[], size_t len, unsigned *const hash/*out*/)
 {
-	size_t i = 0;
-	for (; i < name_len; i++)
-		out[i] = (wchar_t)unicode_toupper(wname[i]);
+	const char *const end = name + len;
+	unsigned h = 2166136261u;
+	while (name != end) {
+		unsigned c;
+		name = utf8_env_name_char(name, &c);
+		if (!name)
+			return 0;
+		h = (h ^ c)*16777619u;
+	}
+	*hash = h;
+	return 1;
+}
+
+/* compare valid UTF-8 names case-insensitively, names may have different lengths in bytes,
+  returns non-zero if the names are equal */
+static int utf8_env_name_eq(const char a[], size_t alen, const char b[], size_t blen)
+{
+	const char *const ae = a + alen, *const be = b + blen;
+	if (alen == blen && !memcmp(a, b, alen))
+		return 1;
+	while (a != ae && b != be) {
+		unsigned ca, cb;
+		a = utf8_env_name_char(a, &ca);
+		b = utf8_env_name_char(b, &cb);
+		if (ca != cb)
+			return 0;
+	}
+	return a == ae && b == be;
+}
+
+static struct utf8_env_entry **utf8_env_bucket(unsigned hash)
+{
+	return &utf8_env_tab[hash & (utf8_env_tab_size - 1)];
+}
+
+/* find the entry by the name of len bytes,
+  returns pointer to the link to the found entry or NULL */
+static struct utf8_env_entry **utf8_env_find(const char name[], size_t len, unsigned hash)
+{
+	struct utf8_env_entry **pe = utf8_env_bucket(hash);
+	for (; *pe; pe = &(*pe)->next) {
+		if ((*pe)->hash == hash &&
+			utf8_env_name_eq((*pe)->name_eq_value, (*pe)->u8name_len, name, len))
+		{
+			return pe;
+		}
+	}
+	return NULL;
+}
+
+static void utf8_env_insert(struct utf8_env_entry *e)
+{
+	struct utf8_env_entry **const b = utf8_env_bucket(e->hash);
+	e->next = *b;
+	*b = e;
+	utf8_env_tab_count++;
+}
+
+/* double the number of buckets when there are as many entries as buckets,
+  if failed, the table remains usable, only the chains get longer */
+static void utf8_env_tab_grow(void)
+{
+	if (utf8_env_tab_count >= utf8_env_tab_size &&
+		utf8_env_tab_size <= (size_t)-1/sizeof(*utf8_env_tab)/2)
+	{
+		struct utf8_env_entry **const old_tab = utf8_env_tab;
+		const size_t old_size = utf8_env_tab_size;
+		struct utf8_env_entry **const tab = (struct utf8_env_entry**)calloc(old_size*2, sizeof(*tab));
+		if (tab) {
+			size_t i = 0;
+			utf8_env_tab = tab;
+			utf8_env_tab_size = old_size*2;
+			utf8_env_tab_count = 0;
+			for (; i < old_size; i++) {
+				struct utf8_env_entry *e = old_tab[i];
+				while (e) {
+					struct utf8_env_entry *n = e->next;
+					utf8_env_insert(e);
+					e = n;
+				}
+			}
+			free(old_tab);
+		}
+	}
+}
+
+/* create the hash table, if it was not created yet, count - expected number of entries */
+static int utf8_env_tab_init(size_t count)
+{
+	if (!utf8_env_tab) {
+		size_t size = UTF8_ENV_TAB_SIZE;
+		while (size < count && size <= (size_t)-1/sizeof(*utf8_env_tab)/2)
+			size *= 2;
+		utf8_env_tab = (struct utf8_env_entry**)calloc(size, sizeof(*utf8_env_tab));
+		if (!utf8_env_tab)
+			return -1;
+		utf8_env_tab_size = size;
+	}
+	return 0;
+}
+
+/* get the entry by its 'name=value' string from utf8_env array */
+static struct utf8_env_entry *utf8_env_entry_of(char *name_eq_value)
+{
+	return (struct utf8_env_entry*)(name_eq_value - OFFSETOF(struct utf8_env_entry, name_eq_value));
+}
+
+/* count the number of bytes needed to store n UTF-16 characters in UTF-8,
+  returns (size_t)-1 if the characters are not a valid UTF-16 */
+static size_t utf8_env_u8_len(const wchar_t s[], size_t n)
+{
+	size_t i = 0, u8len = n;
+	for (; i < n; i++) {
+		const unsigned c = (unsigned)s[i];
+		if (c >= 0x80) {
+			if (c < 0x800)
+				u8len++;
+			else if (utf16_is_high_surrogate(c)) {
+				if (i + 1 == n || !utf16_is_low_surrogate((unsigned)s[i + 1]))
+					return (size_t)-1;
+				u8len += 2; /* 4 bytes for 2 UTF-16 characters */
+				i++;
+			}
+			else if (utf16_is_low_surrogate(c))
+				return (size_t)-1;
+			else
+				u8len += 2;
+		}
+	}
+	return u8len;
+}
+
+/* lengths of the variable of _wenviron */
+struct utf8_env_var_len {
+	size_t name_len;   /* length of the name, in wide-characters */
+	size_t val_len;    /* length of the value, in wide-characters */
+	size_t u8name_len; /* length of the name in UTF-8 */
+	size_t u8val_len;  /* length of the value in UTF-8 */
+};
+
+/* measure the variable in form 'name=value' (or just 'name') of _wenviron,
+  returns the size of its entry in the arena, 0 if the variable has no name,
+  or (size_t)-1 on error */
+static size_t utf8_env_measure(const wchar_t wname[], struct utf8_env_var_len *const l/*out*/)
+{
+	const wchar_t *const eq = wcschr(wname, L'=');
+	size_t e_sz;
+
+	l->name_len = eq ? (size_t)(eq - wname) : wcslen(wname);
+	if (!l->name_len)
+		return 0; /* no variable name */
+
+	l->val_len = eq ? wcslen(eq + 1) : 0;
+	if (l->name_len > (size_t)-1/16 || l->val_len > (size_t)-1/16 - l->name_len) {
+		errno = E2BIG;
+		return (size_t)-1;
+	}
+
+	l->u8name_len = utf8_env_u8_len(wname, l->name_len);
+	l->u8val_len = eq ? utf8_env_u8_len(eq + 1, l->val_len) : 0;
+	if ((size_t)-1 == l->u8name_len || (size_t)-1 == l->u8val_len) {
+		errno = EILSEQ;
+		return (size_t)-1;
+	}
+
+	/* the entry header and the 'name=value' string, aligned */
+	e_sz = OFFSETOF(struct utf8_env_entry, name_eq_value) +
+		l->u8name_len + 1/*'='*/ + l->u8val_len + 1/*'\0'*/;
+	return (e_sz + UTF8_ENV_ALIGN - 1) & ~(UTF8_ENV_ALIGN - 1);
 }
 
 static int utf8_env_create_(void)
 {
-	/* initialize the array */
-	wchar_t **v = _wenviron;
-	while (*v)
-		v++;
+	/* _wenviron is NULL after utf8_clearenv() */
+	wchar_t *no_env = NULL;
+	wchar_t **const wenv = _wenviron ? _wenviron : &no_env;
+	size_t arena_size = 0;
+	char *a;
+
+	/* compute the size of the arena */
+	wchar_t **v = wenv;
+	for (; *v; v++) {
+		struct utf8_env_var_len l;
+		const size_t e_sz = utf8_env_measure(*v, &l);
+		if ((size_t)-1 == e_sz)
+			return -1;
+		if (e_sz > (size_t)-1 - arena_size) {
+			errno = E2BIG;
+			return -1;
+		}
+		arena_size += e_sz;
+	}
 
-	utf8_env_size = (size_t)(v - _wenviron);
+	/* initialize the array */
+	utf8_env_size = (size_t)(v - wenv);
 	utf8_env = (char**)malloc(sizeof(*utf8_env)*(utf8_env_size + 1));
 	if (!utf8_env)
 		return -1;
 
-	for (v = _wenviron; *v; v++) {
-		struct utf8_env_entry *e;
-		const wchar_t *wname = *v;
-		const wchar_t *const eq = wcschr(wname, L'=');
-		const size_t name_len = eq ? (size_t)(eq - wname) : wcslen(wname);
-		size_t name_eq_val_u8_sz, e_sz;
-		unsigned idx;
-
-		if (!name_len)
-			continue; /* no variable name */
-
-		name_eq_val_u8_sz = utf16_to_utf8_z_size((const utf16_char_t**)&wname);
-		if (!name_eq_val_u8_sz)
-			break;
+	/* create the hash table with at least one bucket per variable */
+	if (utf8_env_tab_init(utf8_env_size))
+		return -1;
 
-		e_sz = OFFSETOF(struct utf8_env_entry, name) + !eq;
-		if (sizeof(*wname)*name_len > (size_t)-1 - e_sz ||
-			name_eq_val_u8_sz > (size_t)-1 - e_sz - sizeof(*wname)*name_len)
-			break;
+	utf8_env_arena = (char*)malloc(arena_size + !arena_size);
+	if (!utf8_env_arena)
+		return -1;
+	utf8_env_arena_size = arena_size;
 
-		e_sz += sizeof(*wname)*name_len + name_eq_val_u8_sz;
-		e = (struct utf8_env_entry*)malloc(e_sz);
-		if (!e)
-			break;
+	for (a = utf8_env_arena, v = wenv; *v; v++) {
+		struct utf8_env_entry *e = (struct utf8_env_entry*)a, **pe;
+		const wchar_t *const wname = *v;
+		struct utf8_env_var_len l;
+		const size_t e_sz = utf8_env_measure(wname, &l);
 
-		/* convert name to upper case */
-		name_to_upper(e->name, wname, name_len);
+		if (!e_sz)
+			continue; /* no variable name */
 
-		idx = utf8_env_tab_idx(e->name[0]);
-		e->next = utf8_env_tab[idx];
-		utf8_env_tab[idx] = e;
-		e->name_len = name_len;
-		{
-			char *name_eq_val_u8 = (char*)&e->name[name_len];
-			utf16_to_utf8_z_unsafe((const utf16_char_t*)wname, (utf8_char_t*)name_eq_val_u8);
-			if (eq)
-				e->u8name_len = (size_t)(strchr(name_eq_val_u8, '=') - name_eq_val_u8);
-			else {
-				e->u8name_len = name_eq_val_u8_sz - 1;
-				name_eq_val_u8[name_eq_val_u8_sz - 1] = '=';
-				name_eq_val_u8[name_eq_val_u8_sz] = '\0';
-			}
-			utf8_env[utf8_env_filled++] = name_eq_val_u8;
+		/* convert the variable to UTF-8 in place of the new entry, the name was validated */
+		utf16_to_utf8_unsafe((const utf16_char_t*)wname, (utf8_char_t*)e->name_eq_value, l.name_len);
+		e->name_eq_value[l.u8name_len] = '=';
+		utf16_to_utf8_unsafe((const utf16_char_t*)wname + l.name_len + 1,
+			(utf8_char_t*)e->name_eq_value + l.u8name_len + 1, l.val_len);
+		e->name_eq_value[l.u8name_len + 1 + l.u8val_len] = '\0';
+		(void)utf8_env_hash(e->name_eq_value, l.u8name_len, &e->hash);
+
+		pe = utf8_env_tab_count ? utf8_env_find(e->name_eq_value, l.u8name_len, e->hash) : NULL;
+		if (pe && UTF8_ENV_NO_IDX != (*pe)->idx)
+			continue; /* duplicate name */
+		a += e_sz;
+		e->u8name_len = l.u8name_len;
+		if (pe) {
+			/* the variable was cached by utf8_getenv() under the name as it was queried,
+			  replace the entry to list the name as it is spelled in the environment */
+			struct utf8_env_entry *const c = *pe;
+			e->next = c->next;
+			*pe = e;
+			c->next = utf8_env_retired;
+			utf8_env_retired = c;
 		}
+		else {
+			utf8_env_tab_grow();
+			utf8_env_insert(e);
+		}
+		e->idx = utf8_env_filled;
+		utf8_env[utf8_env_filled++] = e->name_eq_value;
 	}
 	utf8_env[utf8_env_filled] = NULL;
-	return *v ? -1 : 0;
+	return 0;
 }
 
 static void utf8_env_create(void)
@@ -165,6 +425,20 @@ char **utf8_environ(void)
 	return utf8_env;
 }
 
+void utf8_env_set_lazy(int lazy)
+{
+	utf8_env_lazy = lazy;
+}
+
+/* create the whole shadow environment or, in lazy mode, only the hash table */
+static void utf8_env_init(void)
+{
+	if (!utf8_env_lazy)
+		(void)utf8_environ();
+	else if (utf8_env_tab_init(0))
+		utf8_env_fatal();
+}
+
 int utf8_clearenv(void)
 {
 	utf8_env_shadow_reset();
@@ -172,198 +446,185 @@ int utf8_clearenv(void)
 	return 0;
 }
 
-static struct utf8_env_entry **utf8_env_lookup(const char name[])
+/* look up the variable in the real environment, the name is converted to UTF-16 only here,
+  returns NULL if the variable was not found or the name could not be converted */
+static const wchar_t *utf8_env_wgetenv(const char name[])
 {
-	unsigned idx;
-	struct utf8_env_entry **pe;
-	size_t name_sz = 0, name_len;
 	wchar_t name_buf[ENV_NAME_BUF_SIZE];
-	wchar_t *wname = *name ? CVT_UTF8_TO_16_Z_SZ(name, name_buf, &name_sz) : NULL;
+	wchar_t *const wname = CVT_UTF8_TO_16_Z(name, name_buf);
+	const wchar_t *wvalue;
 
 	if (!wname)
 		return NULL;
 
-	name_len = name_sz - 1; /* >0 */
+	wvalue = _wgetenv(wname);
 
-	/* convert name to upper case */
-	name_to_upper(wname, wname, name_len);
+	if (wname != name_buf)
+		free(wname);
+	return wvalue;
+}
 
-	idx = utf8_env_tab_idx(wname[0]);
+/* create an entry for the variable found by _wgetenv(),
+  name - the name of len bytes, as it was passed to utf8_getenv() */
+static struct utf8_env_entry *utf8_env_cache(const char name[], size_t len,
+	unsigned hash, const wchar_t wvalue[])
+{
+	struct utf8_env_entry *e;
+	size_t e_sz = OFFSETOF(struct utf8_env_entry, name_eq_value) + 1/*'='*/, u16sz;
 
-	/* lookup */
-	pe = &utf8_env_tab[idx];
-	for (; *pe; pe = &(*pe)->next) {
-		if ((*pe)->name_len == name_len &&
-			!memcmp((*pe)->name, wname, name_len*sizeof(*wname)))
-			break;
+	if (len > (size_t)-1 - e_sz) {
+		errno = E2BIG;
+		return NULL;
 	}
 
-	if (wname != name_buf)
-		free(wname);
-	return *pe ? pe : NULL;
+	/* reserve a space for the entry header, the name and '=' at head of allocated memory,
+	  convert the value in one call */
+	e_sz += len;
+	e = (struct utf8_env_entry*)cvt_utf16_to_8_z_reserve(wvalue, NULL, 0, &e_sz, &u16sz);
+	if (!e)
+		return NULL;
+
+	e->hash = hash;
+	e->idx = UTF8_ENV_NO_IDX;
+	e->u8name_len = len;
+	memcpy(e->name_eq_value, name, len);
+	e->name_eq_value[len] = '=';
+	return e;
 }
 
 static char *utf8_getenv_(const char name[])
 {
-	struct utf8_env_entry **pe = utf8_env_lookup(name);
-	if (pe) {
-		struct utf8_env_entry *e = *pe;
-		char *u8_value = (char*)&e->name[e->name_len] + e->u8name_len + 1/*'='*/;
-		return u8_value;
+	struct utf8_env_entry **pe, *e = NULL;
+	const size_t len = strlen(name);
+	unsigned hash;
+
+	if (!len || !utf8_env_hash(name, len, &hash))
+		return NULL;
+
+	pe = utf8_env_find(name, len, hash);
+	if (pe)
+		e = *pe;
+	else if (!utf8_env) {
+		/* the variable is not cached yet */
+		const wchar_t *const wvalue = utf8_env_wgetenv(name);
+		if (wvalue) {
+			e = utf8_env_cache(name, len, hash, wvalue);
+			if (!e)
+				utf8_env_fatal();
+			utf8_env_tab_grow();
+			utf8_env_insert(e);
+		}
 	}
-	return NULL;
+
+	return e ? e->name_eq_value + e->u8name_len + 1/*'='*/ : NULL;
 }
 
 A_Use_decl_annotations
 char *utf8_getenv(const char name[])
 {
-	(void)utf8_environ();
+	utf8_env_init();
 	return utf8_getenv_(name);
 }
 
 static int utf8_setenv_(const char name[], const char value[], int overwrite)
 {
-	unsigned idx;
+	unsigned hash;
 	struct utf8_env_entry **pe, *e;
-	size_t sz = 0, u8sz = 0, name_len, u8name_len, val_sz, u8val_sz;
+	const size_t u8name_len = strlen(name);
+	size_t e_sz = OFFSETOF(struct utf8_env_entry, name_eq_value) + 1/*'='*/, u8val_sz;
 	wchar_t name_buf[ENV_NAME_BUF_SIZE];
-	char *u8_name_eq_value;
-	wchar_t *wstr = *name ? CVT_UTF8_TO_16_Z_RESERVE(name, name_buf, &sz, &u8sz) : NULL;
-	size_t e_sz;
+	wchar_t *wstr;
 
-	if (!wstr) {
-		if (!*name)
-			errno = EINVAL;
+	if (!u8name_len || strchr(name, '=')) {
+		errno = EINVAL;
 		return -1;
 	}
 
-	name_len = sz - 1; /* >0 */
-
-	/* convert name to upper case */
-	name_to_upper(wstr, wstr, name_len);
-
-	idx = utf8_env_tab_idx(wstr[0]);
+	if (!utf8_env_hash(name, u8name_len, &hash)) {
+		errno = EILSEQ;
+		return -1;
+	}
 
 	/* lookup */
-	pe = &utf8_env_tab[idx];
-	for (; *pe; pe = &(*pe)->next) {
-		if ((*pe)->name_len == name_len &&
-			!memcmp((*pe)->name, wstr, name_len*sizeof(*wstr)))
-		{
-			if (!overwrite) {
-				if (wstr != name_buf)
-					free(wstr);
-				return 0;
-			}
-			break;
-		}
-	}
+	pe = utf8_env_find(name, u8name_len, hash);
+	if (!overwrite && (pe || (!utf8_env && utf8_env_wgetenv(name))))
+		return 0;
 
 	/* reserve a place in 'environ' array */
-	if (!*pe && utf8_env_filled == utf8_env_size) {
+	if (!pe && utf8_env && utf8_env_filled == utf8_env_size) {
 		if (utf8_env_size > (size_t)-1/sizeof(*utf8_env) - 1 - UTF8_ENV_REALLOC_BY) {
 			errno = E2BIG;
-			goto err_wstr;
+			return -1;
 		}
 		{
-			char **new_env = (char**)realloc(utf8_env,
+			char **const new_env = (char**)realloc(utf8_env,
 				sizeof(*utf8_env)*(utf8_env_size + UTF8_ENV_REALLOC_BY + 1));
 			if (!new_env)
-				goto err_wstr;
+				return -1;
 			utf8_env = new_env;
 		}
 		utf8_env_size += UTF8_ENV_REALLOC_BY;
 	}
 
 	/* create new entry */
-	e_sz = OFFSETOF(struct utf8_env_entry, name) + 1/*'='*/;
-	u8name_len = u8sz - 1; /* >0 */
 	u8val_sz = strlen(value) + 1;
-	if (sizeof(*wstr)*name_len > (size_t)-1 - e_sz ||
-		u8name_len > (size_t)-1 - e_sz - sizeof(*wstr)*name_len ||
-		u8val_sz > (size_t)-1 - e_sz - sizeof(*wstr)*name_len - u8name_len)
+	if (u8name_len > (size_t)-1 - e_sz ||
+		u8val_sz > (size_t)-1 - e_sz - u8name_len)
 	{
 		errno = E2BIG;
-		goto err_wstr;
+		return -1;
 	}
 
-	e_sz += sizeof(*wstr)*name_len + u8name_len + u8val_sz;
+	e_sz += u8name_len + u8val_sz;
 	e = (struct utf8_env_entry*)malloc(e_sz);
 	if (!e)
-		goto err_wstr;
+		return -1;
 
-	/* fill new entry */
+	/* fill new entry, the name is stored as it was passed */
+	e->hash = hash;
 	e->u8name_len = u8name_len;
-	e->name_len = name_len;
-	memcpy(e->name, wstr, sizeof(*wstr)*name_len);
-	u8_name_eq_value = (char*)&e->name[name_len];
-	utf16_to_utf8_unsafe((const utf16_char_t*)wstr, (utf8_char_t*)u8_name_eq_value, name_len);
-	u8_name_eq_value[u8name_len] = '=';
-	memcpy(u8_name_eq_value + u8name_len + 1, value, u8val_sz);
-
-	/* construct 'name=value' string for _wputenv() */
-	if (wstr != name_buf)
-		free(wstr);
-
-	/* reserve a space for 'name=' at head of dynamically allocated memory */
-	val_sz = name_len + 1/*L'='*/;
-	wstr = CVT_UTF8_TO_16_Z_RESERVE(value, name_buf, &val_sz, &u8sz);
+	memcpy(e->name_eq_value, name, u8name_len);
+	e->name_eq_value[u8name_len] = '=';
+	memcpy(e->name_eq_value + u8name_len + 1, value, u8val_sz);
 
+	/* convert 'name=value' string for _wputenv(),
+	  values may be long (e.g. PATH) - convert them in one pass */
+	wstr = CVT_UTF8_TO_16_Z_F(e->name_eq_value, name_buf, CVT_ONE_PASS);
 	if (!wstr)
 		goto err_e;
 
-	if (val_sz > (size_t)-1/sizeof(wchar_t) - 1 - name_len) {
-		errno = E2BIG;
-		goto err_e_wstr;
-	}
-
-	if (name_len + val_sz + 1 <= sizeof(name_buf)/sizeof(name_buf[0]))
-		memmove(wstr + name_len + 1, wstr, val_sz*sizeof(wstr[0]));
-	else if (wstr == name_buf) {
-		wchar_t *buf = (wchar_t*)malloc((name_len + val_sz + 1)*sizeof(*buf));
-		if (!buf)
-			goto err_e;
-		memcpy(buf + name_len + 1, wstr, val_sz);
-		wstr = buf;
-	}
-	/* fill reserved space */
-	memcpy(wstr, e->name, name_len*sizeof(e->name[0]));
-	wstr[name_len] = L'=';
-
 	if (_wputenv(wstr))
 		goto err_e_wstr;
 
 	if (wstr != name_buf)
 		free(wstr);
 
-	if (*pe) {
-		/* find and replace old entry */
-		char **old = utf8_env;
-		char *const old_name_eq_value = (char*)&(*pe)->name[(*pe)->name_len];
-		for (;; old++) {
-			if (*old == old_name_eq_value)
-				break;
-			if (!*old)
-				goto err_e; /* not expected */
-		}
-		*old = u8_name_eq_value;
+	if (pe) {
+		/* replace old entry in its slot */
+		e->idx = (*pe)->idx;
+		if (UTF8_ENV_NO_IDX != e->idx)
+			utf8_env[e->idx] = e->name_eq_value;
 		e->next = (*pe)->next;
-		free(*pe);
+		utf8_env_free(*pe);
+		*pe = e;
 	}
 	else {
-		utf8_env[utf8_env_filled++] = u8_name_eq_value;
-		e->next = NULL;
+		if (utf8_env) {
+			e->idx = utf8_env_filled;
+			utf8_env[utf8_env_filled++] = e->name_eq_value;
+			utf8_env[utf8_env_filled] = NULL;
+		}
+		else
+			e->idx = UTF8_ENV_NO_IDX;
+		utf8_env_tab_grow();
+		utf8_env_insert(e);
 	}
 
-	*pe = e;
 	return 0;
 
 err_e_wstr:
-	free(e);
-err_wstr:
 	if (wstr != name_buf)
 		free(wstr);
-	return -1;
 err_e:
 	free(e);
 	return -1;
@@ -372,36 +633,80 @@ err_e:
 A_Use_decl_annotations
 int utf8_setenv(const char name[], const char value[], int overwrite)
 {
-	(void)utf8_environ();
+	utf8_env_init();
 	return utf8_setenv_(name, value, overwrite);
 }
 
+/* delete the variable from the real environment, so that utf8_getenv()
+  will not find it there - needed only until utf8_environ() is called in lazy mode */
+static int utf8_env_wunsetenv(const char name[])
+{
+	size_t sz = 0;
+	wchar_t name_buf[ENV_NAME_BUF_SIZE];
+
+	/* leave a space for L'=' in the buffer */
+	wchar_t *wstr = cvt_utf8_to_16_z_sz(name, name_buf, sizeof(name_buf)/sizeof(name_buf[0]) - 1, &sz);
+	if (!wstr)
+		return -1;
+
+	if (wstr != name_buf) {
+		wchar_t *const w = (wchar_t*)realloc(wstr, (sz + 1)*sizeof(*wstr));
+		if (!w) {
+			free(wstr);
+			return -1;
+		}
+		wstr = w;
+	}
+
+	wstr[sz - 1] = L'=';
+	wstr[sz] = L'\0';
+	if (_wputenv(wstr)) {
+		if (wstr != name_buf)
+			free(wstr);
+		return -1;
+	}
+
+	if (wstr != name_buf)
+		free(wstr);
+	return 0;
+}
+
 static int utf8_unsetenv_(const char name[])
 {
-	struct utf8_env_entry **pe = utf8_env_lookup(name);
+	struct utf8_env_entry **pe;
+	const size_t len = strlen(name);
+	unsigned hash;
+
+	if (!len || strchr(name, '=')) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!utf8_env_hash(name, len, &hash)) {
+		errno = EILSEQ;
+		return -1;
+	}
+
+	if (!utf8_env && utf8_env_wunsetenv(name))
+		return -1;
+
+	pe = utf8_env_find(name, len, hash);
 	if (pe) {
 		struct utf8_env_entry *e = *pe;
-		char *old_name_eq_value = (char*)&e->name[e->name_len];
-
-		/* find and remove old entry */
-		char **old = utf8_env;
-		for (;; old++) {
-			if (*old == old_name_eq_value)
-				break;
-			if (!*old)
-				return -1; /* not expected */
-		}
 
-		{
-			char **end = old + 1;
-			while (*end)
-				end++;
-			memmove(old, old + 1, (size_t)(end - old)*sizeof(*old));
+		if (UTF8_ENV_NO_IDX != e->idx) {
+			/* move the last string to the slot of removed one */
+			const size_t last = --utf8_env_filled;
+			if (e->idx != last) {
+				utf8_env[e->idx] = utf8_env[last];
+				utf8_env_entry_of(utf8_env[e->idx])->idx = e->idx;
+			}
+			utf8_env[last] = NULL;
 		}
 
 		*pe = e->next;
-		free(e);
-		utf8_env_filled--;
+		utf8_env_free(e);
+		utf8_env_tab_count--;
 	}
 	return 0;
 }
@@ -409,6 +714,6 @@ static int utf8_unsetenv_(const char name[])
 A_Use_decl_annotations
 int utf8_unsetenv(const char name[])
 {
-	(void)utf8_environ();
+	utf8_env_init();
 	return utf8_unsetenv_(name);
 }
@@ -12,6 +12,7 @@
 #include <errno.h>
 
 #include "mscrtx/localerpl.h"
+#include "mscrtx/utf16cvt.h"
 #include "mscrtx/xstat.h" /* xpathwc */
 #include "mscrtx/wreadlink.h"
 
@@ -177,7 +178,24 @@ int readlinkfd(void *h, char buf[], const size_t bufsz)
 	USHORT link_len;
 	REPARSE_DATA_BUF *dyn_rdb = NULL;
 	const WCHAR *const link = readlink_ioctl((HANDLE)h, &u.buf, sizeof(u), &dyn_rdb, &link_len);
-	if (link) {
+	if (link && localerpl_is_utf8()) {
+		size_t converted = link_len;
+		if (converted) {
+			char *const u8link = cvt_utf16_to_8(link, &converted, buf, bufsz);
+			if (u8link != buf) {
+				if (u8link) {
+					free(u8link);
+					errno = ERANGE;
+				}
+				goto err;
+			}
+		}
+		if (converted <= INT_MAX)
+			ret = (int)converted;
+		else
+			errno = ENAMETOOLONG;
+	}
+	else if (link) {
 		/* Convert wide-character path to multibyte string.  */
 		const size_t converted = wcstombs(buf, link, bufsz);
 		if ((size_t)-1 != converted) {
@@ -0,0 +1,10 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* io.h */
+
+/* Stand-in for the header of the Microsoft's CRT, included by mscrtx/localerpl.h,
+  to build tests of platform-independent parts of the library on other systems.  */
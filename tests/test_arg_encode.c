@@ -0,0 +1,192 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_arg_encode.c */
+
+/* Round-trip test of the command line encoder (arg_encode_command_line() and
+  arg_encode_command_line_utf8()): random argument vectors are encoded, then tokenized
+  back - the arguments must be the same, and the command line must be no longer than
+  with the usual quoting.  Also benchmark of encoding of many arguments.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mscrtx/arg_tokenizer.h"
+#include "mscrtx/utf16cvt.h"
+#define TEST_SEED 3
+#include "test_util.h"
+
+/* Length of the argument quoted the usual way: enclosed in double-quotes if it is
+  empty or contains spaces or tabs, double-quotes and backslashes before them - escaped.  */
+static size_t usual_len(const wchar_t arg[], const int is_name)
+{
+	const size_t n = wlen(arg);
+	size_t i, bs = 0, escaped = 0;
+	int quote = !n;
+	for (i = 0; i < n; i++) {
+		if (L' ' == arg[i] || L'\t' == arg[i])
+			quote = 1;
+	}
+	if (is_name)
+		return n + (quote ? 2 : 0);
+	for (i = 0; i < n; i++) {
+		if (L'\\' == arg[i])
+			bs++;
+		else {
+			if (L'"' == arg[i])
+				escaped += bs + 1;
+			bs = 0;
+		}
+	}
+	return n + escaped + (quote ? 2 + bs : 0);
+}
+
+/* Tokenize the command line, compare with n arguments.
+   Returns 0 on mismatch.  */
+static int check_line(const wchar_t line[], wchar_t *const argv[], const unsigned n)
+{
+	struct arg_tok_buf tb = {NULL, 0, 0, 0};
+	const wchar_t *p = line;
+	unsigned k;
+	int ok = 1;
+	for (k = 0; k < n && ok; k++) {
+		size_t sz;
+		if (k)
+			p = arg_skip_spaces(p);
+		tb.filled = 0;
+		sz = k ? arg_tokenize_arg(&p, &tb) : arg_tokenize_module_name(&p, &tb);
+		ok = sz == wlen(argv[k]) && !memcmp(tb.buf, argv[k], sz*sizeof(wchar_t));
+	}
+	if (*arg_skip_spaces(p))
+		ok = 0;
+	free(tb.buf);
+	return ok;
+}
+
+/* Check the encoding of known arguments and errors.
+   Returns the number of failures.  */
+static unsigned check_fixed(void)
+{
+	static const char expected[] = "\"C:\\Program Files\\x.exe\" \"a b\\\\\" \"\" x\\\\\\\"y c:\\dir\\";
+	const char *const args[] = {"C:\\Program Files\\x.exe", "a b\\", "", "x\\\"y", "c:\\dir\\", NULL};
+	static const wchar_t quoted_name[] = {L'"', L'a', L'"', 0};
+	const wchar_t *const wv[] = {quoted_name, NULL};
+	const char *const bad1[] = {"p", "\xC3", NULL};
+	const char *const bad2[] = {"\xF0\x9F\x98", NULL};
+	const char *const empty[] = {NULL};
+	unsigned fails = 0;
+	wchar_t *line = arg_encode_command_line_utf8(args);
+	size_t i;
+	for (i = 0; line && line[i] && (unsigned char)expected[i] == line[i]; i++);
+	fails += !line || expected[i] || line[i];
+	free(line);
+	errno = 0;
+	fails += NULL != arg_encode_command_line(wv) || EINVAL != errno;
+	errno = 0;
+	fails += NULL != arg_encode_command_line_utf8(bad1) || EILSEQ != errno;
+	errno = 0;
+	fails += NULL != arg_encode_command_line_utf8(bad2) || EILSEQ != errno;
+	line = arg_encode_command_line_utf8(empty);
+	fails += !line || line[0];
+	free(line);
+	if (fails)
+		printf("fixed cases: %u failures\n", fails);
+	return fails;
+}
+
+/* Encode n UTF-8 arguments, some with spaces, double-quotes and backslashes.  */
+static unsigned bench(const unsigned n)
+{
+	static const char *const samples[] = {
+		"-o", "C:\\Program Files\\dir\\file.txt", "--name=value", "say \"hi\"",
+		"c:\\dir\\", "\xD1\x84\xD0\xB0\xD0\xB9\xD0\xBB.txt", ""
+	};
+	const char **const argv = (const char**)malloc((n + 1)*sizeof(*argv));
+	wchar_t *line;
+	unsigned i;
+	double t;
+	if (!argv)
+		return 1;
+	for (i = 0; i < n; i++)
+		argv[i] = samples[i % (sizeof(samples)/sizeof(samples[0]))];
+	argv[0] = "prog";
+	argv[n] = NULL;
+	t = seconds();
+	line = arg_encode_command_line_utf8(argv);
+	t = seconds() - t;
+	if (line) {
+		printf("%u arguments encoded in %.3f s, %.1f ns per argument, %u characters\n",
+			n, t, t*1e9/n, (unsigned)wlen(line));
+	}
+	free(line);
+	free(argv);
+	return !line;
+}
+
+int main(void)
+{
+	/* double backslashes and surrogate pairs are more likely */
+	static const wchar_t alphabet[] = {
+		L'a', L' ', L'\t', L'"', L'\\', L'\\', 0xE9, 0xD83D, 0x4E2D, L'b'
+	};
+	wchar_t *argv[8];
+	char *u8[8];
+	unsigned fails = 0, it;
+	for (it = 0; it < 300000; it++) {
+		const unsigned n = rnd(7);
+		const unsigned len = it % 1000 ? 8 : 3000; /* long arguments sometimes */
+		size_t usual = 1;
+		wchar_t *line, *line8;
+		unsigned i;
+		for (i = 0; i < n; i++) {
+			const unsigned m = rnd(len);
+			unsigned j, k = 0;
+			argv[i] = (wchar_t*)malloc((2*m + 1)*sizeof(wchar_t));
+			if (!argv[i])
+				return 2;
+			for (j = 0; j < m; j++) {
+				wchar_t c = alphabet[rnd(sizeof(alphabet)/sizeof(alphabet[0]))];
+				if (!i && L'"' == c)
+					c = L'x'; /* the program name cannot contain double-quotes */
+				if (0xD83D == c) {
+					argv[i][k++] = c;
+					c = 0xDE00;
+				}
+				argv[i][k++] = c;
+			}
+			argv[i][k] = L'\0';
+			usual += usual_len(argv[i], !i) + (i != 0);
+			u8[i] = cvt_utf16_to_8_z(argv[i], NULL, 0);
+			if (!u8[i])
+				return 2;
+		}
+		argv[n] = NULL;
+		u8[n] = NULL;
+		line = arg_encode_command_line((const wchar_t *const*)argv);
+		line8 = arg_encode_command_line_utf8((const char *const*)u8);
+		if (!line || !line8 || wlen(line) != wlen(line8) ||
+			memcmp(line, line8, wlen(line)*sizeof(wchar_t)) ||
+			wlen(line) + 1 > usual || !check_line(line, argv, n))
+		{
+			printf("random vector %u: mismatch\n", it);
+			fails++;
+		}
+		free(line);
+		free(line8);
+		for (i = 0; i < n; i++) {
+			free(argv[i]);
+			free(u8[i]);
+		}
+		if (fails > 10)
+			break;
+	}
+	fails += check_fixed();
+	fails += bench(1000000);
+	printf("test_arg_encode: %u failures\n", fails);
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,265 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_arg_glob.c */
+
+/* Test of wildcard expansion (src/arg_glob.c) with the readdir() backend on a directory
+  tree created in a temporary directory, and benchmark of the enumeration of a directory
+  with many entries (100000 by default, the number may be passed as the argument).  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mscrtx/arg_glob.h"
+#include "test_util.h"
+
+/* glibc wcslen() expects 4-byte wchar_t, while the library is built with -fshort-wchar.  */
+size_t wcslen(const wchar_t *s)
+{
+	const wchar_t *e = s;
+	while (*e)
+		e++;
+	return (size_t)(e - s);
+}
+
+/* Stand-ins for unicode_ctype: only ASCII and Latin-1 letters are converted,
+  enough for the names used here.  */
+unsigned unicode_toupper(unsigned c)
+{
+	if (c - 'a' <= 'z' - 'a' || (c - 0xE0 <= 0xFE - 0xE0 && 0xF7 != c))
+		return c - 0x20;
+	return c;
+}
+
+unsigned unicode_tolower(unsigned c)
+{
+	if (c - 'A' <= 'Z' - 'A' || (c - 0xC0 <= 0xDE - 0xC0 && 0xD7 != c))
+		return c + 0x20;
+	return c;
+}
+
+/* Names are ASCII or Latin-1.  */
+static void to_wide(wchar_t w[], const char s[])
+{
+	while ('\0' != (*w++ = (unsigned char)*s++));
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(char *const*)a, *(char *const*)b);
+}
+
+/* Backend that lists the same files in any directory, for patterns with a drive.  */
+static const char *const mem_files[] = {".", "..", "a.txt", "b.c", "\xE9.txt"};
+
+static int mem_next(void *const handle, wchar_t name[ARG_FIND_NAME_MAX], unsigned *const attrs)
+{
+	size_t *const i = (size_t*)handle;
+	if (*i == sizeof(mem_files)/sizeof(mem_files[0]))
+		return 0;
+	to_wide(name, mem_files[(*i)++]);
+	*attrs = 0;
+	return 1;
+}
+
+static void *mem_first(const wchar_t pattern[], wchar_t name[ARG_FIND_NAME_MAX], unsigned *const attrs)
+{
+	static size_t i;
+	const size_t len = wcslen(pattern);
+	if (!len || L'*' != pattern[len - 1])
+		return NULL;
+	i = 0;
+	mem_next(&i, name, attrs);
+	return &i;
+}
+
+static void mem_close(void *const handle)
+{
+	(void)handle;
+}
+
+static const struct arg_find_backend mem_backend = {mem_first, mem_next, mem_close};
+
+/* Expand the pattern, compare sorted names with the expected ones, separated by '|'.
+   Returns 0 on mismatch.  */
+static int check_with(const struct arg_find_backend *const backend,
+	const char pattern[], const char expected[])
+{
+	static wchar_t wpattern[512];
+	static char names[8192];
+	char *found[64];
+	struct arg_tok_buf tb = {NULL, 0, 0, 0};
+	size_t count, i, k = 0;
+	int matched, ok = 1;
+	const wchar_t *n;
+	to_wide(wpattern, pattern);
+	count = arg_expand_wildcard(backend, wpattern, &tb, &matched);
+	if ((size_t)-1 == count || count > sizeof(found)/sizeof(found[0]) || matched != (count != 0)) {
+		printf("%s: expansion failed\n", pattern);
+		free(tb.buf);
+		return 0;
+	}
+	/* names are ASCII or Latin-1 */
+	for (i = 0, n = tb.buf; i < count; i++, n += wcslen(n) + 1) {
+		found[i] = names + k;
+		do
+			names[k++] = (char)*n;
+		while (*n++);
+		n--;
+	}
+	qsort(found, count, sizeof(found[0]), cmp_str);
+	for (i = 0, k = 0; i < count; i++) {
+		const size_t len = strlen(found[i]);
+		if ((i && '|' != expected[k++]) || strncmp(expected + k, found[i], len)) {
+			ok = 0;
+			break;
+		}
+		k += len;
+	}
+	if (!ok || expected[k]) {
+		printf("%s: mismatch, found:", pattern);
+		for (i = 0; i < count; i++)
+			printf(" %s", found[i]);
+		printf("\n");
+		ok = 0;
+	}
+	free(tb.buf);
+	return ok;
+}
+
+static int check(const char pattern[], const char expected[])
+{
+	return check_with(&arg_readdir_find_backend, pattern, expected);
+}
+
+static void create_file(const char path[])
+{
+	FILE *const f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		exit(2);
+	}
+	fclose(f);
+}
+
+static unsigned test_tree(void)
+{
+	static const char *const files[] = {
+		"t/a.c", "t/b.c", "t/c.txt", "t/.hidden.c",
+		"t/sub/d.c", "t/sub/deep/e.c", "t/sub/deep/f.txt", "t/other/g.c"
+	};
+	unsigned fails = 0, i;
+	if (mkdir("t", 0755) || mkdir("t/sub", 0755) || mkdir("t/sub/deep", 0755) ||
+		mkdir("t/other", 0755) || symlink("sub", "t/link"))
+	{
+		perror("mkdir");
+		exit(2);
+	}
+	for (i = 0; i < sizeof(files)/sizeof(files[0]); i++)
+		create_file(files[i]);
+
+	fails += !check("t/*.c", "t/.hidden.c|t/a.c|t/b.c");
+	fails += !check("t\\*.txt", "t\\c.txt");
+	fails += !check("t/[AB].C", "t/a.c|t/b.c");
+	fails += !check("t/?.*", "t/a.c|t/b.c|t/c.txt");
+	fails += !check("t/{a,c}.*", "t/a.c|t/c.txt");
+	fails += !check("t/*/d.c", "t/link/d.c|t/sub/d.c");
+	fails += !check("t/*/", "t/link/|t/other/|t/sub/");
+	fails += !check("t/**/*.c", "t/.hidden.c|t/a.c|t/b.c|t/other/g.c|t/sub/d.c|t/sub/deep/e.c");
+	fails += !check("t/**/*.txt", "t/c.txt|t/sub/deep/f.txt");
+	fails += !check("t/sub/**", "t/sub/d.c|t/sub/deep|t/sub/deep/e.c|t/sub/deep/f.txt");
+	fails += !check("t/s*/deep/?.c", "t/sub/deep/e.c");
+	fails += !check("t/*.none", "");
+	fails += !check("t/none/*", "");
+
+	/* the drive is not matched against file names */
+	fails += !check_with(&mem_backend, "C:*.txt", "C:a.txt|C:\xE9.txt");
+	fails += !check_with(&mem_backend, "c:?.*", "c:a.txt|c:b.c|c:\xE9.txt");
+	fails += !check_with(&mem_backend, "C:\\*.c", "C:\\b.c");
+	fails += !check_with(&mem_backend, "\\\\?\\C:*.c", "\\\\?\\C:b.c");
+
+	/* non-ASCII letters are case-insensitive in the "C" locale too */
+	fails += !check_with(&mem_backend, "C:\xC9*.txt", "C:\xE9.txt");
+	fails += !check_with(&mem_backend, "C:[\xC0-\xCF]*", "C:\xE9.txt");
+	fails += !check_with(&mem_backend, "C:[!\xC9]*.txt", "C:a.txt");
+
+	/* no character classes, unlike localerpl_fnmatch() */
+	fails += !check_with(&mem_backend, "C:[:alpha:]*", "C:a.txt");
+	fails += !check_with(&mem_backend, "C:[[:alpha:]]*", "");
+
+	for (i = 0; i < sizeof(files)/sizeof(files[0]); i++)
+		remove(files[i]);
+	remove("t/link");
+	remove("t/sub/deep");
+	remove("t/sub");
+	remove("t/other");
+	remove("t");
+	return fails;
+}
+
+/* Create the directory "big" with n entries, expand all of them, then only "f*7.dat".  */
+static unsigned bench_big_dir(const unsigned n)
+{
+	static wchar_t all[] = {'b', 'i', 'g', '/', '*', 0};
+	static wchar_t some[] = {'b', 'i', 'g', '/', 'f', '*', '7', '.', 'd', 'a', 't', 0};
+	char path[64];
+	struct arg_tok_buf tb = {NULL, 0, 0, 0};
+	unsigned fails = 0, i, expect_some = 0;
+	size_t count;
+	int matched;
+	double t;
+	if (mkdir("big", 0755)) {
+		perror("mkdir");
+		exit(2);
+	}
+	for (i = 0; i < n; i++) {
+		sprintf(path, "big/f%u.dat", i);
+		create_file(path);
+		expect_some += 7 == i % 10;
+	}
+
+	t = seconds();
+	count = arg_expand_wildcard(&arg_readdir_find_backend, all, &tb, &matched);
+	t = seconds() - t;
+	printf("\"big/*\": %u entries in %.3f s, %.0f ns per entry, %.1f MB of names\n",
+		n, t, t*1e9/n, (double)tb.filled*sizeof(wchar_t)/(1 << 20));
+	fails += count != n;
+
+	tb.filled = 0;
+	t = seconds();
+	count = arg_expand_wildcard(&arg_readdir_find_backend, some, &tb, &matched);
+	t = seconds() - t;
+	printf("\"big/f*7.dat\": %u of %u entries in %.3f s\n", (unsigned)count, n, t);
+	fails += count != expect_some;
+
+	free(tb.buf);
+	for (i = 0; i < n; i++) {
+		sprintf(path, "big/f%u.dat", i);
+		remove(path);
+	}
+	remove("big");
+	return fails;
+}
+
+int main(int argc, char *argv[])
+{
+	const unsigned n = argc > 1 ? (unsigned)atoi(argv[1]) : 100000u;
+	char dir[] = "/tmp/test_arg_glob.XXXXXX";
+	unsigned fails = 0;
+	if (!mkdtemp(dir) || chdir(dir)) {
+		perror(dir);
+		return 2;
+	}
+	fails += test_tree();
+	fails += bench_big_dir(n);
+	if (chdir("/") || rmdir(dir))
+		perror(dir);
+	printf("test_arg_glob: %u failures\n", fails);
+	return fails ? 1 : 0;
+}
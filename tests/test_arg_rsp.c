@@ -0,0 +1,278 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_arg_rsp.c */
+
+/* Test of response files: arg_rsp_decode() on files written to disk in UTF-8 (with
+  and without BOM), UTF-16LE and UTF-16BE, and arg_tokenize_rsp_arg() against the command
+  line tokenizer - on the same text, where newlines are replaced by spaces.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mscrtx/arg_tokenizer.h"
+#define TEST_SEED 7
+#include "test_util.h"
+
+#define ENC_UTF8     0
+#define ENC_UTF8_BOM 1
+#define ENC_UTF16LE  2
+#define ENC_UTF16BE  3
+
+/* Encode n utf16 characters of the text, surrogates must be paired.
+   Returns the number of bytes stored to out.  */
+static size_t encode(const wchar_t text[], const size_t n, const int enc, unsigned char out[])
+{
+	size_t k = 0, i;
+	if (ENC_UTF8_BOM == enc) {
+		out[k++] = 0xEF;
+		out[k++] = 0xBB;
+		out[k++] = 0xBF;
+	}
+	else if (ENC_UTF16LE == enc) {
+		out[k++] = 0xFF;
+		out[k++] = 0xFE;
+	}
+	else if (ENC_UTF16BE == enc) {
+		out[k++] = 0xFE;
+		out[k++] = 0xFF;
+	}
+	for (i = 0; i < n; i++) {
+		unsigned c = text[i];
+		if (ENC_UTF16LE == enc || ENC_UTF16BE == enc) {
+			out[k++] = (unsigned char)(ENC_UTF16LE == enc ? c & 0xFF : c >> 8);
+			out[k++] = (unsigned char)(ENC_UTF16LE == enc ? c >> 8 : c & 0xFF);
+		}
+		else if (c < 0x80)
+			out[k++] = (unsigned char)c;
+		else if (c < 0x800) {
+			out[k++] = (unsigned char)(0xC0 | c >> 6);
+			out[k++] = (unsigned char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0xD800 || c > 0xDFFF) {
+			out[k++] = (unsigned char)(0xE0 | c >> 12);
+			out[k++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+			out[k++] = (unsigned char)(0x80 | (c & 0x3F));
+		}
+		else {
+			c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00u);
+			out[k++] = (unsigned char)(0xF0 | c >> 18);
+			out[k++] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+			out[k++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+			out[k++] = (unsigned char)(0x80 | (c & 0x3F));
+		}
+	}
+	return k;
+}
+
+/* Write size bytes to a temporary file, read them back and decode.
+   Returns arg_rsp_decode() result.  */
+static wchar_t *decode_file(const unsigned char data[], const size_t size)
+{
+	static unsigned char buf[40000];
+	wchar_t *text = NULL;
+	FILE *const f = tmpfile();
+	if (!f) {
+		perror("tmpfile");
+		exit(2);
+	}
+	if (size != fwrite(data, 1, size, f) || fflush(f) || fseek(f, 0, SEEK_SET))
+		perror("fwrite");
+	else {
+		const size_t got = fread(buf, 1, sizeof(buf), f);
+		if (got != size)
+			perror("fread");
+		else
+			text = arg_rsp_decode(got ? buf : NULL, got);
+	}
+	fclose(f);
+	return text;
+}
+
+/* Tokenize the decoded text of the response file and the same text, with newlines
+  replaced by spaces, as command-line arguments - results must be the same.
+   Returns 0 on mismatch.  */
+static int check_tokens(const wchar_t text[])
+{
+	static wchar_t line[20000];
+	struct arg_tok_buf t1 = {NULL, 0, 0, 0};
+	struct arg_tok_buf t2 = {NULL, 0, 0, 0};
+	const wchar_t *r = text, *l = line;
+	size_t i = 0;
+	int ok = 1;
+	/* arg_tokenize_arg() is never called at the start of the command line */
+	line[i++] = L'p';
+	line[i++] = L' ';
+	for (; *r; r++)
+		line[i++] = (L'\r' == *r || L'\n' == *r) ? L' ' : *r;
+	line[i] = L'\0';
+	r = text;
+	l = line + 2;
+	for (;;) {
+		size_t s1, s2, j;
+		r = arg_skip_rsp_spaces(r);
+		l = arg_skip_spaces(l);
+		if (!*r || !*l) {
+			ok = !*r && !*l;
+			break;
+		}
+		s1 = arg_tokenize_rsp_arg(&r, &t1);
+		s2 = arg_tokenize_arg(&l, &t2);
+		if ((size_t)-1 == s1 || s1 != s2 || (size_t)(r - text) + 2 != (size_t)(l - line)) {
+			ok = 0;
+			break;
+		}
+		/* newlines inside double-quotes are kept */
+		for (j = 0; j < s1; j++) {
+			const wchar_t c = t1.buf[t1.filled - s1 - 1 + j];
+			if ((L'\r' == c || L'\n' == c ? L' ' : c) != t2.buf[t2.filled - s2 - 1 + j])
+				ok = 0;
+		}
+		if (!ok)
+			break;
+	}
+	free(t1.buf);
+	free(t2.buf);
+	return ok;
+}
+
+/* Check that the file decodes to the expected arguments, separated by '|'.  */
+static int check_file(const char bytes[], const size_t size,
+	const char *const expected/*NULL?*/, const int err)
+{
+	wchar_t *const text = decode_file((const unsigned char*)bytes, size);
+	struct arg_tok_buf tb = {NULL, 0, 0, 0};
+	const wchar_t *r = text;
+	size_t k = 0;
+	int ok = 1, n = 0;
+	if (!expected) {
+		ok = !text && err == errno;
+		free(text);
+		return ok;
+	}
+	if (!text)
+		return 0;
+	for (;;) {
+		size_t sz, j;
+		r = arg_skip_rsp_spaces(r);
+		if (!*r)
+			break;
+		if (n++ && '|' != expected[k++]) {
+			ok = 0;
+			break;
+		}
+		sz = arg_tokenize_rsp_arg(&r, &tb);
+		for (j = 0; j < sz; j++) {
+			if ((unsigned char)expected[k++] != tb.buf[tb.filled - sz - 1 + j])
+				ok = 0;
+		}
+	}
+	if (expected[k])
+		ok = 0;
+	free(tb.buf);
+	free(text);
+	return ok;
+}
+
+int main(void)
+{
+	static const wchar_t alphabet[] = {
+		L'a', L'b', L' ', L'\t', L'"', L'\\', L'*', L'\r', L'\n', 0xE9, 0x4E2D, 0xD83D, L'x'
+	};
+#define BYTES(s) s, sizeof(s) - 1
+	static const struct {
+		const char *bytes;
+		size_t size;
+		const char *expected; /* NULL if decoding fails */
+		int err;
+	} files[] = {
+		{BYTES(""), "", 0},
+		{BYTES("\xEF\xBB\xBF"), "", 0},
+		{BYTES("a b\r\nc\n\n\t d"), "a|b|c|d", 0},
+		{BYTES("\xEF\xBB\xBF" "\"a b\"\r\n\"c\nd\" e\\\"f"), "a b|c\nd|e\"f", 0},
+		{BYTES("\"\"\n\"\""), "|", 0},
+		{BYTES("\xFF\xFE" "a\0 \0b\0"), "a|b", 0},
+		{BYTES("\xFE\xFF\0a\0\n\0b"), "a|b", 0},
+		{BYTES("\xFF\xFE" "a\0b"), NULL, EILSEQ},  /* odd size */
+		{BYTES("a\xFF" "b"), NULL, EILSEQ},        /* invalid UTF-8 */
+		{BYTES("\xED\xA0\x80"), NULL, EILSEQ},     /* encoded surrogate */
+		{BYTES("a b\0c"), NULL, EILSEQ},          /* null characters */
+		{BYTES("a b\0"), NULL, EILSEQ},
+		{BYTES("\xFF\xFE" "a\0\0\0c\0"), NULL, EILSEQ},
+		{BYTES("\xFE\xFF\0a\0\0"), NULL, EILSEQ},
+		{BYTES("\xFF\xFE" "\x3D\xD8"), NULL, EILSEQ}, /* unpaired surrogates */
+		{BYTES("\xFF\xFE" "\x3D\xD8" "a\0"), NULL, EILSEQ},
+		{BYTES("\xFF\xFE" "\x3D\xD8\x3D\xD8\x00\xDE"), NULL, EILSEQ},
+		{BYTES("\xFF\xFE" "a\0\x00\xDE"), NULL, EILSEQ},
+		{BYTES("\xFE\xFF\xDE\x00\xD8\x3D"), NULL, EILSEQ}
+	};
+	static wchar_t content[5000];
+	static unsigned char bytes[20000];
+	unsigned fails = 0, it;
+
+	for (it = 0; it < sizeof(files)/sizeof(files[0]); it++) {
+		if (!check_file(files[it].bytes, files[it].size, files[it].expected, files[it].err)) {
+			printf("file %u: mismatch\n", it);
+			fails++;
+		}
+	}
+
+	/* a null character or an unpaired surrogate anywhere makes the contents invalid */
+	for (it = 0; it < 4*8*5; it++) {
+		static const wchar_t bad[] = {0, 0xD800, 0xDBFF, 0xDC00, 0xDFFF};
+		const int enc = (int)(it % 4);
+		const wchar_t c = bad[it/32];
+		wchar_t *text;
+		if (c && enc != ENC_UTF16LE && enc != ENC_UTF16BE)
+			continue; /* surrogates cannot be encoded in UTF-8 */
+		memcpy(content, L"ab c\xE9\x4E2Dxy", 8*sizeof(wchar_t));
+		content[it/4 % 8] = c;
+		errno = 0;
+		text = decode_file(bytes, encode(content, 8, enc, bytes));
+		if (text || EILSEQ != errno) {
+			printf("invalid character 0x%x at %u, encoding %d: not detected\n",
+				(unsigned)c, it/4 % 8, enc);
+			fails++;
+		}
+		free(text);
+	}
+
+	for (it = 0; it < 4000; it++) {
+		const size_t n = rnd(it % 20 ? 40 : 3000);
+		const int enc = (int)(it % 4);
+		size_t i, size;
+		wchar_t *text;
+		for (i = 0; i < n; i++) {
+			const wchar_t c = alphabet[rnd(sizeof(alphabet)/sizeof(alphabet[0]))];
+			if (0xD83D != c)
+				content[i] = c;
+			else if (i + 1 < n) {
+				content[i++] = c;
+				content[i] = 0xDE00;
+			}
+			else
+				content[i] = L'y';
+		}
+		content[n] = L'\0';
+		size = encode(content, n, enc, bytes);
+		text = decode_file(bytes, size);
+		if (!text || wlen(text) != n || memcmp(text, content, n*sizeof(wchar_t)) ||
+			!check_tokens(text))
+		{
+			printf("random file %u, encoding %d: mismatch\n", it, enc);
+			if (++fails > 10) {
+				free(text);
+				break;
+			}
+		}
+		free(text);
+	}
+
+	printf("test_arg_rsp: %u failures\n", fails);
+	return fails ? 1 : 0;
+}
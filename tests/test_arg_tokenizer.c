@@ -0,0 +1,453 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_arg_tokenizer.c */
+
+/* Differential test of the command line tokenizer (src/arg_tokenizer.c) against
+  the original tokenizer of arg_parser.c, which is kept here as the reference.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __unix__
+#include <sys/mman.h>
+#endif
+
+#include "mscrtx/arg_tokenizer.h"
+#include "test_util.h"
+
+/* Reference implementation: parse_module_name() and parse_one_arg() of
+  the original arg_parser.c, writing up to sz wide-characters to dst.  */
+
+/* The tokenizer is called from another translation unit, so for a fair comparison
+  do not let the compiler inline the reference functions into the benchmark loop.  */
+#define REF_NOINLINE __attribute__((noinline))
+
+static wchar_t *copy_to(wchar_t d[], wchar_t *const e,
+	const wchar_t *const b, const wchar_t *const t)
+{
+	const size_t copy = (size_t)(t - b);
+	if (!copy)
+		return d;
+	if (copy > (size_t)(e - d))
+		return e;
+	return (wchar_t*)memcpy(d, b, copy*sizeof(*b)) + copy;
+}
+
+REF_NOINLINE static size_t ref_parse_module_name(const wchar_t **const line, wchar_t dst[], const size_t sz)
+{
+	const wchar_t *w = *line;
+	const wchar_t *b = w;
+	wchar_t *d = dst;
+	wchar_t *const e = d + sz;
+	size_t skipped = 0;
+	for (;;) {
+		switch (*w) {
+			default:
+				w++;
+				continue;
+			case L'\0':case L' ':case L'\t':case L'"':
+				d = copy_to(d, e, b, w);
+				if (L'"' != *w)
+					break;
+				skipped++;
+				for (b = ++w;;) {
+					switch (*w) {
+						default:
+							w++;
+							continue;
+						case L'\0':case L'"':
+							break;
+					}
+					break;
+				}
+				d = copy_to(d, e, b, w);
+				if (L'\0' == *w)
+					break;
+				skipped++;
+				b = ++w;
+				continue;
+		}
+		break;
+	}
+	{
+		const size_t name_sz = (size_t)(w - *line) - skipped;
+		*line = w;
+		return name_sz;
+	}
+}
+
+REF_NOINLINE static size_t ref_parse_one_arg(const wchar_t **const line, wchar_t dst[], const size_t sz)
+{
+	const wchar_t *w = *line;
+	const wchar_t *b = w, *t;
+	wchar_t *d = dst;
+	wchar_t *const e = d + sz;
+	size_t skipped = 0;
+	for (;;) {
+		switch (*w) {
+			default:
+				w++;
+				continue;
+			case L'\\': {
+				const wchar_t *const bs = w;
+				while (L'\\' == *++w);
+				if (L'"' != *w)
+					continue;
+				t = w - ((size_t)(w - bs) + 1)/2;
+				skipped += (size_t)(w - t);
+				if (1u & (size_t)(w - bs)) {
+					d = copy_to(d, e, b, t);
+					b = w++;
+					continue;
+				}
+				goto dquote;
+			}
+			case L'\0':case L' ':case L'\t':case L'"':
+				t = w;
+dquote:
+				d = copy_to(d, e, b, t);
+				if (L'"' != *w)
+					break;
+				skipped++;
+				for (b = ++w;; w++) {
+					for (;;) {
+						switch (*w) {
+							default:
+								w++;
+								continue;
+							case L'\\': {
+								const wchar_t *const bs = w;
+								while (L'\\' == *++w);
+								if (L'"' != *w)
+									continue;
+								t = w - ((size_t)(w - bs) + 1)/2;
+								skipped += (size_t)(w - t);
+								if (1u & (size_t)(w - bs)) {
+									d = copy_to(d, e, b, t);
+									b = w++;
+									continue;
+								}
+								break;
+							}
+							case L'\0':case L'"':
+								t = w;
+								break;
+						}
+						break;
+					}
+					d = copy_to(d, e, b, t);
+					if (L'\0' == *w)
+						goto ret;
+					skipped++;
+					b = ++w;
+					if (L'"' != *w)
+						break;
+				}
+				continue;
+		}
+		break;
+	}
+ret:
+	{
+		const size_t arg_sz = (size_t)(w - *line) - skipped;
+		*line = w;
+		return arg_sz;
+	}
+}
+
+REF_NOINLINE static const wchar_t *ref_skip_spaces(const wchar_t *line)
+{
+	while (L' ' == *line || L'\t' == *line)
+		line++;
+	return line;
+}
+
+/* maximum length of the Windows command line, without the terminating L'\0' */
+#define MAX_LINE 32767
+
+/* Tokenize the whole line by both tokenizers, compare the results.
+   stk_size - size of the caller-supplied buffer of the tokenizer, (size_t)-1 - none.
+   Returns 0 on mismatch.  */
+static int check_line(const wchar_t line[], const size_t stk_size)
+{
+	static wchar_t ref[MAX_LINE + 1];
+	wchar_t stk[16];
+	struct arg_tok_buf tb;
+	const wchar_t *l1 = line, *l2 = line;
+	int ok = 1;
+	unsigned k;
+	tb.buf = (size_t)-1 != stk_size ? stk : NULL;
+	tb.size = (size_t)-1 != stk_size ? stk_size : 0;
+	tb.filled = 0;
+	tb.own = 0;
+	for (k = 0;; k++) {
+		const size_t start = tb.filled;
+		size_t s1, s2;
+		if (k) {
+			l1 = ref_skip_spaces(l1);
+			l2 = arg_skip_spaces(l2);
+			if (l1 != l2) {
+				ok = 0;
+				break;
+			}
+			if (!*l1)
+				break;
+		}
+		s1 = k ? ref_parse_one_arg(&l1, ref, MAX_LINE) : ref_parse_module_name(&l1, ref, MAX_LINE);
+		s2 = k ? arg_tokenize_arg(&l2, &tb) : arg_tokenize_module_name(&l2, &tb);
+		if (s1 != s2 || l1 != l2 || tb.filled != start + s2 + 1 || tb.buf[start + s2] ||
+			memcmp(ref, tb.buf + start, s1*sizeof(wchar_t)))
+		{
+			ok = 0;
+			break;
+		}
+		if (!k && !*l1)
+			break;
+	}
+	if (tb.own)
+		free(tb.buf);
+	return ok;
+}
+
+static void print_line(const wchar_t line[])
+{
+	fputs("mismatch: [", stdout);
+	for (; *line; line++) {
+		if (0x20 <= *line && *line < 0x7F)
+			putchar((char)*line);
+		else
+			printf("\\u%04x", (unsigned)*line);
+	}
+	puts("]");
+}
+
+/* Characters the random command lines are made of: special ones first, then
+  ordinary ones that are false positives of the SIMD scan (below or equal to L'"'
+  or having the same low or high byte as a special character), then letters.  */
+static const wchar_t alphabet[] = {
+	L'\\', L'"', L' ', L'\t',
+	L'!', L'#', 1, 0x8001, 0xFFFF, 0x5C00, 0x225C,
+	L'a', L'b', L'c'
+};
+
+#define ALPHABET_SIZE   (sizeof(alphabet)/sizeof(alphabet[0]))
+#define ALPHABET_SPECIAL 4 /* index of L'!' */
+#define ALPHABET_PLAIN  11 /* index of L'a' */
+
+static wchar_t random_char(const unsigned it)
+{
+	switch (it % 3) {
+		case 0:  /* only letters and special characters */
+			return alphabet[rnd(2) ? ALPHABET_PLAIN + rnd(ALPHABET_SIZE - ALPHABET_PLAIN) : rnd(ALPHABET_SPECIAL)];
+		case 1:  /* any characters */
+			return alphabet[rnd(ALPHABET_SIZE)];
+		default: /* long runs of letters */
+			return alphabet[rnd(8) ? ALPHABET_PLAIN + rnd(ALPHABET_SIZE - ALPHABET_PLAIN) : rnd(ALPHABET_SIZE)];
+	}
+}
+
+#ifdef __unix__
+
+/* Check that vector loads do not cross into the next page after the terminating L'\0'.
+   Returns the number of failures.  */
+static unsigned check_page_end(void)
+{
+	const long page = 4096;
+	unsigned fails = 0, len, q;
+	char *const p = (char*)mmap(NULL, (size_t)page*2, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p || mprotect(p + page, (size_t)page, PROT_NONE)) {
+		puts("mmap() failed");
+		return 1;
+	}
+	for (q = 0; q < 4; q++) {
+		for (len = 0; len < 100; len++) {
+			/* the line ends just before the inaccessible page,
+			  the program name "p" is followed by one argument */
+			wchar_t *const s = (wchar_t*)(p + page) - len - 1;
+			unsigned i;
+			for (i = 0; i < len; i++) {
+				s[i] = !i ? L'p' : 1 == i ? L' ' :
+					1 == q && 2 == i ? L'"' :
+					2 == q && !(i % 5) ? L'\\' :
+					3 == q && !(i % 7) ? L'!' : (wchar_t)(L'a' + i % 26);
+			}
+			s[len] = L'\0';
+			if (!check_line(s, 0) || !check_line(s, (size_t)-1)) {
+				print_line(s);
+				fails++;
+			}
+		}
+	}
+	munmap(p, (size_t)page*2);
+	return fails;
+}
+
+#endif /* __unix__ */
+
+/* Tokenize the whole line by the reference tokenizer.
+   Returns the number of tokenized characters, to not let the compiler drop the work.  */
+static size_t ref_tokenize_line(const wchar_t *line)
+{
+	static wchar_t ref[MAX_LINE + 1];
+	size_t total = ref_parse_module_name(&line, ref, MAX_LINE);
+	while (*(line = ref_skip_spaces(line)))
+		total += ref_parse_one_arg(&line, ref, MAX_LINE);
+	return total;
+}
+
+/* Tokenize the whole line by the tokenizer, reusing the buffer.  */
+static size_t tokenize_line(const wchar_t *line, struct arg_tok_buf *const tb)
+{
+	size_t total;
+	tb->filled = 0;
+	total = arg_tokenize_module_name(&line, tb);
+	while (*(line = arg_skip_spaces(line)))
+		total += arg_tokenize_arg(&line, tb);
+	return total;
+}
+
+/* Fill the line with the arguments up to MAX_LINE characters.  */
+static void fill_line(wchar_t line[], const wchar_t *const args[], const unsigned count)
+{
+	size_t n = 0;
+	unsigned i = 0;
+	for (;; i = (i + 1) % count) {
+		const size_t len = wlen(args[i]);
+		if (len > MAX_LINE - n)
+			break;
+		memcpy(line + n, args[i], len*sizeof(wchar_t));
+		n += len;
+	}
+	line[n] = L'\0';
+}
+
+/* Time tokenizing of command lines of MAX_LINE characters, compare the speed with the
+  reference tokenizer.
+   Returns the number of failures.  */
+static unsigned bench(void)
+{
+	static const wchar_t *const short_args[] = {
+		L"cc ", L"-c ", L"-O2 ", L"a.c ", L"-o ", L"a.o ", L"-g ", L"x "
+	};
+	static const wchar_t *const long_args[] = {
+		L"C:\\Users\\builder\\projects\\mscrtx\\src\\localerpl_fnmatch.c ",
+		L"--include-directory=C:\\Program_Files\\Microsoft_Visual_Studio\\include "
+	};
+	static const wchar_t *const quoted_args[] = {
+		L"\"C:\\Program Files\\Windows Kits\\10\\Include\\ucrt\" ",
+		L"\"D:\\build output\\obj\\release x64\\arg_tokenizer.obj\" "
+	};
+	static const wchar_t *const escaped_args[] = {
+		L"-DVERSION=\\\"1.2.3\\\" ", L"\"-DNAME=\\\"a b\\\"\" ",
+		L"\"a\"\"b\" ", L"C:\\dir\\\\ "
+	};
+	/* command lines recorded from builds and tools */
+	static const wchar_t *const recorded_args[] = {
+		L"cl.exe /nologo /c /O2 /Oi /GL /W4 /sdl /DNDEBUG /D_CONSOLE /D_UNICODE /DUNICODE "
+		L"/EHsc /MD /GS /Gy /Zc:wchar_t /Zc:inline /permissive- /Fo\"x64\\Release\\\\\" "
+		L"/Fd\"x64\\Release\\vc143.pdb\" "
+		L"/I\"C:\\Program Files (x86)\\Windows Kits\\10\\Include\\10.0.22621.0\\ucrt\" "
+		L"/I..\\libutf16 /I..\\unicode_ctype src\\localerpl.c src\\utf8env.c src\\arg_tokenizer.c ",
+		L"link.exe /NOLOGO /OUT:\"C:\\Users\\builder\\source\\repos\\gawk\\x64\\Release\\gawk.exe\" "
+		L"/LTCG /DEBUG /MACHINE:X64 /SUBSYSTEM:CONSOLE /OPT:REF /OPT:ICF "
+		L"/LIBPATH:\"C:\\Program Files (x86)\\Windows Kits\\10\\Lib\\10.0.22621.0\\um\\x64\" "
+		L"kernel32.lib user32.lib advapi32.lib shell32.lib "
+		L"x64\\Release\\main.obj x64\\Release\\eval.obj x64\\Release\\builtin.obj ",
+		L"git.exe -c core.quotepath=false -c log.showSignature=false log "
+		L"--format=\"%H %an <%ae> %s\" --since=2020-01-01 -- src/arg_parser.c ",
+		L"\"C:\\Program Files\\Python311\\python.exe\" -X utf8 -m pytest "
+		L"-k \"not slow and not network\" --junitxml=\"C:\\build\\test results\\junit.xml\" tests\\ "
+	};
+	static const struct {
+		const char *name;
+		const wchar_t *const *args;
+		unsigned count;
+	} lines[] = {
+		{"short arguments", short_args, sizeof(short_args)/sizeof(short_args[0])},
+		{"long arguments", long_args, sizeof(long_args)/sizeof(long_args[0])},
+		{"quoted arguments", quoted_args, sizeof(quoted_args)/sizeof(quoted_args[0])},
+		{"escaped quotes", escaped_args, sizeof(escaped_args)/sizeof(escaped_args[0])},
+		{"recorded lines", recorded_args, sizeof(recorded_args)/sizeof(recorded_args[0])}
+	};
+	static wchar_t line[MAX_LINE + 1];
+	const unsigned rounds = 10, reps = 100;
+	unsigned fails = 0, i, k, r;
+	struct arg_tok_buf tb;
+	tb.buf = NULL;
+	tb.size = 0;
+	tb.own = 0;
+	for (i = 0; i < sizeof(lines)/sizeof(lines[0]); i++) {
+		size_t s1 = 0, s2 = 0;
+		double mb, t1, t2;
+		fill_line(line, lines[i].args, lines[i].count);
+		mb = (double)reps*(double)wlen(line)*sizeof(wchar_t)/1e6;
+		if (!check_line(line, (size_t)-1)) {
+			print_line(line);
+			fails++;
+		}
+		/* interleave the tokenizers, take the best of the rounds */
+		t1 = t2 = 1e9;
+		for (k = 0; k < rounds; k++) {
+			double t = seconds();
+			for (r = 0; r < reps; r++)
+				s1 += ref_tokenize_line(line);
+			t = seconds() - t;
+			t1 = t < t1 ? t : t1;
+			t = seconds();
+			for (r = 0; r < reps; r++)
+				s2 += tokenize_line(line, &tb);
+			t = seconds() - t;
+			t2 = t < t2 ? t : t2;
+		}
+		fails += s1 != s2;
+		printf("%-17s reference: %7.1f MB/s, arg_tokenizer: %7.1f MB/s\n",
+			lines[i].name, mb/t1, mb/t2);
+	}
+	if (tb.own)
+		free(tb.buf);
+	return fails;
+}
+
+int main(void)
+{
+	static const wchar_t *const fixed[] = {
+		L"", L"prog", L"\"C:\\Program Files\\x.exe\" a b",
+		L"p \"\"", L"p a\\\\b", L"p a\\\\\\\"b", L"p \"a\"\"b\"", L"p \"a\\\\\" b",
+		L"p \\\\\\\\\"a b\"", L"p \"\"\"\"\"\" x", L"p\ta \t b\t", L"p \"unterminated"
+	};
+	static wchar_t buf[MAX_LINE + 32];
+	unsigned fails = 0, it;
+	for (it = 0; it < sizeof(fixed)/sizeof(fixed[0]); it++) {
+		if (!check_line(fixed[it], 0) || !check_line(fixed[it], (size_t)-1)) {
+			print_line(fixed[it]);
+			fails++;
+		}
+	}
+	for (it = 0; it < 200000; it++) {
+		/* mostly short lines, sometimes long ones to grow the buffer many times */
+		const size_t n = rnd(it % 100 ? 80 : MAX_LINE);
+		wchar_t *const line = buf + it % 17; /* vary the alignment */
+		size_t i;
+		for (i = 0; i < n; i++)
+			line[i] = random_char(it);
+		line[n] = L'\0';
+		/* alternate between no initial buffer and small stack buffers */
+		if (!check_line(line, (it & 1) ? it % 9 : (size_t)-1)) {
+			print_line(line);
+			if (++fails > 10)
+				break;
+		}
+	}
+#ifdef __unix__
+	fails += check_page_end();
+#endif
+	fails += bench();
+	printf("test_arg_tokenizer: %u failures\n", fails);
+	return fails ? 1 : 0;
+}
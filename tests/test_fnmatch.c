@@ -0,0 +1,220 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_fnmatch.c */
+
+/* Test of localerpl_fnmatch() and compiled patterns (src/localerpl_fnmatch.c) against
+  fnmatch() of glibc in the C.UTF-8 locale, in UTF-8 mode and in ANSI mode - where
+  characters are decoded by mbrtowc() of the same locale.
+   Known differences are not compared:
+  - with LOCALERPL_FNM_CASEFOLD, [:upper:] and [:lower:] match letters of any case,
+  - collating symbols [. .] are not supported,
+  - a range ending with "[:" is undefined by POSIX, here it ends with '[',
+  - glibc does not match "*\\/" with FNM_PATHNAME,
+  - if the characters do not match, glibc retries matching byte by byte.  */
+
+#define _GNU_SOURCE /* FNM_CASEFOLD */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <wctype.h>
+#include <fnmatch.h>
+
+#define LOCALE_RPL_IMPL /* do not replace fnmatch() of glibc */
+#include "mscrtx/localerpl.h"
+#define TEST_SEED 5
+#include "test_util.h"
+
+/* Functions of localerpl.c used by the matcher, implemented by the C library.  */
+
+static int g_utf8;
+
+int localerpl_is_utf8(void)
+{
+	return g_utf8;
+}
+
+unsigned localerpl_c32tolower(unsigned c)
+{
+	return (unsigned)towlower((wint_t)c);
+}
+
+unsigned localerpl_c32toupper(unsigned c)
+{
+	return (unsigned)towupper((wint_t)c);
+}
+
+static const char *const class_names[] = {
+	"alnum", "alpha", "blank", "cntrl", "digit", "graph",
+	"lower", "print", "punct", "space", "upper", "xdigit"
+};
+
+c32ctype_t localerpl_c32ctype(const char *name)
+{
+	c32ctype_t i;
+	for (i = 0; i < sizeof(class_names)/sizeof(class_names[0]); i++) {
+		if (!strcmp(name, class_names[i]))
+			return (c32ctype_t)(i + 1);
+	}
+	return 0;
+}
+
+int localerpl_c32isctype(unsigned c, c32ctype_t desc)
+{
+	return iswctype((wint_t)c, wctype(class_names[desc - 1]));
+}
+
+static int glibc_flags(const int flags)
+{
+	return ((flags & LOCALERPL_FNM_NOESCAPE) ? FNM_NOESCAPE : 0) |
+		((flags & LOCALERPL_FNM_PATHNAME) ? FNM_PATHNAME : 0) |
+		((flags & LOCALERPL_FNM_PERIOD) ? FNM_PERIOD : 0) |
+		((flags & LOCALERPL_FNM_CASEFOLD) ? FNM_CASEFOLD : 0);
+}
+
+static locale_t g_c_locale;
+
+static int is_ascii(const char *s)
+{
+	while (*s && !(0x80 & *s))
+		s++;
+	return !*s;
+}
+
+/* Check if the result of glibc may be compared, see the known differences above.  */
+static int glibc_comparable(const char pattern[], const char string[], const int flags)
+{
+	int bytes_match;
+	if ((flags & LOCALERPL_FNM_CASEFOLD) &&
+		(strstr(pattern, "[:upper:]") || strstr(pattern, "[:lower:]")))
+	{
+		return 0;
+	}
+	if (strstr(pattern, "[.") || strstr(pattern, "-[:"))
+		return 0;
+	if ((flags & LOCALERPL_FNM_PATHNAME) && !(flags & LOCALERPL_FNM_NOESCAPE) &&
+		strstr(pattern, "*\\/"))
+	{
+		return 0;
+	}
+	if (is_ascii(pattern) && is_ascii(string))
+		return 1;
+	/* in the "C" locale glibc matches bytes */
+	uselocale(g_c_locale);
+	bytes_match = !fnmatch(pattern, string, glibc_flags(flags));
+	uselocale(LC_GLOBAL_LOCALE);
+	return !bytes_match;
+}
+
+/* Match the string by localerpl_fnmatch(), by the compiled pattern and by glibc.
+   Returns 0 on mismatch.  */
+static int check(const char pattern[], const char string[], const int flags)
+{
+	const int r = localerpl_fnmatch(pattern, string, flags);
+	const int g = fnmatch(pattern, string, glibc_flags(flags));
+	struct localerpl_fnpat *const pat = localerpl_fnmatch_compile(pattern, flags);
+	int ok = (0 == r || LOCALERPL_FNM_NOMATCH == r) &&
+		(!r == !g || !glibc_comparable(pattern, string, flags));
+	if (!pat || localerpl_fnmatch_exec(pat, string) != r)
+		ok = 0;
+	localerpl_fnmatch_free(pat);
+	if (!ok) {
+		printf("mismatch: utf8=%d flags=0x%x pattern=\"%s\" string=\"%s\": %d, glibc: %d\n",
+			g_utf8, (unsigned)flags, pattern, string, r, g);
+	}
+	return ok;
+}
+
+/* Parts the random patterns are made of: wildcards first, then parts of strings -
+  with letters that are lowered to ASCII ones (KELVIN SIGN, I WITH DOT ABOVE).  */
+static const char *const parts[] = {
+	"*", "?", "[", "]", "!", "^", "-", "\\", "[:alpha:]", "[:upper:]", "[:digit:]",
+	"a", "b", "z", "A", "B", "K", "k", "i", "/", ".", "0", "\xC3\xA9", "\xC3\x89",
+	"\xE2\x84\xAA", "\xC4\xB0", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80"
+};
+
+#define PARTS_SIZE (sizeof(parts)/sizeof(parts[0]))
+#define PARTS_PLAIN 11 /* index of "a" */
+
+/* Make the string from the pattern, so that it often matches.  */
+static void string_from_pattern(char s[], const char *p)
+{
+	for (; *p; p++) {
+		if ('*' == *p) {
+			unsigned k = rnd(4);
+			while (k--)
+				strcat(s, parts[PARTS_PLAIN + rnd(PARTS_SIZE - PARTS_PLAIN)]);
+		}
+		else if ('?' == *p)
+			strcat(s, rnd(2) ? "a" : "\xC3\xA9");
+		else if ('[' != *p && ']' != *p && '\\' != *p) {
+			const size_t n = strlen(s);
+			s[n] = *p;
+			s[n + 1] = '\0';
+		}
+	}
+}
+
+int main(void)
+{
+	static const char *const fixed[][2] = {
+		{"*.c", "a.c"}, {"*.c", ".a.c"}, {"a/*", "a/.b"}, {"a*b", "a/b"}, {"a?b", "a/b"},
+		{"[a-c]x", "bx"}, {"[!a-c]x", "bx"}, {"[^a-c]x", "dx"}, {"[]]", "]"}, {"[!]]", "a"},
+		{"[a-]", "-"}, {"[[:alpha:]]", "\xC3\xA9"}, {"[[:upper:]]", "\xC3\x89"},
+		{"[[:digit:]x]", "x"}, {"[[:nosuch:]]", "a"}, {"[", "["}, {"[a", "[a"},
+		{"\\*", "*"}, {"\\*", "\\*"}, {"a\\", "a\\"}, {"[\\]]", "]"}, {"[\\!]", "\\"},
+		{"K", "\xE2\x84\xAA"}, {"k", "\xE2\x84\xAA"}, {"I", "\xC4\xB0"},
+		{"*\xE4\xB8\xAD*", "x\xE4\xB8\xAD" "y"}, {"??", "\xF0\x9F\x98\x80" "a"},
+		{"[\xC3\xA0-\xC3\xAA]", "\xC3\xA9"}, {"*abcdefghijklmnopqrstuvwxyz0123456789*",
+		"0123456789abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"}
+	};
+	static char pattern[256], string[1024];
+	unsigned fails = 0, it;
+	int flags;
+	g_c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+	if (!setlocale(LC_ALL, "C.UTF-8") || !g_c_locale) {
+		puts("cannot set C.UTF-8 locale");
+		return 2;
+	}
+	for (g_utf8 = 0; g_utf8 <= 1; g_utf8++) {
+		for (it = 0; it < sizeof(fixed)/sizeof(fixed[0]); it++) {
+			for (flags = 0; flags <= LOCALERPL_FNM_CASEFOLD; flags++) {
+				if (!(flags & 0x08) && !check(fixed[it][0], fixed[it][1], flags))
+					fails++;
+			}
+		}
+	}
+	for (it = 0; it < 1000000; it++) {
+		const unsigned n = rnd(8);
+		unsigned i;
+		g_utf8 = (int)(it & 1);
+		flags = (int)rnd(32) & ~0x08;
+		pattern[0] = '\0';
+		string[0] = '\0';
+		for (i = 0; i < n; i++)
+			strcat(pattern, parts[rnd(2) ? rnd(PARTS_SIZE) : PARTS_PLAIN + rnd(PARTS_SIZE - PARTS_PLAIN)]);
+		if (rnd(3))
+			string_from_pattern(string, pattern);
+		else {
+			const unsigned m = rnd(8);
+			for (i = 0; i < m; i++)
+				strcat(string, parts[PARTS_PLAIN + rnd(PARTS_SIZE - PARTS_PLAIN)]);
+		}
+		/* long strings for the vector search of the literal part */
+		if (!(it % 16)) {
+			const unsigned m = rnd(80);
+			for (i = 0; i < m; i++)
+				strcat(string, rnd(2) ? "ab" : "K.");
+		}
+		if (!check(pattern, string, flags) && ++fails > 20)
+			break;
+	}
+	freelocale(g_c_locale);
+	printf("test_fnmatch: %u failures\n", fails);
+	return fails ? 1 : 0;
+}
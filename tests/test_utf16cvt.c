@@ -0,0 +1,507 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_utf16cvt.c */
+
+/* Differential test of the conversions of src/utf16cvt.c against the scalar code of
+  libutf16: utf8->utf16, which widens runs of ASCII characters by SSE2/AVX2, the utf8
+  validator and counter cvt_utf8_count_z(), and utf16->utf8, which has ASCII and 2-byte
+  SIMD lanes.  Random strings at every alignment, invalid and boundary sequences at every
+  position around the 32-byte block boundary, strings ending just before an inaccessible
+  page.  Also benchmark of the conversions and counting of ASCII, Cyrillic, CJK, emoji
+  and mixed-script log texts.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __unix__
+#include <sys/mman.h>
+#endif
+
+#include "libutf16/utf8_to_utf16.h"
+#include "libutf16/utf16_to_utf8.h"
+#include "mscrtx/utf16cvt.h"
+#define TEST_SEED 11
+#include "test_util.h"
+
+/* maximum length of random strings, in bytes */
+#define MAX_STR 4000
+
+/* Convert by the scalar decoder of libutf16.
+   Returns the number of stored utf16 characters, including the terminating '\0',
+  or 0 if the string is not a valid utf8.  */
+static size_t ref_utf8_to_16(const char s[], wchar_t d[], const size_t sz)
+{
+	const utf8_char_t *q = (const utf8_char_t*)s;
+	utf16_char_t *b = (utf16_char_t*)d;
+	return utf8_to_utf16_z(&q, &b, sz);
+}
+
+/* Count code points of the utf16 string of n characters.  */
+static size_t code_points(const wchar_t s[], const size_t n)
+{
+	size_t i = 0, c = n;
+	for (; i < n; i++)
+		c -= (0xDC00 == (s[i] & 0xFC00));
+	return c;
+}
+
+/* Convert the string by the '\0'-terminated and by the counted conversions, with and
+  without the buffer, validate and count its characters, compare with libutf16.
+   Returns 0 on mismatch.  */
+static int check_utf8(const char s[])
+{
+	static const unsigned flags[] = {0, CVT_ONE_PASS, CVT_ONE_PASS | CVT_SHRINK};
+	static wchar_t ref[MAX_STR + 1];
+	const size_t n = ref_utf8_to_16(s, ref, sizeof(ref)/sizeof(ref[0]));
+	const size_t len = strlen(s);
+	wchar_t buf[40], *r;
+	unsigned f, k;
+	int ok;
+
+	{
+		/* validation and counting without conversion */
+		size_t u16 = 0, cps;
+		errno = 0;
+		cps = cvt_utf8_count_z(s, &u16);
+		ok = n ? cps == code_points(ref, n - 1) && u16 == n - 1 :
+			(size_t)-1 == cps && EILSEQ == errno;
+	}
+
+	for (f = 0; f < sizeof(flags)/sizeof(flags[0]); f++) {
+		/* no buffer, a small buffer - converted into it or not */
+		for (k = 0; k < 3 && ok; k++) {
+			const size_t buf_sz = k ? 1 == k ? sizeof(buf)/sizeof(buf[0]) : len % 7 : 0;
+			errno = 0;
+			r = cvt_utf8_to_16_z_f(s, buf_sz ? buf : NULL, buf_sz, flags[f]);
+			ok = n ? r && !memcmp(r, ref, n*sizeof(wchar_t)) : !r && EILSEQ == errno;
+			if (r != buf)
+				free(r);
+		}
+		if (len && ok) {
+			size_t sz = len;
+			errno = 0;
+			r = cvt_utf8_to_16_f(s, &sz, NULL, 0, flags[f]);
+			ok = n ? r && sz == n - 1 && !memcmp(r, ref, sz*sizeof(wchar_t)) :
+				!r && EILSEQ == errno;
+			free(r);
+		}
+	}
+	if (!ok)
+		printf("mismatch: \"%s\" at %u\n", s, (unsigned)((size_t)s & 63));
+	return ok;
+}
+
+/* Parts the random strings are made of: ASCII runs of different lengths, 2-, 3- and
+  4-byte characters, invalid sequences.  */
+static const char *const parts[] = {
+	"a", "bcdefgh", "0123456789abcdefghijklmnopqrstuvwxyz", "/", "\x7F",
+	"\xD0\x96", "\xC3\xA9", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80",
+	"\xFF", "\x80", "\xE4\xB8", "\xC0\xAF", "\xED\xA0\x80"
+};
+
+#define PARTS_VALID 9 /* index of the first invalid part */
+
+/* Make a random string at the beginning of s.  */
+static void random_string(char s[])
+{
+	/* mostly short strings, sometimes long ones, rarely invalid */
+	const unsigned n = rnd(10) ? rnd(12) : rnd(100);
+	const int invalid = !rnd(20);
+	size_t len = 0;
+	unsigned i;
+	for (i = 0; i < n; i++) {
+		const char *const p = parts[rnd(PARTS_VALID)];
+		const size_t l = strlen(p);
+		memcpy(s + len, p, l);
+		len += l;
+	}
+	if (invalid) {
+		const char *const p = parts[PARTS_VALID + rnd(sizeof(parts)/sizeof(parts[0]) - PARTS_VALID)];
+		const size_t at = rnd((unsigned)len + 1), l = strlen(p);
+		memmove(s + at + l, s + at, len - at);
+		memcpy(s + at, p, l);
+		len += l;
+	}
+	s[len] = '\0';
+}
+
+/* Sequences placed at every position around the 32-byte block boundary: invalid -
+  truncated, overlong, surrogates, above 0x10FFFF, bytes 0xF5 and above, stray
+  continuation bytes, then valid ones - at the limits of the ranges.  */
+static const char *const edge_seqs[] = {
+	"\xC3", "\xE4\xB8", "\xF0\x9F\x98", "\xC0\xAF", "\xC1\xBF", "\xE0\x80\xAF",
+	"\xE0\x9F\xBF", "\xF0\x80\x80\xAF", "\xF0\x8F\xBF\xBF", "\xED\xA0\x80", "\xED\xBF\xBF",
+	"\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xF8\x88\x80\x80\x80", "\xFE", "\xFF",
+	"\x80", "\xBF", "\xC3\xA9\xA9", "\xE4\xB8\xAD\xAD",
+	"\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xEE\x80\x80", "\xEF\xBF\xBF",
+	"\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF"
+};
+
+/* Check the sequences after 0..40 characters of ASCII and of Cyrillic text, followed by
+  the end of the string or by more text, at all alignments of the string.
+   Returns the number of failures.  */
+static unsigned check_edge_seqs(char base[])
+{
+	static const char *const backgrounds[] = {"a", "\xD0\x96"};
+	static const unsigned tails[] = {0, 3, 40};
+	unsigned fails = 0, b, q, k, t, a;
+	for (b = 0; b < sizeof(backgrounds)/sizeof(backgrounds[0]); b++) {
+		const size_t bl = strlen(backgrounds[b]);
+		for (q = 0; q < sizeof(edge_seqs)/sizeof(edge_seqs[0]); q++) {
+			const size_t ql = strlen(edge_seqs[q]);
+			for (k = 0; k <= 40; k++) {
+				for (t = 0; t < sizeof(tails)/sizeof(tails[0]); t++) {
+					char str[256];
+					size_t len = 0;
+					unsigned i;
+					for (i = 0; i < k; i++, len += bl)
+						memcpy(str + len, backgrounds[b], bl);
+					memcpy(str + len, edge_seqs[q], ql);
+					len += ql;
+					for (i = 0; i < tails[t]; i++, len += bl)
+						memcpy(str + len, backgrounds[b], bl);
+					str[len] = '\0';
+					for (a = 0; a < 32; a++) {
+						strcpy(base + a, str);
+						if (!check_utf8(base + a) && ++fails > 10)
+							return fails;
+					}
+				}
+			}
+		}
+	}
+	return fails;
+}
+
+/* Convert utf16->utf8 by the scalar encoder of libutf16.
+   Returns the number of stored bytes, including the terminating '\0',
+  or 0 if the string has an unpaired surrogate.  */
+static size_t ref_utf16_to_8(const wchar_t s[], char d[], const size_t sz)
+{
+	const utf16_char_t *w = (const utf16_char_t*)s;
+	utf8_char_t *b = (utf8_char_t*)d;
+	return utf16_to_utf8_z(&w, &b, sz);
+}
+
+/* Convert the utf16 string by the L'\0'-terminated, the counted and the by-parts
+  conversions, with and without the buffer, compare with the result of libutf16.
+   Returns 0 on mismatch.  */
+static int check_utf16(const wchar_t s[])
+{
+	static char ref[MAX_STR*4 + 1], parts_buf[MAX_STR*4 + 1];
+	const size_t n = ref_utf16_to_8(s, ref, sizeof(ref));
+	const size_t len = wlen(s);
+	char buf[40], *r;
+	unsigned k;
+	int ok = 1;
+
+	/* no buffer, a small buffer - converted into it or not */
+	for (k = 0; k < 3 && ok; k++) {
+		const size_t buf_sz = k ? 1 == k ? sizeof(buf) : len % 7 : 0;
+		errno = 0;
+		r = cvt_utf16_to_8_z(s, buf_sz ? buf : NULL, buf_sz);
+		ok = n ? r && !memcmp(r, ref, n) : !r && EILSEQ == errno;
+		if (r != buf)
+			free(r);
+	}
+	if (len && ok) {
+		size_t sz = len;
+		errno = 0;
+		r = cvt_utf16_to_8(s, &sz, NULL, 0);
+		ok = n ? r && sz == n - 1 && !memcmp(r, ref, sz) : !r && EILSEQ == errno;
+		free(r);
+	}
+	if (ok) {
+		/* by parts of 4..26 bytes, a part always has space for any character */
+		const wchar_t *w = s;
+		const size_t part = 4 + len % 23;
+		size_t filled = 0, m = 0;
+		while (*w) {
+			errno = 0;
+			m = cvt_utf16_to_8_part_z(&w, parts_buf + filled, part);
+			if ((size_t)-1 == m)
+				break;
+			filled += m;
+		}
+		ok = n ? filled == n - 1 && !memcmp(parts_buf, ref, filled) :
+			(size_t)-1 == m && EILSEQ == errno;
+	}
+	if (!ok) {
+		size_t i = 0;
+		printf("utf16 mismatch at %u:", (unsigned)((size_t)s & 63));
+		for (; i < len; i++)
+			printf(" %04X", (unsigned)s[i]);
+		printf("\n");
+	}
+	return ok;
+}
+
+/* Units the random utf16 strings are made of, a surrogate pair is always selected
+  with the next unit: ASCII, 2-byte characters - also at the limits of the range,
+  3-byte characters, surrogate pairs, rarely unpaired surrogates.  */
+static const wchar_t units[] = {
+	L'a', L'z', L' ', 0x7F, 0x80, 0xE9, 0x416, 0x3B1, 0x7FF,
+	0x800, 0x4E2D, 0xFFFF, 0xD83D, 0xDE00, 0xDC00, 0xD800
+};
+
+#define UNITS_ASCII 4  /* index of the first non-ASCII unit */
+#define UNITS_3BYTE 9  /* index of the first 3-byte unit */
+#define UNITS_PAIR  12 /* index of the pair */
+#define UNITS_VALID 14 /* index of the first unpaired surrogate */
+
+/* Make a random utf16 string at the beginning of s: mostly ASCII and 2-byte
+  characters, to hit all the masks of the 2-byte lane.  */
+static void random_utf16(wchar_t s[])
+{
+	const unsigned n = rnd(10) ? rnd(40) : rnd(1000);
+	const unsigned kind = rnd(4);
+	unsigned i = 0;
+	while (i < n) {
+		unsigned u;
+		switch (kind) {
+			case 0:  /* only ASCII and 2-byte characters */
+				u = rnd(UNITS_3BYTE);
+				break;
+			case 1:  /* only 2-byte characters, rarely others */
+				u = rnd(16) ? UNITS_ASCII + rnd(UNITS_3BYTE - UNITS_ASCII) : rnd(UNITS_VALID);
+				break;
+			default: /* any characters, rarely unpaired surrogates */
+				u = rnd(200) ? rnd(UNITS_VALID) : UNITS_VALID + rnd(2);
+				break;
+		}
+		if (UNITS_PAIR + 1 == u)
+			u = UNITS_PAIR;
+		s[i++] = units[u];
+		if (UNITS_PAIR == u)
+			s[i++] = units[UNITS_PAIR + 1];
+	}
+	s[i] = L'\0';
+}
+
+/* Place a 3-byte character, a surrogate pair or an unpaired surrogate at every position
+  of a run of 2-byte characters, with ASCII characters at some lanes.
+   Returns the number of failures.  */
+static unsigned check_2byte_lane(wchar_t base[])
+{
+	static const wchar_t breakers[] = {0x4E2D, 0xD83D, 0xDC00, 0xD800, L'a'};
+	unsigned fails = 0, b, at, len, a;
+	for (b = 0; b < sizeof(breakers)/sizeof(breakers[0]); b++) {
+		for (len = 1; len <= 40; len++) {
+			for (at = 0; at < len; at++) {
+				wchar_t str[64];
+				unsigned i, k = 0;
+				for (i = 0; i < len; i++) {
+					if (i == at) {
+						str[k++] = breakers[b];
+						if (0xD83D == breakers[b])
+							str[k++] = 0xDE00;
+					}
+					else
+						str[k++] = (wchar_t)(i % 5 == len % 5 ? L'a' + i % 26 : 0x400 + i);
+				}
+				str[k] = L'\0';
+				/* every 2-byte offset relative to 32-byte vectors */
+				for (a = 0; a < 16; a++) {
+					memcpy(base + a, str, (k + 1)*sizeof(wchar_t));
+					if (!check_utf16(base + a) && ++fails > 10)
+						return fails;
+				}
+			}
+		}
+	}
+	return fails;
+}
+
+#ifdef __unix__
+
+/* Check that aligned loads do not cross into the next page after the terminating '\0'.
+   Returns the number of failures.  */
+static unsigned check_page_end(void)
+{
+	const long page = 4096;
+	unsigned fails = 0, len, q;
+	char *const p = (char*)mmap(NULL, (size_t)page*2, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p || mprotect(p + page, (size_t)page, PROT_NONE)) {
+		puts("mmap() failed");
+		return 1;
+	}
+	for (q = 0; q < 3; q++) {
+		for (len = 0; len < 200; len++) {
+			/* the string ends just before the inaccessible page: only ASCII characters,
+			  a 2-byte character at the end or an invalid byte at the end */
+			char *const s = p + page - len - 1;
+			unsigned i;
+			for (i = 0; i < len; i++)
+				s[i] = (char)('a' + i % 26);
+			if (len >= 2 && 1 == q) {
+				s[len - 2] = '\xD0';
+				s[len - 1] = '\x96';
+			}
+			else if (len && 2 == q)
+				s[len - 1] = '\xFF';
+			s[len] = '\0';
+			if (!check_utf8(s))
+				fails++;
+		}
+	}
+	for (q = 0; q < 3; q++) {
+		for (len = 0; len < 100; len++) {
+			/* the utf16 string of 2-byte characters, with some ASCII ones or a surrogate
+			  pair at the end, ends just before the inaccessible page */
+			wchar_t *const s = (wchar_t*)(p + page) - len - 1;
+			unsigned i;
+			for (i = 0; i < len; i++)
+				s[i] = (wchar_t)(1 == q && !(i % 3) ? L'a' : 0x430 + i % 32);
+			if (len >= 2 && 2 == q) {
+				s[len - 2] = 0xD83D;
+				s[len - 1] = 0xDE00;
+			}
+			s[len] = L'\0';
+			if (!check_utf16(s))
+				fails++;
+		}
+	}
+	munmap(p, (size_t)page*2);
+	return fails;
+}
+
+#endif /* __unix__ */
+
+/* Texts of the benchmark, repeated to fill the input.  */
+static const char *const corpora[][2] = {
+	{"ASCII", "The quick brown fox jumps over the lazy dog. 0123456789 "},
+	{"Cyrillic", "\xD0\xA1\xD1\x8A\xD0\xB5\xD1\x88\xD1\x8C \xD0\xB6\xD0\xB5 \xD0\xB5\xD1\x89\xD1\x91 "
+		"\xD1\x8D\xD1\x82\xD0\xB8\xD1\x85 \xD0\xBC\xD1\x8F\xD0\xB3\xD0\xBA\xD0\xB8\xD1\x85. "},
+	{"CJK", "\xE4\xB8\xAD\xE6\x96\x87\xE5\xAD\x97\xE7\xAC\xA6\xE7\xBC\x96\xE7\xA0\x81"
+		"\xE6\xB5\x8B\xE8\xAF\x95\xE3\x80\x82"},
+	{"emoji", "\xF0\x9F\x98\x80\xF0\x9F\x98\x81 \xF0\x9F\x8E\x89\xF0\x9F\x9A\x80 "},
+	{"log", "2020-05-17 12:00:01 INFO request /api/v1/items?q=caf\xC3\xA9 user=\xD0\x98\xD0\xB2\xD0\xB0\xD0\xBD "
+		"status=200 time=12ms size=1024 agent=\"Mozilla/5.0 (Windows NT 10.0; Win64; x64)\"\n"},
+	{"log-mix", "12:00:01 \xD0\x9E\xD1\x88\xD0\xB8\xD0\xB1\xD0\xBA\xD0\xB0: \xD1\x84\xD0\xB0\xD0\xB9\xD0\xBB "
+		"\"C:\\\xD0\x94\xD0\xB0\xD0\xBD\xD0\xBD\xD1\x8B\xD0\xB5\\\xCE\xB1\xCE\xB2\xCE\xB3.txt\" "
+		"\xD0\xBD\xD0\xB5 \xD0\xBD\xD0\xB0\xD0\xB9\xD0\xB4\xD0\xB5\xD0\xBD, "
+		"\xE6\x96\x87\xE4\xBB\xB6\xE6\x9C\xAA\xE6\x89\xBE\xE5\x88\xB0 \xF0\x9F\x98\x9E\n"}
+};
+
+/* Convert and count a text of about sz bytes many times by the library and by libutf16,
+  print the speed in MB/s of utf8 text, then convert it back from utf16.  */
+static unsigned bench(const size_t sz)
+{
+	char *const text = (char*)malloc(sz + 64);
+	char *const text2 = (char*)malloc(sz + 64);
+	wchar_t *const out = (wchar_t*)malloc((sz + 64)*sizeof(wchar_t));
+	unsigned fails = 0, c;
+	if (!text || !text2 || !out) {
+		free(text);
+		free(text2);
+		free(out);
+		return 1;
+	}
+	for (c = 0; c < sizeof(corpora)/sizeof(corpora[0]); c++) {
+		const size_t l = strlen(corpora[c][1]);
+		const unsigned reps = (unsigned)(200*1000000/sz);
+		size_t len = 0, n = 0, u16 = 0;
+		unsigned i;
+		double t, tr, tc, tcr;
+		for (; len + l <= sz; len += l)
+			memcpy(text + len, corpora[c][1], l);
+		text[len] = '\0';
+		t = seconds();
+		for (i = 0; i < reps; i++) {
+			const wchar_t *const r = cvt_utf8_to_16_z(text, out, sz + 64);
+			fails += r != out;
+		}
+		t = seconds() - t;
+		tr = seconds();
+		for (i = 0; i < reps; i++)
+			n = ref_utf8_to_16(text, out, sz + 64);
+		tr = seconds() - tr;
+		fails += !n;
+		tc = seconds();
+		for (i = 0; i < reps; i++)
+			fails += (size_t)-1 == cvt_utf8_count_z(text, &u16);
+		tc = seconds() - tc;
+		fails += u16 != n - 1;
+		tcr = seconds();
+		for (i = 0; i < reps; i++) {
+			/* size query: the decoder only counts, if there is no space in the buffer */
+			const utf8_char_t *q = (const utf8_char_t*)text;
+			utf16_char_t *b = (utf16_char_t*)out;
+			n = utf8_to_utf16_z(&q, &b, 0);
+		}
+		tcr = seconds() - tcr;
+		fails += u16 != n - 1;
+		printf("%-8s utf8->utf16: %7.1f MB/s, libutf16: %7.1f MB/s; count: %7.1f MB/s, libutf16: %7.1f MB/s\n",
+			corpora[c][0], (double)len*reps/t/1e6, (double)len*reps/tr/1e6,
+			(double)len*reps/tc/1e6, (double)len*reps/tcr/1e6);
+
+		(void)ref_utf8_to_16(text, out, sz + 64);
+		t = seconds();
+		for (i = 0; i < reps; i++) {
+			const char *const r = cvt_utf16_to_8_z(out, text2, sz + 64);
+			fails += r != text2;
+		}
+		t = seconds() - t;
+		fails += !!strcmp(text, text2);
+		tr = seconds();
+		for (i = 0; i < reps; i++)
+			n = ref_utf16_to_8(out, text2, sz + 64);
+		tr = seconds() - tr;
+		fails += n != len + 1;
+		printf("%-8s utf16->utf8: %7.1f MB/s, libutf16: %7.1f MB/s\n",
+			corpora[c][0], (double)len*reps/t/1e6, (double)len*reps/tr/1e6);
+	}
+	free(text);
+	free(text2);
+	free(out);
+	return fails;
+}
+
+int main(void)
+{
+	static char area[MAX_STR + 64 + 64];
+	char *const base = (char*)(((size_t)area + 63) & ~(size_t)63);
+	unsigned fails = 0, it;
+	for (it = 0; it < 5000; it++) {
+		char str[MAX_STR + 64];
+		unsigned a;
+		random_string(str);
+		/* the same string at every alignment relative to 32-byte vectors */
+		for (a = 0; a < 64; a++) {
+			strcpy(base + a, str);
+			if (!check_utf8(base + a))
+				fails++;
+		}
+		if (fails > 10)
+			break;
+	}
+	fails += check_edge_seqs(base);
+	{
+		/* utf16 strings at every 2-byte offset relative to 32-byte vectors */
+		wchar_t *const wbase = (wchar_t*)base;
+		for (it = 0; it < 5000 && fails <= 10; it++) {
+			wchar_t str[MAX_STR/2];
+			unsigned a;
+			random_utf16(str);
+			for (a = 0; a < 16; a++) {
+				memcpy(wbase + a, str, (wlen(str) + 1)*sizeof(wchar_t));
+				if (!check_utf16(wbase + a))
+					fails++;
+			}
+		}
+		fails += check_2byte_lane(wbase);
+	}
+#ifdef __unix__
+	fails += check_page_end();
+#endif
+	fails += bench(1 << 20);
+	printf("test_utf16cvt: %u failures\n", fails);
+	return fails ? 1 : 0;
+}
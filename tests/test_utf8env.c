@@ -0,0 +1,390 @@
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_utf8env.c */
+
+/* Test of the UTF-8 environment (src/utf8env.c) on a simulated wide-character
+  environment, in the default and in lazy mode, and benchmark of utf8_getenv(),
+  utf8_environ(), utf8_setenv() and utf8_unsetenv() in both modes with many variables
+  (10000 by default, the number may be passed as the argument).  The stand-ins of _wgetenv() and _wputenv() are timed separately:
+  their linear scans dominate the first lookups and the updates.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <errno.h>
+
+#include "test_util.h"
+
+/* glibc wcslen() and wcschr() expect 4-byte wchar_t, while the library is built
+  with -fshort-wchar.  */
+static size_t test_wcslen(const wchar_t *s)
+{
+	const wchar_t *e = s;
+	while (*e)
+		e++;
+	return (size_t)(e - s);
+}
+
+static wchar_t *test_wcschr(const wchar_t *s, const wchar_t c)
+{
+	for (; *s != c; s++) {
+		if (!*s)
+			return NULL;
+	}
+	return (wchar_t*)s;
+}
+
+#define wcslen test_wcslen
+#define wcschr test_wcschr
+
+/* Stand-ins for the CRT: the environment is an array of 'name=value' strings, names
+  are compared case-insensitively, _wgetenv() and _wputenv() scan it linearly.  */
+
+wchar_t **_wenviron;
+static wchar_t **wenv_array; /* _wenviron is set to NULL by utf8_clearenv() */
+static size_t wenv_count, wenv_size;
+
+/* Only ASCII and Latin-1 letters are converted, enough for the names used here.  */
+unsigned unicode_toupper(unsigned c)
+{
+	if (c - 'a' <= 'z' - 'a' || (c - 0xE0 <= 0xFE - 0xE0 && 0xF7 != c))
+		return c - 0x20;
+	return c;
+}
+
+static size_t wname_len(const wchar_t s[])
+{
+	const wchar_t *e = s;
+	while (*e && L'=' != *e)
+		e++;
+	return (size_t)(e - s);
+}
+
+/* Find the variable by the name of n characters, returns its index or wenv_count.  */
+static size_t wenv_find(const wchar_t name[], const size_t n)
+{
+	size_t i = 0;
+	for (; i < wenv_count; i++) {
+		const wchar_t *const v = _wenviron[i];
+		size_t k = 0;
+		if (n != wname_len(v))
+			continue;
+		while (k < n && unicode_toupper(v[k]) == unicode_toupper(name[k]))
+			k++;
+		if (k == n)
+			break;
+	}
+	return i;
+}
+
+wchar_t *_wgetenv(const wchar_t name[])
+{
+	const size_t n = wcslen(name);
+	const size_t i = _wenviron ? wenv_find(name, n) : 0;
+	return _wenviron && i < wenv_count ? _wenviron[i] + n + 1 : NULL;
+}
+
+static void wenv_free(void)
+{
+	while (wenv_count)
+		free(wenv_array[--wenv_count]);
+	free(wenv_array);
+	wenv_array = NULL;
+	wenv_size = 0;
+}
+
+int _wputenv(const wchar_t str[])
+{
+	const size_t n = wname_len(str);
+	size_t i, sz;
+	wchar_t *v;
+	if (!n || !str[n])
+		return -1;
+	if (!_wenviron)
+		wenv_free();
+	i = wenv_find(str, n);
+	if (!str[n + 1]) {
+		/* 'name=' deletes the variable */
+		if (i < wenv_count) {
+			free(_wenviron[i]);
+			_wenviron[i] = _wenviron[--wenv_count];
+			_wenviron[wenv_count] = NULL;
+		}
+		return 0;
+	}
+	sz = (wcslen(str) + 1)*sizeof(wchar_t);
+	v = (wchar_t*)malloc(sz);
+	if (!v)
+		return -1;
+	memcpy(v, str, sz);
+	if (i < wenv_count) {
+		free(_wenviron[i]);
+		_wenviron[i] = v;
+		return 0;
+	}
+	if (wenv_count + 1 >= wenv_size) {
+		wchar_t **const e = (wchar_t**)realloc(_wenviron, (wenv_size*2 + 16)*sizeof(*e));
+		if (!e) {
+			free(v);
+			return -1;
+		}
+		_wenviron = wenv_array = e;
+		wenv_size = wenv_size*2 + 16;
+	}
+	_wenviron[wenv_count++] = v;
+	_wenviron[wenv_count] = NULL;
+	return 0;
+}
+
+void utf8_env_fatal(void)
+{
+	puts("utf8_env_fatal() called");
+	exit(2);
+}
+
+/* the module is compiled here, with the stand-ins above */
+#include "../src/utf8env.c"
+
+/* Put the ASCII 'name=value' string to the wide-character environment.  */
+static void wput(const char str[])
+{
+	wchar_t w[256];
+	size_t i = 0;
+	while ('\0' != (w[i] = (unsigned char)str[i]))
+		i++;
+	if (_wputenv(w)) {
+		puts("_wputenv() failed");
+		exit(2);
+	}
+}
+
+static int check_value(const char name[], const char *const expected/*NULL?*/)
+{
+	const char *const v = utf8_getenv(name);
+	if (expected ? !v || strcmp(v, expected) : !!v) {
+		printf("utf8_getenv(\"%s\"): \"%s\", expected \"%s\"\n", name,
+			v ? v : "(null)", expected ? expected : "(null)");
+		return 0;
+	}
+	return 1;
+}
+
+/* Find the variable in utf8_environ() by the name in exact case, returns its value.  */
+static const char *environ_value(const char name[])
+{
+	const size_t len = strlen(name);
+	char **e = utf8_environ();
+	for (; *e; e++) {
+		if (!strncmp(*e, name, len) && '=' == (*e)[len])
+			return *e + len + 1;
+	}
+	return NULL;
+}
+
+/* Check that utf8_setenv() rejects the name with '='.  */
+static int check_setenv_eq(void)
+{
+	errno = 0;
+	if (-1 != utf8_setenv("A=B", "1", 1) || EINVAL != errno || NULL != _wgetenv(L"A")) {
+		puts("utf8_setenv(\"A=B\"): expected EINVAL");
+		return 0;
+	}
+	return 1;
+}
+
+/* Lazy mode: variables are converted as they are queried.  */
+static unsigned test_lazy(void)
+{
+	unsigned fails = 0;
+	utf8_env_set_lazy(1);
+	wput("Path=C:\\bin");
+	wput("HOME=C:\\Users\\u");
+	{
+		/* LATIN SMALL LETTER E WITH ACUTE in the name and in the value */
+		static const wchar_t latin[] = {0xE9, L'=', L'x', 0xE9, 0};
+		if (_wputenv(latin))
+			fails++;
+	}
+
+	fails += !check_value("HOME", "C:\\Users\\u");
+	fails += !check_value("NONE", NULL);
+
+	/* until utf8_environ() is called, the variable is also deleted from the real
+	  environment, else utf8_getenv() would find it there */
+	wput("TMP=C:\\t");
+	fails += !check_value("TMP", "C:\\t");
+	fails += !!utf8_unsetenv("tmp");
+	fails += !check_value("TMP", NULL) || NULL != _wgetenv(L"TMP");
+
+	{
+		/* the names are cached as they were queried, but utf8_environ() lists them as
+		  they are spelled in the environment, and the cached values remain valid */
+		const char *const path = utf8_getenv("PATH");
+		const char *const e_acute = utf8_getenv("\xC3\x89");
+		fails += !path || !environ_value("Path") || !!environ_value("PATH");
+		fails += !e_acute || !environ_value("\xC3\xA9") || !!environ_value("\xC3\x89");
+		fails += !check_value("pAtH", "C:\\bin") || (path && strcmp(path, "C:\\bin"));
+		fails += !check_value("\xC3\xA9", "x\xC3\xA9") || (e_acute && strcmp(e_acute, "x\xC3\xA9"));
+	}
+
+	fails += !!utf8_setenv("Home", "D:\\", 0);
+	fails += !check_value("home", "C:\\Users\\u");
+	fails += !!utf8_setenv("Home", "D:\\", 1);
+	fails += !check_value("HOME", "D:\\");
+	fails += !!utf8_setenv("NEW", "1", 0);
+	fails += !check_value("new", "1");
+
+	fails += !environ_value("NEW");
+	fails += !!utf8_setenv("path", "C:\\x", 1);
+	fails += !environ_value("path") || !!environ_value("Path") || !check_value("PATH", "C:\\x");
+	fails += !!utf8_unsetenv("new");
+	fails += !check_value("NEW", NULL) || !!environ_value("NEW");
+	fails += NULL == _wgetenv(L"NEW"); /* after utf8_environ() */
+	fails += !check_setenv_eq();
+
+	utf8_clearenv();
+	fails += !check_value("Path", NULL) || !!*utf8_environ();
+	utf8_env_shadow_reset();
+	utf8_env_set_lazy(0);
+	return fails;
+}
+
+/* Default mode: the whole environment is converted by the first call,
+  later changes of the real environment are not seen.  */
+static unsigned test_default(void)
+{
+	unsigned fails = 0;
+	wput("Path=C:\\bin");
+	fails += !check_value("PATH", "C:\\bin");
+
+	/* utf8_environ() is not called yet */
+	wput("LATER=1");
+	fails += !check_value("LATER", NULL);
+
+	/* the variable is deleted only from the shadow environment */
+	fails += !!utf8_unsetenv("path");
+	fails += !check_value("Path", NULL) || NULL == _wgetenv(L"Path");
+	fails += !!environ_value("Path") || !!environ_value("LATER");
+
+	fails += !!utf8_setenv("NEW", "1", 0);
+	fails += !check_value("new", "1") || !environ_value("NEW") || NULL == _wgetenv(L"NEW");
+	fails += !check_setenv_eq();
+
+	utf8_clearenv();
+	fails += !check_value("NEW", NULL) || !!*utf8_environ();
+	utf8_env_shadow_reset();
+	return fails;
+}
+
+/* Names share long prefixes, as many variables of build environments do.  */
+static void var_name(char name[], const unsigned i)
+{
+	sprintf(name, "%s_%u", i % 3 ? "MSVC_VAR" : "PROCESSOR", i);
+}
+
+/* Get all n variables, check their values.
+   Returns the number of failures.  */
+static unsigned get_all(const unsigned n, const char prefix[])
+{
+	unsigned fails = 0, i;
+	for (i = 0; i < n; i++) {
+		char name[64], value[64];
+		const char *v;
+		var_name(name, i);
+		sprintf(value, "%s_%u", prefix, i);
+		v = utf8_getenv(name);
+		if (!v || strcmp(v, value))
+			fails++;
+	}
+	return fails;
+}
+
+static unsigned bench(const unsigned n, const int lazy)
+{
+	const char *const mode = lazy ? "lazy" : "default";
+	unsigned fails = 0, i;
+	char name[64], str[128];
+	double t;
+
+	utf8_env_set_lazy(lazy);
+
+	for (i = 0; i < n; i++) {
+		var_name(name, i);
+		sprintf(str, "%s=value_%u", name, i);
+		wput(str);
+	}
+
+	/* the stand-ins scan the environment, time them separately */
+	t = seconds();
+	for (i = 0; i < n; i++) {
+		wchar_t w[64];
+		size_t k = 0;
+		var_name(name, i);
+		while ('\0' != (w[k] = (unsigned char)name[k]))
+			k++;
+		fails += !_wgetenv(w);
+	}
+	printf("%u variables, stand-in _wgetenv() of each: %.3f s\n", n, seconds() - t);
+
+	t = seconds();
+	for (i = 0; i < n; i++) {
+		var_name(name, i);
+		sprintf(str, "%s=value_%u", name, i);
+		wput(str);
+	}
+	printf("%u variables, stand-in _wputenv() of each: %.3f s\n", n, seconds() - t);
+
+	t = seconds();
+	fails += get_all(n, "value");
+	printf("%u variables, %s mode, first utf8_getenv() of each: %.3f s\n", n, mode, seconds() - t);
+
+	t = seconds();
+	fails += get_all(n, "value");
+	printf("%u variables, %s mode, cached utf8_getenv() of each: %.3f s\n", n, mode, seconds() - t);
+
+	t = seconds();
+	for (i = 0; utf8_environ()[i]; i++);
+	printf("%u variables, %s mode, utf8_environ(): %.3f s\n", n, mode, seconds() - t);
+	fails += i != n;
+
+	t = seconds();
+	for (i = 0; i < n; i++) {
+		var_name(name, i);
+		sprintf(str, "new_%u", i);
+		fails += !!utf8_setenv(name, str, 1);
+	}
+	printf("%u variables, %s mode, utf8_setenv() of each: %.3f s\n", n, mode, seconds() - t);
+
+	t = seconds();
+	fails += get_all(n, "new");
+	printf("%u variables, %s mode, utf8_getenv() of each: %.3f s\n", n, mode, seconds() - t);
+
+	t = seconds();
+	for (i = 0; i < n; i++) {
+		var_name(name, i);
+		fails += !!utf8_unsetenv(name);
+	}
+	printf("%u variables, %s mode, utf8_unsetenv() of each: %.3f s\n", n, mode, seconds() - t);
+	fails += !!*utf8_environ() || n != wenv_count;
+
+	utf8_clearenv();
+	wenv_free();
+	utf8_env_set_lazy(0);
+	return fails;
+}
+
+int main(int argc, char *argv[])
+{
+	const unsigned n = argc > 1 ? (unsigned)atoi(argv[1]) : 10000u;
+	unsigned fails = test_default(); /* first, to test the default */
+	fails += test_lazy();
+	fails += bench(n, 0);
+	fails += bench(n, 1);
+	printf("test_utf8env: %u failures\n", fails);
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef TEST_UTIL_H_INCLUDED
+#define TEST_UTIL_H_INCLUDED
+
+/******************************************************************************
+* Library of replacement/missing functions of the Microsoft's CRT API.
+* Copyright (C) 2020 Michael M. Builov, https://github.com/mbuilov/mscrtx
+* Licensed under GPL version 3 or any later version, see COPYING
+******************************************************************************/
+
+/* test_util.h */
+
+/* Helpers shared by the tests: pseudo-random numbers, time and wide-string length.
+   Define TEST_SEED before including this header to get a different sequence.  */
+
+#include <stddef.h>
+#include <wchar.h>
+#include <time.h>
+
+/* Deterministic pseudo-random numbers, so failures are reproducible.  */
+#ifndef TEST_SEED
+#define TEST_SEED 1
+#endif
+
+static unsigned long g_seed = TEST_SEED;
+
+/* returns a number in the range [0, n) */
+static inline unsigned rnd(const unsigned n)
+{
+	g_seed = g_seed*1103515245ul + 12345ul;
+	return (unsigned)((g_seed >> 16) & 0x7FFF) % n;
+}
+
+/* monotonic time in seconds */
+static inline double seconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+/* length of the 2-byte wide-character string: glibc wcslen() expects 4-byte wchar_t,
+  while most tests are compiled with -fshort-wchar */
+static inline size_t wlen(const wchar_t s[])
+{
+	const wchar_t *e = s;
+	while (*e)
+		e++;
+	return (size_t)(e - s);
+}
+
+#endif /* TEST_UTIL_H_INCLUDED */